@@ -0,0 +1,621 @@
+#pragma once
+
+#include <bamit/BgzfReader.hpp>
+#include <bamit/BgzfWriter.hpp>
+#include <bamit/Record.hpp>
+#include <bamit/ThreadPool.hpp>
+
+#include <array>
+#include <concepts>
+#include <deque>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+namespace bamit
+{
+/*!
+   \brief Get the number of reference bases covered by the cigar operations of a BAM record, like bamit::get_length.
+   \param cigar The cigar operations as stored in the BAM record.
+   \param count The number of cigar operations.
+   \return Returns the number of M/I/D/=/X bases.
+*/
+inline int32_t bam_cigar_length(char const * cigar, uint16_t const count)
+{
+    int32_t length{0};
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        uint32_t c{};
+        std::memcpy(&c, cigar + 4 * i, 4);
+        uint32_t const op = c & 0xF;
+        if (op <= 2 || op == 7 || op == 8) length += c >> 4;
+    }
+    return length;
+}
+
+/*! The BamScanner class reads the records of a BAM file without decoding them into full alignment records. For every
+ *  record, only the fixed-size part of the BAM record and the raw cigar operations are read; the read name, sequence,
+ *  qualities and tags are skipped. This is all bamit::index needs to know about a record.
+ */
+class BamScanner
+{
+private:
+    BgzfReader reader;
+    std::string header_text{};
+    std::string sorting{};
+    std::vector<std::string> ref_names{};
+    std::vector<uint32_t> ref_lengths{};
+
+    std::streamoff cur_file_position{-1};
+    int32_t cur_ref_id{-1};
+    int32_t cur_position{-1};
+    uint16_t cur_flag{0};
+    int32_t cur_length{0};
+    std::vector<uint32_t> cigar{};
+
+    /*!
+       \brief Read a little-endian integer.
+       \return Returns the integer.
+    */
+    template <typename int_type>
+    int_type read_integer()
+    {
+        int_type value{};
+        if (reader.read(reinterpret_cast<char *>(&value), sizeof(int_type)) != sizeof(int_type))
+            throw std::runtime_error{"ERROR: Unexpected end of BAM file."};
+        return value;
+    }
+
+    /*!
+       \brief Read a string of a given size.
+       \param size The number of characters.
+       \return Returns the string.
+    */
+    std::string read_string(size_t const size)
+    {
+        std::string value(size, '\0');
+        if (reader.read(value.data(), size) != size)
+            throw std::runtime_error{"ERROR: Unexpected end of BAM file."};
+        return value;
+    }
+
+    /*!
+       \brief Read the header of the BAM file.
+    */
+    void read_header()
+    {
+        if (read_string(4) != std::string{"BAM\1", 4})
+            throw std::runtime_error{"ERROR: Input file is not a BAM file."};
+        header_text = read_string(read_integer<int32_t>());
+        // Strip the padding some writers add after the header text.
+        header_text.erase(std::find(header_text.begin(), header_text.end(), '\0'), header_text.end());
+
+        int32_t const ref_count = read_integer<int32_t>();
+        ref_names.reserve(ref_count);
+        ref_lengths.reserve(ref_count);
+        for (int32_t i = 0; i < ref_count; ++i)
+        {
+            std::string name = read_string(read_integer<int32_t>());
+            name.erase(std::find(name.begin(), name.end(), '\0'), name.end());
+            ref_names.push_back(std::move(name));
+            ref_lengths.push_back(read_integer<uint32_t>());
+        }
+
+        // The sort order is given by the SO tag of the @HD line, which has to be the first line.
+        if (header_text.starts_with("@HD"))
+        {
+            std::string_view const line{header_text.data(), std::min(header_text.find('\n'), header_text.size())};
+            if (size_t tag = line.find("\tSO:"); tag != std::string_view::npos)
+            {
+                std::string_view const value = line.substr(tag + 4);
+                sorting = value.substr(0, value.find('\t'));
+            }
+        }
+    }
+
+    /*!
+       \brief Check whether data looks like the start of a BAM record of this file.
+       \param data The data.
+       \param available The number of bytes available at data.
+       \return Returns the size of the record including its block_size field, or 0 if it does not look like a record.
+       \details Fields which lie beyond the available data are not checked.
+    */
+    size_t plausible_record(char const * data, size_t const available) const
+    {
+        if (available < 36) return 0;
+        int32_t block_size{}, ref_id{}, position{}, seq_length{}, next_ref_id{}, next_position{};
+        uint16_t cigar_count{};
+        std::memcpy(&block_size, data, 4);
+        std::memcpy(&ref_id, data + 4, 4);
+        std::memcpy(&position, data + 8, 4);
+        uint8_t const name_length = static_cast<uint8_t>(data[12]);
+        std::memcpy(&cigar_count, data + 16, 2);
+        std::memcpy(&seq_length, data + 20, 4);
+        std::memcpy(&next_ref_id, data + 24, 4);
+        std::memcpy(&next_position, data + 28, 4);
+
+        int32_t const ref_count = ref_names.size();
+        int64_t const minimum_size = int64_t{32} + name_length + 4 * cigar_count + (int64_t{seq_length} + 1) / 2 +
+                                     seq_length;
+        if (ref_id < -1 || ref_id >= ref_count || next_ref_id < -1 || next_ref_id >= ref_count ||
+            position < -1 || next_position < -1 || name_length == 0 || seq_length < 0 || block_size < minimum_size)
+            return 0;
+
+        // The read name is printable and terminated by a null character.
+        if (available >= 36u + name_length)
+        {
+            if (data[35 + name_length] != '\0') return 0;
+            for (char const * c = data + 36; c < data + 35 + name_length; ++c)
+                if (*c < '!' || *c > '~') return 0;
+        }
+        // The cigar operations are valid and consume as many bases as there are in the sequence.
+        if (available >= 36u + name_length + 4 * cigar_count)
+        {
+            int64_t query_length{0};
+            for (uint16_t i = 0; i < cigar_count; ++i)
+            {
+                uint32_t c{};
+                std::memcpy(&c, data + 36 + name_length + 4 * i, 4);
+                uint32_t const op = c & 0xF;
+                if (op > 8) return 0;
+                if (op <= 1 || op == 4 || op == 7 || op == 8) query_length += c >> 4;
+            }
+            if (cigar_count > 0 && seq_length > 0 && query_length != seq_length) return 0;
+        }
+        return block_size + 4;
+    }
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    BamScanner()                                = delete;  //!< Deleted.
+    BamScanner(BamScanner const &)              = delete;  //!< Deleted.
+    BamScanner(BamScanner &&)                   = default; //!< Defaulted.
+    BamScanner & operator=(BamScanner const &)  = delete;  //!< Deleted.
+    BamScanner & operator=(BamScanner &&)       = default; //!< Defaulted.
+    ~BamScanner()                               = default; //!< Defaulted.
+    //!\}
+
+    /*!
+       \brief Open a BAM file and read its header.
+       \param path The path to the BAM file.
+       \param cache The cache of decompressed blocks of the BAM file, see bamit::BgzfReader. None by default.
+    */
+    explicit BamScanner(std::filesystem::path const & path, BlockCache * const cache = nullptr) :
+        reader{path, cache}
+    {
+        read_header();
+    }
+
+    /*!
+       \brief Read the next record.
+       \return Returns `false` if there are no records left.
+    */
+    bool next()
+    {
+        cur_file_position = reader.tell();
+        if (reader.at_end()) return false;
+
+        // block_size, refID, pos, l_read_name, mapq, bin, n_cigar_op, flag, l_seq, next_refID, next_pos, tlen
+        std::array<char, 36> core{};
+        if (reader.read(core.data(), core.size()) != core.size())
+            throw std::runtime_error{"ERROR: Unexpected end of BAM file."};
+        int32_t block_size{};
+        uint16_t cigar_count{};
+        std::memcpy(&block_size, core.data(), 4);
+        std::memcpy(&cur_ref_id, core.data() + 4, 4);
+        std::memcpy(&cur_position, core.data() + 8, 4);
+        uint8_t const name_length = static_cast<uint8_t>(core[12]);
+        std::memcpy(&cigar_count, core.data() + 16, 2);
+        std::memcpy(&cur_flag, core.data() + 18, 2);
+
+        reader.skip(name_length);
+        cigar.resize(cigar_count);
+        size_t const cigar_size = cigar_count * sizeof(uint32_t);
+        if (reader.read(reinterpret_cast<char *>(cigar.data()), cigar_size) != cigar_size)
+            throw std::runtime_error{"ERROR: Unexpected end of BAM file."};
+        int64_t const remaining = static_cast<int64_t>(block_size) - 32 - name_length - cigar_size;
+        if (remaining < 0 || !reader.skip(remaining))
+            throw std::runtime_error{"ERROR: Corrupt BAM record at file position " +
+                                     std::to_string(cur_file_position) + "."};
+
+        cur_length = bam_cigar_length(reinterpret_cast<char const *>(cigar.data()), cigar_count);
+        return true;
+    }
+
+    /*!
+       \brief Read the next record and append it to a buffer as it is stored in the file.
+       \param data The buffer, to which the record including its block_size field is appended. The record can be
+                   removed again by resizing the buffer to its previous size.
+       \return Returns `false` if there are no records left.
+       \details Like bamit::BamScanner::next, but the whole record is kept, e.g. to cache or copy it.
+    */
+    bool next(std::vector<char> & data)
+    {
+        cur_file_position = reader.tell();
+        if (reader.at_end()) return false;
+
+        size_t const offset = data.size();
+        data.resize(offset + 36);
+        if (reader.read(data.data() + offset, 36) != 36)
+            throw std::runtime_error{"ERROR: Unexpected end of BAM file."};
+        int32_t block_size{};
+        std::memcpy(&block_size, data.data() + offset, 4);
+        if (block_size < 32)
+            throw std::runtime_error{"ERROR: Corrupt BAM record at file position " +
+                                     std::to_string(cur_file_position) + "."};
+        data.resize(offset + 4 + block_size);
+        if (reader.read(data.data() + offset + 36, block_size - 32) != static_cast<size_t>(block_size - 32))
+            throw std::runtime_error{"ERROR: Unexpected end of BAM file."};
+
+        char const * record = data.data() + offset;
+        uint16_t cigar_count{};
+        std::memcpy(&cur_ref_id, record + 4, 4);
+        std::memcpy(&cur_position, record + 8, 4);
+        uint8_t const name_length = static_cast<uint8_t>(record[12]);
+        std::memcpy(&cigar_count, record + 16, 2);
+        std::memcpy(&cur_flag, record + 18, 2);
+        if (32 + name_length + 4 * cigar_count > block_size)
+            throw std::runtime_error{"ERROR: Corrupt BAM record at file position " +
+                                     std::to_string(cur_file_position) + "."};
+        cur_length = bam_cigar_length(record + 36 + name_length, cigar_count);
+        return true;
+    }
+
+    /*!
+       \brief Write the header of the BAM file, followed by the end of a block so that records start in a new block.
+       \param writer The BGZF file to write to.
+    */
+    void write_header(BgzfWriter & writer) const
+    {
+        auto write_integer = [&writer] (auto const value)
+        {
+            writer.write(reinterpret_cast<char const *>(&value), sizeof(value));
+        };
+        writer.write("BAM\1", 4);
+        write_integer(static_cast<int32_t>(header_text.size()));
+        writer.write(header_text.data(), header_text.size());
+        write_integer(static_cast<int32_t>(ref_names.size()));
+        for (size_t i = 0; i < ref_names.size(); ++i)
+        {
+            write_integer(static_cast<int32_t>(ref_names[i].size() + 1));
+            writer.write(ref_names[i].c_str(), ref_names[i].size() + 1);
+            write_integer(ref_lengths[i]);
+        }
+        writer.flush();
+    }
+
+    /*!
+       \brief Get the current position.
+       \return Returns the file position of the record which is read by the next call to bamit::BamScanner::next.
+    */
+    std::streamoff tell()
+    {
+        return reader.tell();
+    }
+
+    /*!
+       \brief Move to a record.
+       \param file_position The file position of the record, as returned by bamit::BamScanner::get_file_position.
+       \details The next call to bamit::BamScanner::next reads the record at the given file position.
+    */
+    void seek(std::streamoff const file_position)
+    {
+        reader.seek(file_position);
+    }
+
+    /*!
+       \brief Move to the first record which starts in the current BGZF block, e.g. after seeking to the start of a
+              block which was found with bamit::bgzf_find_block.
+       \return Returns `false` if no record start was found in the block. The position is undefined then.
+       \details The BAM format does not mark where records start, so this looks for a position at which a chain of
+                plausible records begins. This may be wrong for unusual data, so the result should be verified, e.g.
+                against the position after the last record of the preceding part of the file. See bamit::scan_records.
+    */
+    bool resync()
+    {
+        std::streamoff const origin = reader.tell();
+        size_t const block_size = reader.remaining_in_block();
+        std::vector<char> buffer(3 * bgzf_max_block_size);
+        size_t const available = reader.read(buffer.data(), buffer.size());
+
+        for (size_t i = 0; i < block_size; ++i)
+        {
+            // Accept a position if it and up to three following records look like records.
+            size_t size = plausible_record(buffer.data() + i, available - i);
+            size_t j = i + size;
+            for (size_t chain = 0; size != 0 && chain < 3 && j + 36 <= available; ++chain, j += size)
+                size = plausible_record(buffer.data() + j, available - j);
+            if (size != 0)
+            {
+                reader.seek(origin + i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*!
+       \brief Check whether the current record is unmapped, like bamit::unmapped.
+       \return Returns `true` if the record has no reference sequence or position, or is flagged as unmapped.
+    */
+    bool unmapped() const
+    {
+        return cur_ref_id == -1 || cur_position == -1 || (cur_flag & 4) != 0;
+    }
+
+    //!\brief Returns the file position of the current record.
+    std::streamoff get_file_position() const
+    {
+        return cur_file_position;
+    }
+
+    //!\brief Returns the reference sequence of the current record, -1 if there is none.
+    int32_t get_reference_id() const
+    {
+        return cur_ref_id;
+    }
+
+    //!\brief Returns the 0-based start position of the current record, -1 if there is none.
+    int32_t get_reference_position() const
+    {
+        return cur_position;
+    }
+
+    //!\brief Returns the flag of the current record.
+    uint16_t get_flag() const
+    {
+        return cur_flag;
+    }
+
+    //!\brief Returns the length of the M/I/D/=/X operations of the current record, see bamit::get_length.
+    int32_t get_length() const
+    {
+        return cur_length;
+    }
+
+    //!\brief Returns the header text of the file.
+    std::string const & get_header_text() const
+    {
+        return header_text;
+    }
+
+    //!\brief Returns the sort order given in the header, or an empty string if there is none.
+    std::string const & get_sorting() const
+    {
+        return sorting;
+    }
+
+    //!\brief Returns the names of the reference sequences.
+    std::vector<std::string> const & get_ref_names() const
+    {
+        return ref_names;
+    }
+
+    //!\brief Returns the lengths of the reference sequences.
+    std::vector<uint32_t> const & get_ref_lengths() const
+    {
+        return ref_lengths;
+    }
+};
+
+//!\brief The compressed size of the parts of a BAM file which bamit::scan_records scans in parallel.
+inline constexpr uint64_t parallel_scan_range_size{1 << 26};
+
+/*! The records of a part of a BAM file, as collected by bamit::scan_range. A part consists of whole BGZF blocks and
+ *  holds the records which start in these blocks.
+ */
+struct BamRange
+{
+    //!\brief The reference sequence and bamit::Record of a record, and whether it is unmapped.
+    using entry_type = std::tuple<uint32_t, Record, bool>;
+
+    //!\brief The offset of the first BGZF block of the part.
+    uint64_t block_begin{0};
+    //!\brief The offset of the first BGZF block after the part.
+    uint64_t block_end{0};
+    //!\brief The file position the scan started at, or -1 if no record start was found.
+    std::streamoff begin{-1};
+    //!\brief The file position of the first record after the records collected.
+    std::streamoff next{-1};
+    //!\brief Whether the records collected are all records of the part, i.e. next lies after the part.
+    bool complete{false};
+    //!\brief The reference sequence and bamit::Record of every record collected, and whether it is unmapped.
+    std::vector<entry_type> records{};
+};
+
+/*!
+   \brief Collect the records of a part of a BAM file.
+   \param scanner A scanner positioned at the first record of the part.
+   \param range The part, of which block_end must be set.
+   \param with_unmapped Whether unmapped records are collected as well.
+   \param max_records The number of records after which the scan stops, leaving the rest of the part to the caller.
+                      The space for them is reserved up front, so the records never take more memory. 0 means no limit.
+*/
+inline void scan_range(BamScanner & scanner, BamRange & range, bool const with_unmapped = false,
+                       size_t const max_records = 0)
+{
+    range.begin = scanner.tell();
+    range.complete = false;
+    range.records.clear();
+    if (max_records != 0) range.records.reserve(max_records);
+    while (max_records == 0 || range.records.size() < max_records)
+    {
+        if (!scanner.next() || (static_cast<uint64_t>(scanner.get_file_position()) >> 16) >= range.block_end)
+        {
+            range.next = scanner.get_file_position();
+            range.complete = true;
+            return;
+        }
+        if (scanner.unmapped() && !with_unmapped) continue;
+        uint32_t position = scanner.get_reference_position();
+        range.records.emplace_back(scanner.get_reference_id(), Record{position,
+                                                                      position + scanner.get_length(),
+                                                                      scanner.get_file_position()},
+                                   scanner.unmapped());
+    }
+    range.next = scanner.tell();
+}
+
+/*!
+   \brief Call a function on every mapped record of a BAM file, in the order of the file.
+   \param bam_path The path to the BAM file.
+   \param pool The ThreadPool decompressing and scanning parts of the file in parallel, which may be shared with other
+               work, e.g. the construction of the trees by a bamit::IndexBuilder. With nullptr or a pool of one thread,
+               the file is scanned by the calling thread alone.
+   \param function The callable to call with the reference sequence and the bamit::Record of each mapped record. If
+                   it takes a third argument, it is called with every record instead, and whether the record is
+                   unmapped. The reference sequence and start of records without them are then
+                   `std::numeric_limits<uint32_t>::max()`.
+   \param range_size The compressed size of the parts of the file which are scanned in parallel.
+   \param memory_budget The number of bytes the records collected by the parallel scans may take at once. 0 means no
+                        limit.
+   \return Returns the file position after the last record.
+   \details With more than one thread, the file is split into parts of whole BGZF blocks, which are decompressed and
+            scanned independently. As the BAM format does not mark where records start, the scan of a part starts at
+            a record found by bamit::BamScanner::resync. Before the records of a part are passed on, this start is
+            checked against the end of the preceding part, and the part is scanned again from the correct position if
+            they differ. The records are therefore always the same as the ones of a sequential scan.
+
+            Up to two parts per thread are scanned ahead of the function. Without a memory budget, each of them holds
+            all its records. With a budget, each holds as many as fit into its share of the budget, and the calling
+            thread scans the rest of the part itself, passing the records on as it reads them.
+*/
+template <typename function_type>
+std::streamoff scan_records(std::filesystem::path const & bam_path,
+                            ThreadPool * const pool,
+                            function_type && function,
+                            uint64_t const & range_size = parallel_scan_range_size,
+                            size_t const & memory_budget = 0)
+{
+    constexpr bool with_unmapped = std::invocable<function_type &, uint32_t, Record const &, bool>;
+    auto call = [&function] (uint32_t const ref_id, Record const & record, bool const unmapped)
+    {
+        if constexpr (with_unmapped) function(ref_id, record, unmapped);
+        else function(ref_id, record);
+    };
+    // Pass the records of the scanner on until it leaves the part ending at block_end.
+    auto call_until = [&call] (BamScanner & scanner, uint64_t const block_end)
+    {
+        while (scanner.next() && (static_cast<uint64_t>(scanner.get_file_position()) >> 16) < block_end)
+        {
+            if (scanner.unmapped() && !with_unmapped) continue;
+            uint32_t position = scanner.get_reference_position();
+            call(static_cast<uint32_t>(scanner.get_reference_id()), Record{position,
+                                                                           position + scanner.get_length(),
+                                                                           scanner.get_file_position()},
+                 scanner.unmapped());
+        }
+        return scanner.get_file_position();
+    };
+
+    BamScanner scanner{bam_path};
+    std::streamoff const first_record = scanner.tell();
+
+    // Split the file on block boundaries.
+    std::vector<BamRange> ranges(1);
+    if (pool && pool->size() > 1)
+    {
+        uint64_t const file_size = std::filesystem::file_size(bam_path);
+        std::ifstream file{bam_path, std::ios_base::binary | std::ios_base::in};
+        for (uint64_t offset = range_size; offset < file_size; offset = ranges.back().block_begin + range_size)
+        {
+            uint64_t const block = bgzf_find_block(file, offset, file_size);
+            if (block >= file_size) break;
+            ranges.back().block_end = block;
+            ranges.emplace_back().block_begin = block;
+        }
+    }
+    ranges.back().block_end = std::numeric_limits<uint64_t>::max();
+
+    if (ranges.size() == 1) return call_until(scanner, ranges.back().block_end);
+
+    size_t const window = 2 * pool->size();
+    size_t const max_records = memory_budget == 0 ? 0 :
+                               std::max<size_t>(memory_budget / window / sizeof(BamRange::entry_type), 1);
+    std::deque<std::future<void>> pending{};
+    auto submit = [&] (size_t const i)
+    {
+        pending.push_back(pool->submit([&bam_path, &range = ranges[i], first = i == 0, max_records] ()
+        {
+            try
+            {
+                BamScanner range_scanner{bam_path};
+                if (!first)
+                {
+                    range_scanner.seek(static_cast<std::streamoff>(range.block_begin << 16));
+                    if (!range_scanner.resync()) return;
+                }
+                scan_range(range_scanner, range, with_unmapped, max_records);
+            }
+            catch (std::exception const &)
+            {
+                // A wrong start may run into data which is not a record. The part is scanned again then.
+                range.begin = -1;
+            }
+        }));
+    };
+
+    // The parts in flight refer to the local variables, so they have to finish before an exception leaves this scope.
+    try
+    {
+        for (size_t i = 0; i < std::min(window, ranges.size()); ++i)
+            submit(i);
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            pool->wait(pending.front());
+            pending.pop_front();
+            if (i + window < ranges.size()) submit(i + window);
+
+            std::streamoff const expected = i == 0 ? first_record : ranges[i - 1].next;
+            if (ranges[i].begin != expected)
+            {
+                scanner.seek(expected);
+                scan_range(scanner, ranges[i], with_unmapped, max_records);
+            }
+            for (auto const & [ref_id, record, unmapped] : ranges[i].records)
+                call(ref_id, record, unmapped);
+            ranges[i].records = std::vector<BamRange::entry_type>{};
+            if (!ranges[i].complete)
+            {
+                scanner.seek(ranges[i].next);
+                ranges[i].next = call_until(scanner, ranges[i].block_end);
+            }
+        }
+    }
+    catch (...)
+    {
+        for (auto & task : pending)
+        {
+            try { pool->wait(task); } catch (...) {}
+        }
+        throw;
+    }
+    return ranges.back().next;
+}
+
+/*!
+   \brief Call a function on every mapped record of a BAM file, in the order of the file, on a pool of its own.
+   \param bam_path The path to the BAM file.
+   \param threads The number of threads decompressing and scanning the file.
+   \param function See the overload taking a ThreadPool.
+   \param range_size See the overload taking a ThreadPool.
+   \param memory_budget See the overload taking a ThreadPool.
+   \return Returns the file position after the last record.
+*/
+template <typename function_type>
+std::streamoff scan_records(std::filesystem::path const & bam_path,
+                            uint16_t const & threads,
+                            function_type && function,
+                            uint64_t const & range_size = parallel_scan_range_size,
+                            size_t const & memory_budget = 0)
+{
+    std::optional<ThreadPool> pool{};
+    if (threads > 1) pool.emplace(threads);
+    return scan_records(bam_path, pool ? &*pool : nullptr, std::forward<function_type>(function), range_size,
+                        memory_budget);
+}
+} // namespace bamit
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <bamit/BlockCache.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace bamit
+{
+//!\brief The largest possible size of a compressed or decompressed BGZF block.
+inline constexpr size_t bgzf_max_block_size{1 << 16};
+
+/*!
+   \brief Get the size of a BGZF block from its header.
+   \param header The first 18 bytes of the block, or more.
+   \param size The number of bytes available at header.
+   \return Returns the total size of the compressed block including its header, or 0 if header is not the start of a
+           BGZF block or the size is too small for the header and footer. It is at most bamit::bgzf_max_block_size.
+*/
+inline size_t bgzf_block_size(char const * header, size_t const size)
+{
+    auto const * bytes = reinterpret_cast<unsigned char const *>(header);
+    if (size < 18 || bytes[0] != 31 || bytes[1] != 139 || bytes[2] != 8 || (bytes[3] & 4) == 0) return 0;
+    size_t const extra_length = bytes[10] | (bytes[11] << 8);
+    // Find the BC subfield holding the block size among the extra subfields.
+    for (size_t i = 12; i + 4 <= 12 + extra_length && i + 6 <= size; i += 4 + (bytes[i + 2] | (bytes[i + 3] << 8)))
+    {
+        if (bytes[i] == 'B' && bytes[i + 1] == 'C' && (bytes[i + 2] | (bytes[i + 3] << 8)) == 2)
+        {
+            // The block must hold its header, the extra subfields and the CRC32 and ISIZE footer.
+            size_t const block_size = (bytes[i + 4] | (bytes[i + 5] << 8)) + 1;
+            return block_size >= 12 + extra_length + 8 ? block_size : 0;
+        }
+    }
+    return 0;
+}
+
+/*!
+   \brief Decompress a BGZF block.
+   \param block The complete compressed block including its header.
+   \param size The total size of the compressed block, as returned by bamit::bgzf_block_size.
+   \param output Receives the decompressed data.
+*/
+inline void bgzf_inflate_block(char const * block, size_t const size, std::vector<char> & output)
+{
+    auto const * bytes = reinterpret_cast<unsigned char const *>(block);
+    size_t const extra_length = bytes[10] | (bytes[11] << 8);
+    size_t const data_offset = 12 + extra_length;
+    uint32_t decompressed_size{};
+    std::memcpy(&decompressed_size, block + size - 4, 4);
+    if (decompressed_size > bgzf_max_block_size)
+        throw std::runtime_error{"ERROR: Corrupt BGZF block."};
+    output.resize(decompressed_size);
+    if (decompressed_size == 0) return;
+
+    z_stream stream{};
+    if (inflateInit2(&stream, -15) != Z_OK)
+        throw std::runtime_error{"ERROR: Could not initialise zlib."};
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(block + data_offset));
+    stream.avail_in = size - data_offset - 8;
+    stream.next_out = reinterpret_cast<Bytef *>(output.data());
+    stream.avail_out = decompressed_size;
+    int const status = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if (status != Z_STREAM_END || stream.avail_out != 0)
+        throw std::runtime_error{"ERROR: Corrupt BGZF block."};
+}
+
+/*!
+   \brief Find the first BGZF block at or after an offset in a file.
+   \param file The file to search.
+   \param offset The offset to start searching at.
+   \param file_size The size of the file.
+   \return Returns the offset of the block, or file_size if there is none.
+   \details A block is recognised by its header, which is only accepted if it is followed by another block header or
+            the end of the file. This makes it unlikely to mistake compressed data for the start of a block.
+*/
+inline uint64_t bgzf_find_block(std::istream & file, uint64_t offset, uint64_t const file_size)
+{
+    std::vector<char> window(2 * bgzf_max_block_size);
+    std::array<char, 18> header{};
+    for (; offset < file_size; offset += bgzf_max_block_size)
+    {
+        file.clear();
+        file.seekg(offset);
+        file.read(window.data(), window.size());
+        size_t const available = file.gcount();
+        for (size_t i = 0; i < std::min<size_t>(available, bgzf_max_block_size); ++i)
+        {
+            size_t const size = bgzf_block_size(window.data() + i, available - i);
+            if (size == 0) continue;
+            uint64_t const next = offset + i + size;
+            if (next == file_size) return offset + i;
+            file.clear();
+            file.seekg(next);
+            if (file.read(header.data(), header.size()) && bgzf_block_size(header.data(), header.size()) != 0)
+                return offset + i;
+        }
+    }
+    return file_size;
+}
+
+/*! The BgzfReader class reads the decompressed data of a BGZF compressed file, e.g. a BAM file, one block at a time.
+ *  Positions in the file are BGZF virtual offsets: the offset of a compressed block in the file shifted left by 16
+ *  bits, combined with the offset within the decompressed block. These are the file positions used throughout bamit.
+ *
+ *  Readers of the same file can share a bamit::BlockCache, so that a block is decompressed once for all of them.
+ */
+class BgzfReader
+{
+private:
+    std::ifstream file{};
+    std::vector<char> compressed{};
+    std::vector<char> inflated{}; // The current block if there is no cache.
+    std::shared_ptr<std::vector<char> const> shared_block{nullptr}; // The current block if there is a cache.
+    std::span<char const> block{};
+    BlockCache * cache{nullptr};
+    size_t block_position{0};
+    uint64_t block_offset{0};
+    uint64_t next_block_offset{0};
+    uint64_t data_end_offset{0};
+    uint64_t file_size{0};
+
+    /*!
+       \brief Load and decompress the block starting at a given offset in the file, or take it from the cache.
+       \param offset The offset of the compressed block.
+       \return Returns `false` if there is no block at the offset, i.e. the end of the file was reached.
+    */
+    bool load_block(uint64_t const offset)
+    {
+        block = {};
+        block_position = 0;
+        block_offset = offset;
+        next_block_offset = offset;
+        if (offset >= file_size) return false;
+        if (std::optional<CachedBlock> cached = cache ? cache->find(offset) : std::nullopt)
+        {
+            shared_block = std::move(cached->data);
+            next_block_offset = cached->next_offset;
+        }
+        else
+        {
+            compressed.resize(bgzf_max_block_size);
+            file.clear();
+            file.seekg(offset);
+            if (!file.read(compressed.data(), 18)) return false;
+            size_t const size = bgzf_block_size(compressed.data(), 18);
+            if (size == 0 || !file.read(compressed.data() + 18, size - 18))
+                throw std::runtime_error{"ERROR: Corrupt BGZF block at offset " + std::to_string(offset) + "."};
+            next_block_offset = offset + size;
+            if (cache)
+            {
+                auto data = std::make_shared<std::vector<char>>();
+                bgzf_inflate_block(compressed.data(), size, *data);
+                shared_block = std::move(data);
+                cache->insert(offset, CachedBlock{shared_block, next_block_offset});
+            }
+            else
+            {
+                bgzf_inflate_block(compressed.data(), size, inflated);
+            }
+        }
+        block = cache ? std::span<char const>{*shared_block} : std::span<char const>{inflated};
+        // An empty block, e.g. the end-of-file marker, ends the data at its own start, also if it was seeked to.
+        data_end_offset = block.empty() ? offset : next_block_offset;
+        return true;
+    }
+
+    /*!
+       \brief Make sure the current position is inside a block with data left, skipping empty blocks.
+       \return Returns `false` at the end of the file.
+    */
+    bool fill()
+    {
+        while (block_position >= block.size())
+        {
+            if (!load_block(next_block_offset)) return false;
+        }
+        return true;
+    }
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    BgzfReader()                                = delete;  //!< Deleted.
+    BgzfReader(BgzfReader const &)              = delete;  //!< Deleted.
+    BgzfReader(BgzfReader &&)                   = default; //!< Defaulted.
+    BgzfReader & operator=(BgzfReader const &)  = delete;  //!< Deleted.
+    BgzfReader & operator=(BgzfReader &&)       = default; //!< Defaulted.
+    ~BgzfReader()                               = default; //!< Defaulted.
+    //!\}
+
+    /*!
+       \brief Open a BGZF compressed file and position the reader at its start.
+       \param path The path to the file.
+       \param cache_i The cache of decompressed blocks of the file, which must outlive the reader. Blocks are
+                     decompressed by the reader alone if it is nullptr, the default.
+    */
+    explicit BgzfReader(std::filesystem::path const & path, BlockCache * const cache_i = nullptr) :
+        file{path, std::ios_base::binary | std::ios_base::in},
+        cache{cache_i}
+    {
+        if (!file.is_open())
+            throw std::runtime_error{"ERROR: Could not open " + path.string() + "."};
+        file.seekg(0, std::ios_base::end);
+        file_size = static_cast<uint64_t>(file.tellg());
+        load_block(0);
+    }
+
+    /*!
+       \brief Read decompressed data.
+       \param buffer Where to store the data.
+       \param count The number of bytes to read.
+       \return Returns the number of bytes read, which is less than count only at the end of the file.
+    */
+    size_t read(char * buffer, size_t const count)
+    {
+        size_t done{0};
+        while (done < count && fill())
+        {
+            size_t const n = std::min(count - done, block.size() - block_position);
+            std::memcpy(buffer + done, block.data() + block_position, n);
+            block_position += n;
+            done += n;
+        }
+        return done;
+    }
+
+    /*!
+       \brief Skip decompressed data.
+       \param count The number of bytes to skip.
+       \return Returns `false` if the end of the file was reached before.
+    */
+    bool skip(size_t count)
+    {
+        while (count > 0 && fill())
+        {
+            size_t const n = std::min(count, block.size() - block_position);
+            block_position += n;
+            count -= n;
+        }
+        return count == 0;
+    }
+
+    /*!
+       \brief Get the current position.
+       \return Returns the virtual offset of the next byte to be read. At the end of a block, this is the start of
+               the next non-empty block. At the end of the file, this is the start of the last empty block read, i.e.
+               of the end-of-file marker, as htslib reports it.
+    */
+    std::streamoff tell()
+    {
+        if (!fill()) return static_cast<std::streamoff>(data_end_offset << 16);
+        return static_cast<std::streamoff>((block_offset << 16) | block_position);
+    }
+
+    /*!
+       \brief Move to a position.
+       \param virtual_offset The virtual offset to move to, e.g. as returned by bamit::BgzfReader::tell.
+    */
+    void seek(std::streamoff const virtual_offset)
+    {
+        uint64_t const offset = static_cast<uint64_t>(virtual_offset) >> 16;
+        if (offset != block_offset || block.empty()) load_block(offset);
+        block_position = static_cast<uint64_t>(virtual_offset) & 0xFFFF;
+    }
+
+    /*!
+       \brief Get the number of decompressed bytes left in the current block.
+       \return Returns the number of bytes which can be read before the next block is loaded. This is 0 only at the
+               end of the file.
+    */
+    size_t remaining_in_block()
+    {
+        if (!fill()) return 0;
+        return block.size() - block_position;
+    }
+
+    /*!
+       \brief Check whether all data was read.
+       \return Returns `true` at the end of the file.
+    */
+    bool at_end()
+    {
+        return !fill();
+    }
+};
+} // namespace bamit
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <bamit/BgzfReader.hpp>
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace bamit
+{
+//!\brief The largest amount of data stored in one BGZF block, small enough for its compressed size to fit the header.
+inline constexpr size_t bgzf_block_data_size{0xff00};
+
+/*! The BgzfWriter class writes data to a BGZF compressed file, e.g. a BAM file. Data is collected until a block is
+ *  full and then compressed into a block. Blocks which are already compressed, e.g. taken from another BGZF file, can be
+ *  copied into the file as they are.
+ */
+class BgzfWriter
+{
+private:
+    std::ofstream file{};
+    std::vector<char> buffer{};
+    std::vector<char> compressed{};
+    int level{Z_DEFAULT_COMPRESSION};
+    bool closed{false};
+
+    /*!
+       \brief Compress data into one block.
+       \param data The data.
+       \param size The number of bytes at data, at most bamit::bgzf_block_data_size.
+       \param block_level The zlib compression level.
+       \return Returns the size of the compressed block, or 0 if it did not fit.
+    */
+    size_t deflate_block(char const * data, size_t const size, int const block_level)
+    {
+        // Header with the BC subfield holding the block size, which is filled in once it is known.
+        constexpr std::array<unsigned char, 18> header{31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0};
+        compressed.resize(bgzf_max_block_size);
+        std::memcpy(compressed.data(), header.data(), header.size());
+
+        z_stream stream{};
+        if (deflateInit2(&stream, block_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error{"ERROR: Could not initialise zlib."};
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        stream.avail_in = size;
+        stream.next_out = reinterpret_cast<Bytef *>(compressed.data() + header.size());
+        stream.avail_out = compressed.size() - header.size() - 8;
+        int const status = deflate(&stream, Z_FINISH);
+        deflateEnd(&stream);
+        if (status != Z_STREAM_END) return 0;
+
+        size_t const block_size = header.size() + stream.total_out + 8;
+        uint32_t const crc = crc32(crc32(0, nullptr, 0), reinterpret_cast<Bytef const *>(data), size);
+        uint32_t const data_size = size;
+        std::memcpy(compressed.data() + block_size - 8, &crc, 4);
+        std::memcpy(compressed.data() + block_size - 4, &data_size, 4);
+        compressed[16] = static_cast<char>((block_size - 1) & 0xFF);
+        compressed[17] = static_cast<char>((block_size - 1) >> 8);
+        return block_size;
+    }
+
+    /*!
+       \brief Compress data into one block and write it.
+       \param data The data.
+       \param size The number of bytes at data, at most bamit::bgzf_block_data_size.
+    */
+    void write_block(char const * data, size_t const size)
+    {
+        size_t block_size = deflate_block(data, size, level);
+        if (block_size == 0) block_size = deflate_block(data, size, 0); // Incompressible data is stored.
+        if (block_size == 0)
+            throw std::runtime_error{"ERROR: Could not compress BGZF block."};
+        if (!file.write(compressed.data(), block_size))
+            throw std::runtime_error{"ERROR: Could not write BGZF block."};
+    }
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    BgzfWriter()                                = delete;  //!< Deleted.
+    BgzfWriter(BgzfWriter const &)              = delete;  //!< Deleted.
+    BgzfWriter(BgzfWriter &&)                   = default; //!< Defaulted.
+    BgzfWriter & operator=(BgzfWriter const &)  = delete;  //!< Deleted.
+    BgzfWriter & operator=(BgzfWriter &&)       = default; //!< Defaulted.
+
+    /*!
+       \brief Create a BGZF compressed file.
+       \param path The path to the file, which is overwritten if it exists.
+       \param level_i The zlib compression level of the blocks written.
+    */
+    explicit BgzfWriter(std::filesystem::path const & path, int const level_i = Z_DEFAULT_COMPRESSION) :
+        file{path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc},
+        level{level_i}
+    {
+        if (!file.is_open())
+            throw std::runtime_error{"ERROR: Could not open " + path.string() + "."};
+        buffer.reserve(bgzf_block_data_size);
+    }
+
+    //!\brief Write the remaining data and the end-of-file marker, unless bamit::BgzfWriter::close was called.
+    ~BgzfWriter()
+    {
+        try
+        {
+            close();
+        }
+        catch (...)
+        {
+        }
+    }
+    //!\}
+
+    /*!
+       \brief Write data, compressing it into blocks as they become full.
+       \param data The data.
+       \param size The number of bytes at data.
+    */
+    void write(char const * data, size_t size)
+    {
+        while (size > 0)
+        {
+            size_t const n = std::min(size, bgzf_block_data_size - buffer.size());
+            buffer.insert(buffer.end(), data, data + n);
+            data += n;
+            size -= n;
+            if (buffer.size() == bgzf_block_data_size) flush();
+        }
+    }
+
+    /*!
+       \brief Compress the data written so far into a block, even if it is not full.
+    */
+    void flush()
+    {
+        if (buffer.empty()) return;
+        write_block(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    /*!
+       \brief Copy a compressed block into the file as it is, after the data written so far.
+       \param block The complete compressed block including its header.
+       \param size The total size of the compressed block, as returned by bamit::bgzf_block_size.
+    */
+    void write_compressed_block(char const * block, size_t const size)
+    {
+        flush();
+        if (!file.write(block, size))
+            throw std::runtime_error{"ERROR: Could not write BGZF block."};
+    }
+
+    /*!
+       \brief Write the remaining data and the empty block marking the end of a BGZF file, and close the file.
+    */
+    void close()
+    {
+        if (closed) return;
+        closed = true;
+        flush();
+        write_block(nullptr, 0);
+        file.close();
+        if (file.fail())
+            throw std::runtime_error{"ERROR: Could not write BGZF file."};
+    }
+};
+} // namespace bamit
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <bamit/BgzfWriter.hpp>
+#include <bamit/Record.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bamit
+{
+/*! The BinningIndex class collects the standard index of a coordinate sorted BAM file, as read by htslib and samtools,
+ *  and writes it as BAI or CSI file. It is filled from the same records as the interval trees, see bamit::index, so
+ *  the file does not have to be read again by `samtools index`.
+ *
+ *  The index follows htslib: every record is put into the smallest bin of the binning scheme containing it, records
+ *  in the same bin which follow each other form a chunk, and every window of 2^min_shift positions gets the file
+ *  position of the first record overlapping it. Small bins are merged into their parents and chunks starting in the
+ *  same BGZF block are merged, so the file is the one `samtools index` writes.
+ */
+class BinningIndex
+{
+private:
+    //!\brief A bin with the chunks of records in it, as pairs of the file positions of the first record and after the last.
+    struct Bin
+    {
+        uint64_t loffset{0};
+        std::vector<std::pair<uint64_t, uint64_t>> chunks{};
+    };
+
+    //!\brief The index of a reference sequence.
+    struct Reference
+    {
+        std::map<uint32_t, Bin> bins{};
+        std::vector<uint64_t> windows{};
+        uint64_t begin{0}, end{0};
+        uint64_t mapped{0}, unmapped{0};
+    };
+
+    //!\brief The value of windows no record overlaps, until bamit::BinningIndex::finish.
+    static constexpr uint64_t unset{std::numeric_limits<uint64_t>::max()};
+    //!\brief The bins whose chunks span fewer compressed bytes than this are merged into their parents.
+    static constexpr uint64_t min_bin_span{0x10000};
+
+    bool csi{false};
+    int32_t min_shift{14};
+    int32_t depth{5};
+    std::vector<Reference> references{};
+    uint64_t no_coordinate{0};
+    // The chunk being collected.
+    uint32_t cur_ref{std::numeric_limits<uint32_t>::max()};
+    uint32_t cur_bin{std::numeric_limits<uint32_t>::max()};
+    uint64_t cur_begin{0};
+
+    //!\brief Returns the first bin of a level.
+    static uint32_t first_bin(int32_t const level)
+    {
+        return ((1u << 3 * level) - 1) / 7;
+    }
+
+    //!\brief Returns the number of bins, which is also the pseudo-bin holding the metadata of a reference.
+    uint32_t bin_count() const
+    {
+        return ((1u << (3 * depth + 3)) - 1) / 7;
+    }
+
+    //!\brief Returns the level of a bin.
+    static int32_t bin_level(uint32_t bin)
+    {
+        int32_t level{0};
+        for (; bin != 0; bin = (bin - 1) >> 3)
+            ++level;
+        return level;
+    }
+
+    /*!
+       \brief Add the chunk being collected to its bin.
+       \param end The file position after the last record of the chunk.
+    */
+    void close_chunk(uint64_t const end)
+    {
+        if (cur_bin == std::numeric_limits<uint32_t>::max()) return;
+        references[cur_ref].bins[cur_bin].chunks.emplace_back(cur_begin, end);
+        references[cur_ref].end = end;
+        cur_bin = std::numeric_limits<uint32_t>::max();
+    }
+
+    /*!
+       \brief Merge small bins into their parents and chunks starting in the same BGZF block, like htslib.
+       \param reference The reference.
+    */
+    void compress(Reference & reference) const
+    {
+        for (int32_t level = depth; level > 0; --level)
+        {
+            auto it = reference.bins.lower_bound(first_bin(level));
+            auto const last = reference.bins.lower_bound(first_bin(level + 1));
+            while (it != last)
+            {
+                auto & chunks = it->second.chunks;
+                std::ranges::sort(chunks);
+                auto parent = reference.bins.find((it->first - 1) >> 3);
+                if ((chunks.back().second >> 16) - (chunks.front().first >> 16) >= min_bin_span ||
+                    parent == reference.bins.end())
+                {
+                    ++it;
+                    continue;
+                }
+                parent->second.chunks.insert(parent->second.chunks.end(), chunks.begin(), chunks.end());
+                it = reference.bins.erase(it);
+            }
+        }
+
+        for (auto & [bin, contents] : reference.bins)
+        {
+            auto & chunks = contents.chunks;
+            std::ranges::sort(chunks);
+            size_t merged{0};
+            for (size_t i = 1; i < chunks.size(); ++i)
+            {
+                if ((chunks[merged].second >> 16) >= (chunks[i].first >> 16))
+                    chunks[merged].second = std::max(chunks[merged].second, chunks[i].second);
+                else
+                    chunks[++merged] = chunks[i];
+            }
+            chunks.resize(merged + 1);
+        }
+    }
+
+    /*!
+       \brief Write the index.
+       \param write_integer Writes an integer to the file.
+    */
+    template <typename write_type>
+    void write_contents(write_type && write_integer) const
+    {
+        write_integer(static_cast<int32_t>(references.size()));
+        for (Reference const & reference : references)
+        {
+            bool const has_records = reference.mapped + reference.unmapped > 0;
+            write_integer(static_cast<int32_t>(reference.bins.size() + has_records));
+            for (auto const & [bin, contents] : reference.bins)
+            {
+                write_integer(bin);
+                if (csi) write_integer(contents.loffset);
+                write_integer(static_cast<int32_t>(contents.chunks.size()));
+                for (auto const & [begin, end] : contents.chunks)
+                {
+                    write_integer(begin);
+                    write_integer(end);
+                }
+            }
+            if (has_records)
+            {
+                write_integer(bin_count() + 1);
+                if (csi) write_integer(uint64_t{0});
+                write_integer(int32_t{2});
+                write_integer(reference.begin);
+                write_integer(reference.end);
+                write_integer(reference.mapped);
+                write_integer(reference.unmapped);
+            }
+            if (csi) continue;
+            write_integer(static_cast<int32_t>(reference.windows.size()));
+            for (uint64_t const offset : reference.windows)
+                write_integer(offset);
+        }
+        write_integer(no_coordinate);
+    }
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    BinningIndex()                                  = delete;  //!< Deleted.
+    BinningIndex(BinningIndex const &)              = default; //!< Defaulted.
+    BinningIndex(BinningIndex &&)                   = default; //!< Defaulted.
+    BinningIndex & operator=(BinningIndex const &)  = default; //!< Defaulted.
+    BinningIndex & operator=(BinningIndex &&)       = default; //!< Defaulted.
+    ~BinningIndex()                                 = default; //!< Defaulted.
+
+    /*!
+       \brief Prepare an empty index.
+       \param ref_lengths The lengths of the reference sequences, see bamit::BamScanner::get_ref_lengths.
+       \param csi_i Whether to write a CSI instead of a BAI index. BAI indices cannot hold references longer than
+                    2^29 - 1.
+       \param min_shift_i The size of the smallest bins as power of 2. Only used for CSI indices, BAI indices use 14.
+    */
+    explicit BinningIndex(std::vector<uint32_t> const & ref_lengths, bool const csi_i = false,
+                          int32_t const min_shift_i = 14) :
+        csi{csi_i},
+        references(ref_lengths.size())
+    {
+        uint64_t const max_length = ref_lengths.empty() ? 0 : std::ranges::max(ref_lengths);
+        if (!csi)
+        {
+            if (max_length >= (uint64_t{1} << 29))
+                throw std::runtime_error{"ERROR: References longer than 2^29 - 1 cannot be indexed by BAI. Please "
+                                         "write a CSI index."};
+            return;
+        }
+        // Like htslib, use as many levels as needed to cover the longest reference.
+        min_shift = min_shift_i;
+        depth = 0;
+        for (uint64_t size = uint64_t{1} << min_shift; max_length + 256 > size; size <<= 3)
+            ++depth;
+    }
+    //!\}
+
+    /*!
+       \brief Get the bin of a region.
+       \param begin The 0-based start of the region.
+       \param end The position after the region.
+       \return Returns the smallest bin containing the region.
+    */
+    uint32_t region_to_bin(int64_t const begin, int64_t end) const
+    {
+        --end;
+        int32_t shift = min_shift;
+        for (int32_t level = depth; level > 0; --level, shift += 3)
+        {
+            if (begin >> shift == end >> shift) return first_bin(level) + (begin >> shift);
+        }
+        return 0;
+    }
+
+    /*!
+       \brief Add the next record of a coordinate sorted BAM file.
+       \param ref_id The reference sequence of the record, `std::numeric_limits<uint32_t>::max()` if it has none.
+       \param record The record. Its start is `std::numeric_limits<uint32_t>::max()` if it has no position.
+       \param unmapped Whether the record is unmapped. Unmapped records with a position are indexed at it.
+       \details Records must be added in the order of the file, including unmapped ones, as the chunks end at the
+                file position of the next record.
+    */
+    void add(uint32_t const ref_id, Record const & record, bool const unmapped)
+    {
+        uint64_t const offset = static_cast<uint64_t>(record.file_position);
+        if (ref_id == std::numeric_limits<uint32_t>::max() || record.start == std::numeric_limits<uint32_t>::max())
+        {
+            close_chunk(offset);
+            cur_ref = std::numeric_limits<uint32_t>::max();
+            ++no_coordinate;
+            return;
+        }
+        if (ref_id >= references.size())
+            throw std::runtime_error{"ERROR: Record at file position " + std::to_string(offset) +
+                                     " refers to an unknown reference sequence."};
+
+        // Like htslib, unmapped records and records without length cover their start.
+        int64_t const begin = record.start;
+        int64_t const end = unmapped ? begin + 1 : std::max<int64_t>(record.end, begin + 1);
+        uint32_t const bin = region_to_bin(begin, end);
+        if (ref_id != cur_ref || bin != cur_bin)
+        {
+            close_chunk(offset);
+            if (ref_id != cur_ref) references[ref_id].begin = offset;
+            cur_ref = ref_id;
+            cur_bin = bin;
+            cur_begin = offset;
+        }
+
+        Reference & reference = references[ref_id];
+        ++(unmapped ? reference.unmapped : reference.mapped);
+        size_t const last_window = (end - 1) >> min_shift;
+        if (reference.windows.size() <= last_window) reference.windows.resize(last_window + 1, unset);
+        for (size_t window = begin >> min_shift; window <= last_window; ++window)
+        {
+            if (reference.windows[window] == unset) reference.windows[window] = offset;
+        }
+    }
+
+    /*!
+       \brief Complete the index after the last record was added.
+       \param end_of_file The file position after the last record, e.g. as returned by bamit::scan_records.
+    */
+    void finish(std::streamoff const end_of_file)
+    {
+        close_chunk(end_of_file);
+        cur_ref = std::numeric_limits<uint32_t>::max();
+        for (Reference & reference : references)
+        {
+            // Windows no record overlaps get the position of the records before them, like htslib.
+            uint64_t previous = reference.begin;
+            for (uint64_t & offset : reference.windows)
+            {
+                if (offset == unset) offset = previous;
+                previous = offset;
+            }
+            for (auto & [bin, contents] : reference.bins)
+            {
+                int32_t const level = bin_level(bin);
+                size_t const window = static_cast<size_t>(bin - first_bin(level)) << 3 * (depth - level);
+                contents.loffset = window < reference.windows.size() ? reference.windows[window] : 0;
+            }
+            compress(reference);
+        }
+    }
+
+    /*!
+       \brief Write the index to a file.
+       \param path The path of the index file, which is overwritten if it exists. BAM files are usually indexed as
+                   `<file>.bam.bai` or `<file>.bam.csi`.
+       \details BAI files are written as they are, CSI files are BGZF compressed. Call bamit::BinningIndex::finish
+                first.
+    */
+    void write(std::filesystem::path const & path) const
+    {
+        if (csi)
+        {
+            BgzfWriter writer{path};
+            auto write_integer = [&writer] (auto const value)
+            {
+                writer.write(reinterpret_cast<char const *>(&value), sizeof(value));
+            };
+            writer.write("CSI\1", 4);
+            write_integer(min_shift);
+            write_integer(depth);
+            write_integer(int32_t{0});
+            write_contents(write_integer);
+            writer.close();
+            return;
+        }
+
+        std::ofstream out{path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc};
+        if (!out.is_open())
+            throw std::runtime_error{"ERROR: Could not open " + path.string() + "."};
+        out.write("BAI\1", 4);
+        write_contents([&out] (auto const value)
+        {
+            out.write(reinterpret_cast<char const *>(&value), sizeof(value));
+        });
+        out.close();
+        if (out.fail())
+            throw std::runtime_error{"ERROR: Could not write " + path.string() + "."};
+    }
+
+    //!\brief Returns whether the index is written as CSI.
+    bool is_csi() const
+    {
+        return csi;
+    }
+};
+} // namespace bamit
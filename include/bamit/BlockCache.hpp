@@ -0,0 +1,37 @@
+#pragma once
+
+#include <bamit/LruCache.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace bamit
+{
+/*! A decompressed BGZF block as stored by a bamit::BlockCache. */
+struct CachedBlock
+{
+    //!\brief The decompressed data of the block.
+    std::shared_ptr<std::vector<char> const> data{nullptr};
+    //!\brief The offset of the compressed block following it in the file.
+    uint64_t next_offset{0};
+};
+
+//!\brief Gets the memory taken by the data of a bamit::CachedBlock.
+struct CachedBlockSize
+{
+    size_t operator()(CachedBlock const & block) const
+    {
+        return block.data ? sizeof(std::vector<char>) + 2 * sizeof(void *) + block.data->capacity() : 0;
+    }
+};
+
+/*! The BlockCache keeps recently decompressed BGZF blocks of one file, so that readers of the file do not decompress
+ *  the same blocks again, e.g. for nearby queries. Blocks are looked up by the offset of the compressed block in the
+ *  file. A decompressed block takes up to 64 KiB of the budget, see bamit::LruCache.
+ *
+ *  A cache is shared by passing it to every bamit::BgzfReader or bamit::BamScanner of the file; it must not be shared
+ *  between different files, as the offsets would mix. Blocks handed out stay valid after they were dropped.
+ */
+using BlockCache = LruCache<uint64_t, CachedBlock, CachedBlockSize>;
+} // namespace bamit
@@ -0,0 +1,206 @@
+#pragma once
+#include <seqan3/core/debug_stream.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <bamit/IntervalNode.hpp>
+
+#include <limits>
+#include <stdexcept>
+
+namespace bamit
+{
+/*! The FlatIntervalTree class stores the interval tree of a single chromosome in contiguous memory instead of as
+ *  individually allocated IntervalNodes. The nodes are laid out in breadth-first (Eytzinger) order, i.e. the children
+ *  of the node at index i are found at 2i + 1 and 2i + 2, so no child pointers are stored and a query walks down the
+ *  arrays without chasing pointers. The start, end and file position of every node are kept in parallel arrays.
+ *
+ *  Slots of the layout which do not hold a node are marked with FlatIntervalTree::no_node as file position. As
+ *  bamit::split_records keeps every subtree built by bamit::construct_tree at most half the size of its parent, also
+ *  with an approximate median, a tree over n records has at most log2(n) + 1 levels and the layout at most 2n slots.
+ */
+class FlatIntervalTree
+{
+private:
+    std::vector<uint32_t> starts{};
+    std::vector<uint32_t> ends{};
+    std::vector<std::streamoff> file_positions{};
+
+    /*!
+       \brief Get the number of levels of a tree.
+       \param node The root of the tree.
+       \return Returns 0 for an empty tree, otherwise the number of nodes on the longest path from the root to a leaf.
+    */
+    static size_t depth(std::unique_ptr<IntervalNode> const & node)
+    {
+        if (!node) return 0;
+        return 1 + std::max(depth(node->get_left_node()), depth(node->get_right_node()));
+    }
+
+    /*!
+       \brief Copy a node and its subtrees into the arrays.
+       \param node The node to copy.
+       \param index The index of the node in breadth-first order.
+    */
+    void fill(std::unique_ptr<IntervalNode> const & node, size_t const index)
+    {
+        if (!node) return;
+        starts[index] = node->get_start();
+        ends[index] = node->get_end();
+        file_positions[index] = node->get_file_position();
+        fill(node->get_left_node(), 2 * index + 1);
+        fill(node->get_right_node(), 2 * index + 2);
+    }
+
+public:
+    //!\brief The file position marking a slot of the layout which does not hold a node.
+    static constexpr std::streamoff no_node{std::numeric_limits<std::streamoff>::min()};
+
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    FlatIntervalTree()                                      = default; //!< Defaulted.
+    FlatIntervalTree(FlatIntervalTree const &)              = default; //!< Defaulted.
+    FlatIntervalTree(FlatIntervalTree &&)                   = default; //!< Defaulted.
+    FlatIntervalTree & operator=(FlatIntervalTree const &)  = default; //!< Defaulted.
+    FlatIntervalTree & operator=(FlatIntervalTree &&)       = default; //!< Defaulted.
+    ~FlatIntervalTree()                                     = default; //!< Defaulted.
+    //!\}
+
+    /*!
+       \brief Lay out an interval tree in breadth-first order.
+       \param root The root node of the interval tree of one chromosome, as constructed by bamit::construct_tree.
+    */
+    explicit FlatIntervalTree(std::unique_ptr<IntervalNode> const & root)
+    {
+        size_t const levels = depth(root);
+        if (levels >= std::numeric_limits<size_t>::digits)
+            throw std::runtime_error{"ERROR: The interval tree is too deep to be laid out flat."};
+        size_t const slots = (size_t{1} << levels) - 1;
+        starts.resize(slots);
+        ends.resize(slots);
+        file_positions.resize(slots, no_node);
+        fill(root, 0);
+    }
+
+    /*!
+       \brief Get the number of slots of the layout.
+       \return Returns the number of slots, including slots which do not hold a node.
+    */
+    size_t size() const
+    {
+        return starts.size();
+    }
+
+    /*!
+       \brief Check whether a slot of the layout holds a node.
+       \param index The index of the slot in breadth-first order.
+       \return Returns `true` if there is a node at the given index.
+    */
+    bool has_node(size_t const index) const
+    {
+        return index < file_positions.size() && file_positions[index] != no_node;
+    }
+
+    /*!
+       \brief Get the start of a node.
+       \param index The index of the node in breadth-first order.
+       \return Returns the start position of the left-most record which is stored in the node.
+    */
+    uint32_t const & get_start(size_t const index) const
+    {
+        return starts[index];
+    }
+
+    /*!
+       \brief Get the end of a node.
+       \param index The index of the node in breadth-first order.
+       \return Returns the end position of the right-most record which is stored in the node.
+    */
+    uint32_t const & get_end(size_t const index) const
+    {
+        return ends[index];
+    }
+
+    /*!
+       \brief Get the file position to the first read stored by a node.
+       \param index The index of the node in breadth-first order.
+       \return Returns a reference to a std::streamoff which can be used to seek to a file position.
+    */
+    std::streamoff const & get_file_position(size_t const index) const
+    {
+        return file_positions[index];
+    }
+
+    /*!
+       \brief Print the Interval Tree in breadth-first order.
+    */
+    void print() const
+    {
+        for (size_t i = 0; i < size(); ++i)
+        {
+            if (!has_node(i)) continue;
+            seqan3::debug_stream << "Index: " << i << '\n' <<
+                                    "Start, end: " << starts[i] << ", " << ends[i] << '\n' <<
+                                    "File position: " << file_positions[i] << '\n';
+        }
+    }
+
+    template <class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(this->starts, this->ends, this->file_positions);
+    }
+};
+
+/*!
+   \brief Convert the interval trees of all chromosomes into their flat layout.
+   \param node_list The list of interval nodes per chromosome, as returned by bamit::index.
+   \return Returns a vector of FlatIntervalTrees, one per chromosome.
+*/
+inline std::vector<FlatIntervalTree> flatten(std::vector<std::unique_ptr<IntervalNode>> const & node_list)
+{
+    std::vector<FlatIntervalTree> result{};
+    result.reserve(node_list.size());
+    for (auto const & root : node_list)
+        result.emplace_back(root);
+    return result;
+}
+
+/*!
+   \brief Find the closest file offset to an overlap query which is stored in a flat Interval Tree.
+   \param tree The flat tree to search, a FlatIntervalTree or any other tree in its breadth-first layout, e.g. a
+               MappedIntervalTree.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param file_position The resulting file position.
+   \details This is the counterpart of bamit::get_current_file_position for the pointer-based tree and returns the
+            same file position. The descent is iterative and only touches the arrays of the tree.
+ */
+template <typename flat_tree_type>
+    requires requires (flat_tree_type const & tree) { tree.has_node(size_t{}); }
+inline void get_current_file_position(flat_tree_type const & tree,
+                                      uint32_t const & start,
+                                      uint32_t const & end,
+                                      std::streamoff & file_position)
+{
+    size_t i{0};
+    while (tree.has_node(i))
+    {
+        // See the pointer-based overload for the six possible cases.
+        if (end < tree.get_start(i))
+        {
+            i = 2 * i + 1;
+        }
+        else if (start > tree.get_end(i))
+        {
+            i = 2 * i + 2;
+        }
+        else
+        {
+            file_position = file_position == -1 ? tree.get_file_position(i)
+                                                : std::min(file_position, tree.get_file_position(i));
+            i = 2 * i + 1;
+        }
+    }
+}
+} // namespace bamit
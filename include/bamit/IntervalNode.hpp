@@ -5,22 +5,34 @@
 #include <cereal/types/memory.hpp>
 #include <cereal/types/vector.hpp>
 
+#include <bamit/BamScanner.hpp>
+#include <bamit/BinningIndex.hpp>
+#include <bamit/LinearIndex.hpp>
 #include <bamit/Record.hpp>
+#include <bamit/RecordFile.hpp>
+#include <bamit/ThreadPool.hpp>
 
+#include <algorithm>
 #include <numeric>
+#include <span>
 
 namespace bamit
 {
-/*! The IntervalNode class stores a single node which is a part of an interval tree. It stores a file position to the
- *  first read which intersects the median, along with pointers to its left and right children.
+/*! The IntervalNode class stores a single node which is a part of an interval tree. It stores file positions to the
+ *  first and last read which intersect the median, along with pointers to its left and right children.
  *  Additionally, it stores the chromosome it is in, the start of the left-most record and the end of the right-most
- *  record.
+ *  record. The median, the number of records intersecting it and the number of records in the subtree rooted at the
+ *  node allow counting overlapping records from the index, see bamit::get_overlap_count_bounds.
  */
 class IntervalNode
 {
 private:
     uint32_t start{}, end{};
     std::streamoff file_position{-1};
+    std::streamoff last_file_position{-1};
+    uint32_t median{};
+    uint32_t count{};
+    uint64_t subtree_count{};
     std::unique_ptr<IntervalNode> lNode{nullptr};
     std::unique_ptr<IntervalNode> rNode{nullptr};
 public:
@@ -44,6 +56,12 @@ public:
          return lNode;
      }
 
+     //!\overload
+     std::unique_ptr<IntervalNode> const & get_left_node() const
+     {
+         return lNode;
+     }
+
      /*!
         \brief Get the right child node of current node.
         \return Returns a std::unique_ptr reference to the right child node.
@@ -53,6 +71,12 @@ public:
          return rNode;
      }
 
+     //!\overload
+     std::unique_ptr<IntervalNode> const & get_right_node() const
+     {
+         return rNode;
+     }
+
      /*!
         \brief Get the start for the current node.
         \return Returns the start position of the left-most record which is stored in this node.
@@ -89,6 +113,24 @@ public:
          this->file_position = std::move(new_file_position);
      }
 
+     /*!
+        \brief Get the file position to the last read stored by this node.
+        \return Returns a reference to a std::streamoff which can be used to seek to a file position.
+     */
+     std::streamoff const & get_last_file_position() const
+     {
+         return last_file_position;
+     }
+
+     /*!
+        \brief Set the file position to the last read for the current node.
+        \param new_file_position The file position based on the records stored by this node.
+     */
+     void set_last_file_position(std::streamoff new_file_position)
+     {
+         this->last_file_position = std::move(new_file_position);
+     }
+
      /*!
         \brief Set the start value for the current node.
         \param s The start of the left-most record stored by this node.
@@ -107,6 +149,60 @@ public:
          this->end = std::move(e);
      }
 
+     /*!
+        \brief Get the median of the current node.
+        \return Returns the position which all records stored by this node intersect.
+     */
+     uint32_t const & get_median() const
+     {
+         return median;
+     }
+
+     /*!
+        \brief Set the median of the current node.
+        \param m The position which all records stored by this node intersect.
+     */
+     void set_median(uint32_t m)
+     {
+         this->median = std::move(m);
+     }
+
+     /*!
+        \brief Get the number of records stored by the current node.
+        \return Returns the number of records which intersect the median.
+     */
+     uint32_t const & get_count() const
+     {
+         return count;
+     }
+
+     /*!
+        \brief Set the number of records stored by the current node.
+        \param c The number of records which intersect the median.
+     */
+     void set_count(uint32_t c)
+     {
+         this->count = std::move(c);
+     }
+
+     /*!
+        \brief Get the number of records in the subtree rooted at the current node.
+        \return Returns the number of records stored by this node and all of its descendants.
+     */
+     uint64_t const & get_subtree_count() const
+     {
+         return subtree_count;
+     }
+
+     /*!
+        \brief Set the number of records in the subtree rooted at the current node.
+        \param c The number of records stored by this node and all of its descendants.
+     */
+     void set_subtree_count(uint64_t c)
+     {
+         this->subtree_count = std::move(c);
+     }
+
      /*!
         \brief Print the Interval Tree starting at this node.
         \param level The level of the current node.
@@ -116,7 +212,10 @@ public:
          std::string indent(level, '\t');
          seqan3::debug_stream << indent << "Level: " << level << '\n' <<
                                  indent << "Start, end: " << start << ", " << end << '\n' <<
-                                 indent << "File position: " << this->get_file_position() << '\n';
+                                 indent << "File positions: " << this->get_file_position() << ", "
+                                        << this->get_last_file_position() << '\n' <<
+                                 indent << "Median: " << median << '\n' <<
+                                 indent << "Records, in subtree: " << count << ", " << subtree_count << '\n';
          if (lNode)
          {
              seqan3::debug_stream << indent << "left node... \n";
@@ -130,87 +229,637 @@ public:
      }
 
     template <class Archive>
-    void serialize(Archive & ar)
+    void serialize(Archive & ar, std::uint32_t const version)
     {
         ar(this->start, this->end, this->lNode, this->rNode, this->file_position);
+        // Version 1 added the record counts.
+        if (version >= 1) ar(this->median, this->count, this->subtree_count);
+        // Version 2 added the file position of the last record.
+        if (version >= 2) ar(this->last_file_position);
+    }
+
+    /*!
+       \brief Read a node written before the nodes were versioned, together with its subtree.
+       \param ar The archive, positioned at the node.
+       \details Such nodes lack the median, the record counts and the last file position, which keep their defaults.
+                See bamit::has_record_counts.
+    */
+    template <class Archive>
+    void load_unversioned(Archive & ar)
+    {
+        ar(this->start, this->end);
+        for (std::unique_ptr<IntervalNode> * child : {&lNode, &rNode})
+        {
+            uint8_t valid{};
+            ar(valid);
+            if (!valid) continue;
+            *child = std::make_unique<IntervalNode>();
+            (*child)->load_unversioned(ar);
+        }
+        ar(this->file_position);
     }
 
 };
 
+//!\brief The number of starts and ends up to which bamit::calculate_median selects the median in a buffer.
+inline constexpr size_t median_buffer_limit{1 << 16};
+
+/*!
+   \brief Find two positions among the starts and ends of a set of records by their rank, without copying them.
+   \param visit_records A callable which takes a callable and calls it on each bamit::Record or bamit::CompactRecord of
+                        the set. It is called twice.
+   \param lower_rank The rank of the first position, counting from 0 in ascending order.
+   \param upper_rank The rank of the second position.
+   \param end_of Gets the end of a record.
+   \return Returns the two positions.
+
+   The positions are selected by their upper and then by their lower 16 bits in two counting passes over the records,
+   so the memory needed does not depend on the number of records and the records may be read from a file.
+*/
+template <typename visit_type>
+inline std::pair<uint32_t, uint32_t> select_positions(visit_type && visit_records,
+                                                      uint64_t lower_rank,
+                                                      uint64_t upper_rank,
+                                                      RecordEnd const & end_of = RecordEnd{})
+{
+    // Find the bucket a rank falls into and turn the rank into the rank within that bucket.
+    auto find_bucket = [] (std::vector<uint64_t> const & counts, uint64_t & rank)
+    {
+        uint32_t bucket{0};
+        for (; rank >= counts[bucket]; ++bucket)
+            rank -= counts[bucket];
+        return bucket;
+    };
+
+    std::vector<uint64_t> lower_counts(1 << 16);
+    visit_records([&lower_counts, &end_of] (auto const & r)
+    {
+        ++lower_counts[r.start >> 16];
+        ++lower_counts[end_of(r) >> 16];
+    });
+    uint32_t const lower_high = find_bucket(lower_counts, lower_rank);
+    uint32_t const upper_high = find_bucket(lower_counts, upper_rank);
+
+    std::fill(lower_counts.begin(), lower_counts.end(), 0);
+    std::vector<uint64_t> upper_counts(1 << 16);
+    auto count = [&] (uint32_t const position)
+    {
+        if (position >> 16 == lower_high) ++lower_counts[position & 0xFFFF];
+        if (position >> 16 == upper_high) ++upper_counts[position & 0xFFFF];
+    };
+    visit_records([&count, &end_of] (auto const & r)
+    {
+        count(r.start);
+        count(end_of(r));
+    });
+
+    return {(lower_high << 16) | find_bucket(lower_counts, lower_rank),
+            (upper_high << 16) | find_bucket(upper_counts, upper_rank)};
+}
+
 /*!
    \brief Calculate the median for a set of records based on the starts and ends of all records.
    \param records_i The list of records from which the median is computed.
-   \return Returns a tuple of chromosome of median and the median value.
+   \param values A buffer for the starts and ends, reused between calls to avoid an allocation per node.
+   \param sample_size If non-zero and there are more records than this, the median is approximated from a sample of
+                      this many evenly spaced records.
+   \param end_of Gets the end of a record.
+   \tparam record_type The type of the records, bamit::Record or bamit::CompactRecord.
+   \return Returns the median value.
 
-   The median is calculated by sorting all of the starts and ends from a list of records. Since each record
-   has a start and end, the list is an even length and the median is the average of the middle two positions.
+   Since each record has a start and end, the list of positions is an even length and the median is the average of
+   the middle two positions. Up to bamit::median_buffer_limit positions, they are copied into the buffer and selected
+   with std::nth_element. Beyond that, they are selected by bamit::select_positions without copying. Both take linear
+   time. The approximate median is the upper middle position of the sampled starts and ends. As that is the start or
+   end of a record, at least one record intersects it. It may split the records unevenly, see bamit::split_records.
 */
-inline uint32_t calculate_median(std::vector<Record> const & records_i)
+template <typename record_type = Record>
+inline uint32_t calculate_median(std::span<std::type_identity_t<record_type> const> records_i,
+                                 std::vector<uint32_t> & values,
+                                 uint32_t const & sample_size = 0,
+                                 RecordEnd const & end_of = RecordEnd{})
+{
+    bool const sampled = sample_size != 0 && records_i.size() > sample_size;
+    if (!sampled && records_i.size() * 2 > median_buffer_limit)
+    {
+        auto visit = [records_i] (auto && function) { std::ranges::for_each(records_i, function); };
+        auto [lower, upper] = select_positions(visit, records_i.size() - 1, records_i.size(), end_of);
+        return (lower + upper) / 2;
+    }
+
+    size_t const step = sampled ? records_i.size() / sample_size : 1;
+    values.clear();
+    for (size_t i = 0; i < records_i.size(); i += step)
+    {
+        values.push_back(records_i[i].start);
+        values.push_back(end_of(records_i[i]));
+    }
+
+    auto upper = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), upper, values.end());
+    if (sampled) return *upper;
+    // All values in front of the upper middle are not greater than it, so the lower middle is the largest of them.
+    return (*upper + *std::max_element(values.begin(), upper)) / 2;
+}
+
+//!\overload
+template <typename record_type = Record>
+inline uint32_t calculate_median(std::span<std::type_identity_t<record_type> const> records_i)
 {
     std::vector<uint32_t> values{};
-    values.reserve(records_i.size() * 2);
-    for (auto const & r : records_i)
+    return calculate_median<record_type>(records_i, values);
+}
+
+/*!
+   \brief Add a record which intersects the median of a node to the node.
+   \param node The node.
+   \param record The record.
+   \param end_of Gets the end of the record.
+   \details Only the file position and start of the left-most read, i.e. the one which comes first in the file, are
+            stored! The end is the largest end of all reads intersecting the median, and the last file position the
+            one of the read which comes last in the file. For a bamit::CompactRecord, the node stores indices in the
+            bamit::FilePositionTable until bamit::resolve_file_positions is called.
+*/
+template <typename record_type>
+inline void add_to_node(IntervalNode & node, record_type const & record, RecordEnd const & end_of = RecordEnd{})
+{
+    if (node.get_file_position() == -1 || record.file_position < node.get_file_position())
     {
-        values.push_back(r.start);
-        values.push_back(r.end);
+        node.set_file_position(record.file_position);
+        node.set_start(record.start);
     }
-    std::sort(values.begin(), values.end());
+    if (record.file_position > node.get_last_file_position()) node.set_last_file_position(record.file_position);
+    if (uint32_t const end = end_of(record); end > node.get_end()) node.set_end(end);
+    node.set_count(node.get_count() + 1);
+}
 
-    return (values[values.size() / 2] + values[(values.size() - 1) / 2]) / 2;
+/*!
+   \brief Set the number of records in the subtree rooted at a node, once the subtrees of its children are complete.
+   \param node The node.
+*/
+inline void count_subtree(IntervalNode & node)
+{
+    uint64_t subtree_count = node.get_count();
+    if (node.get_left_node()) subtree_count += node.get_left_node()->get_subtree_count();
+    if (node.get_right_node()) subtree_count += node.get_right_node()->get_subtree_count();
+    node.set_subtree_count(subtree_count);
 }
 
 /*!
-   \brief Construct an interval tree given a set of records.
+   \brief Fill a node from the records which intersect the median and partition the records in place around it.
+   \param node The node to fill.
+   \param records_i The list of records the node is constructed over.
+   \param values The buffer passed to bamit::calculate_median.
+   \param median_sample_size The sample size passed to bamit::calculate_median.
+   \param end_of Gets the end of a record.
+   \tparam record_type The type of the records, bamit::Record or bamit::CompactRecord.
+   \return Returns the records which end before the median and the records which start after the median. They are
+           moved to the front and to the back of records_i, respectively.
+   \details With the exact median, each side holds at most half of the records, as all starts and ends of its records
+            lie on one side of the median. If an approximate median leaves more than half of the records on one side,
+            the exact median is used instead, so that the depth of the tree stays logarithmic in the number of records.
+*/
+template <typename record_type>
+inline std::pair<std::span<record_type>, std::span<record_type>> split_records(IntervalNode & node,
+                                                                               std::span<record_type> records_i,
+                                                                               std::vector<uint32_t> & values,
+                                                                               uint32_t const & median_sample_size,
+                                                                               RecordEnd const & end_of = RecordEnd{})
+{
+    uint32_t cur_median{};
+    auto left_end = records_i.begin();
+    auto right_begin = records_i.end();
+    // Three-way partition: [begin, left_end) end before the median, [right_begin, end) start after the median and
+    // the records in between intersect it.
+    auto partition = [&] ()
+    {
+        left_end = records_i.begin();
+        right_begin = records_i.end();
+        for (auto it = records_i.begin(); it != right_begin;)
+        {
+            if (end_of(*it) < cur_median) std::iter_swap(left_end++, it++);
+            else if (it->start > cur_median) std::iter_swap(it, --right_begin);
+            else ++it;
+        }
+    };
+
+    cur_median = calculate_median<record_type>(records_i, values, median_sample_size, end_of);
+    partition();
+    size_t const half = records_i.size() / 2;
+    if (static_cast<size_t>(left_end - records_i.begin()) > half ||
+        static_cast<size_t>(records_i.end() - right_begin) > half)
+    {
+        cur_median = calculate_median<record_type>(records_i, values, 0, end_of);
+        partition();
+    }
+    node.set_median(cur_median);
+
+    for (auto it = left_end; it != right_begin; ++it)
+        add_to_node(node, *it, end_of);
+
+    return {std::span<record_type>{records_i.begin(), left_end}, std::span<record_type>{right_begin, records_i.end()}};
+}
+
+/*!
+   \brief Recursively construct an interval tree, reusing one median buffer for all nodes.
    \param node The current node to fill.
    \param records_i The list of records to create the tree over.
+   \param median_sample_size The sample size passed to bamit::calculate_median.
+   \param values The buffer passed to bamit::calculate_median.
+   \param end_of Gets the end of a record.
+   \tparam record_type The type of the records, bamit::Record or bamit::CompactRecord.
 */
+template <typename record_type = Record>
 inline void construct_tree(std::unique_ptr<IntervalNode> & node,
-                           std::vector<Record> & records_i)
+                           std::span<std::type_identity_t<record_type>> records_i,
+                           uint32_t const & median_sample_size,
+                           std::vector<uint32_t> & values,
+                           RecordEnd const & end_of = RecordEnd{})
 {
     // If there are no records, exit.
     if (records_i.empty()) return;
     // Set node to an empty IntervalNode pointer.
     node = std::make_unique<IntervalNode>();
 
-    // Calculate and set median.
-    auto cur_median = calculate_median(records_i);
-
     // Get reads which intersect median.
-    std::vector<Record> lRecords{};
-    std::vector<Record> rRecords{};
+    auto [lRecords, rRecords] = split_records(*node, records_i, values, median_sample_size, end_of);
+
+    // Set left and right subtrees.
+    construct_tree<record_type>(node->get_left_node(), lRecords, median_sample_size, values, end_of);
+    construct_tree<record_type>(node->get_right_node(), rRecords, median_sample_size, values, end_of);
+    count_subtree(*node);
+    return;
+}
+
+/*!
+   \brief Construct an interval tree given a set of records.
+   \param node The current node to fill.
+   \param records_i The list of records to create the tree over. The records are reordered in place.
+   \param median_sample_size If non-zero, nodes over more records than this use a median approximated from a sample
+                             of this many records. See bamit::calculate_median.
+   \param end_of Gets the end of a record. It must know the bamit::LongRecordEnds of CompactRecords which are too long
+                 to store their length.
+   \tparam record_type The type of the records. With bamit::CompactRecord, the nodes store indices into a
+                        bamit::FilePositionTable, which are replaced by file positions with bamit::resolve_file_positions.
+                        The tree is otherwise the same.
+*/
+template <typename record_type = Record>
+inline void construct_tree(std::unique_ptr<IntervalNode> & node,
+                           std::span<std::type_identity_t<record_type>> records_i,
+                           uint32_t const & median_sample_size = 0,
+                           RecordEnd const & end_of = RecordEnd{})
+{
+    std::vector<uint32_t> values{};
+    construct_tree<record_type>(node, records_i, median_sample_size, values, end_of);
+}
+
+//!\brief The number of records below which bamit::construct_tree does not split its work into parallel tasks.
+inline constexpr size_t parallel_construction_cutoff{1 << 16};
+
+/*!
+   \brief Construct an interval tree given a set of records, constructing subtrees in parallel.
+   \param node The current node to fill.
+   \param records_i The list of records to create the tree over. The records are reordered in place.
+   \param pool The ThreadPool the left subtrees are constructed on.
+   \param cutoff Subtrees over fewer records than this are constructed serially by the current thread. 0 is treated
+                 as 1.
+   \param median_sample_size The sample size passed to bamit::calculate_median.
+   \param end_of Gets the end of a record, see the serial bamit::construct_tree.
+   \tparam record_type The type of the records, bamit::Record or bamit::CompactRecord.
+   \details Constructs exactly the same tree as the serial bamit::construct_tree. Above the cutoff, the left subtree is
+            handed to the pool while the current thread constructs the right subtree. Both work on disjoint parts of
+            records_i.
+*/
+template <typename record_type = Record>
+inline void construct_tree(std::unique_ptr<IntervalNode> & node,
+                           std::span<std::type_identity_t<record_type>> records_i,
+                           ThreadPool & pool,
+                           size_t const cutoff = parallel_construction_cutoff,
+                           uint32_t const & median_sample_size = 0,
+                           RecordEnd const & end_of = RecordEnd{})
+{
+    // Empty subtrees are always left to the serial construction.
+    if (records_i.size() < std::max<size_t>(cutoff, 1))
+    {
+        construct_tree<record_type>(node, records_i, median_sample_size, end_of);
+        return;
+    }
+    node = std::make_unique<IntervalNode>();
+
+    std::vector<uint32_t> values{};
+    auto [lRecords, rRecords] = split_records(*node, records_i, values, median_sample_size, end_of);
+
+    std::future<void> left = pool.submit([&, lRecords = lRecords] ()
+    {
+        construct_tree<record_type>(node->get_left_node(), lRecords, pool, cutoff, median_sample_size, end_of);
+    });
+    try
+    {
+        construct_tree<record_type>(node->get_right_node(), rRecords, pool, cutoff, median_sample_size, end_of);
+    }
+    catch (...)
+    {
+        // The left task refers to local variables, so it has to finish before the exception leaves this scope.
+        try { pool.wait(left); } catch (...) {}
+        throw;
+    }
+    pool.wait(left);
+    count_subtree(*node);
+}
+
+/*!
+   \brief Construct an interval tree given a set of records stored in a file, holding only part of them in memory.
+   \param node The current node to fill.
+   \param records_i The file of records to create the tree over. It is cleared once the node is filled.
+   \param memory_budget The number of bytes of records which may be held in memory.
+   \param median_sample_size The sample size passed to bamit::calculate_median for subtrees constructed in memory.
+   \details As long as the records do not fit into the memory budget, the exact median is selected by
+            bamit::select_positions while reading the file and the records are split into one new file per subtree.
+            Subtrees which fit are constructed in memory. If median_sample_size is 0, the resulting tree is the same as
+            the one constructed by bamit::construct_tree with all records in memory. Otherwise only the subtrees
+            constructed in memory use approximate medians, so the tree depends on the budget, but answers queries the
+            same way.
+*/
+inline void construct_tree(std::unique_ptr<IntervalNode> & node,
+                           RecordFile & records_i,
+                           size_t const memory_budget,
+                           uint32_t const & median_sample_size = 0)
+{
+    if (records_i.size() == 0) return;
+    if (records_i.size() * sizeof(Record) <= memory_budget)
+    {
+        std::vector<Record> records = records_i.load();
+        records_i.clear();
+        construct_tree(node, records, median_sample_size);
+        return;
+    }
+    node = std::make_unique<IntervalNode>();
+
+    auto visit = [&records_i] (auto && function) { records_i.for_each(function); };
+    auto [lower, upper] = select_positions(visit, records_i.size() - 1, records_i.size());
+    uint32_t const cur_median = (lower + upper) / 2;
+    node->set_median(cur_median);
 
-    uint32_t start{0}, end{0};
-    for (auto & r : records_i)
+    // Records are buffered and written to the subtree files in chunks of a fraction of the memory budget.
+    size_t const buffer_size = std::max<size_t>(memory_budget / sizeof(Record) / 4, 1);
+    RecordFile lFile{records_i.get_directory()};
+    RecordFile rFile{records_i.get_directory()};
+    std::vector<Record> lBuffer{};
+    std::vector<Record> rBuffer{};
+    auto add_to_file = [buffer_size] (RecordFile & file, std::vector<Record> & buffer, Record const & r)
+    {
+        buffer.push_back(r);
+        if (buffer.size() < buffer_size) return;
+        file.append(buffer);
+        buffer.clear();
+    };
+    records_i.for_each([&] (Record const & r)
     {
         // Read ends before the median.
-        if (r.end < cur_median) lRecords.push_back(std::move(r));
+        if (r.end < cur_median) add_to_file(lFile, lBuffer, r);
         // Read starts after the median.
-        else if (r.start > cur_median) rRecords.push_back(std::move(r));
-        // Read intersects the median. Only store file position and start from the left-most read!
-        // End is always updated while the read intersects the median.
-        else
+        else if (r.start > cur_median) add_to_file(rFile, rBuffer, r);
+        // Read intersects the median.
+        else add_to_node(*node, r);
+    });
+    lFile.append(lBuffer);
+    rFile.append(rBuffer);
+    lBuffer = std::vector<Record>{};
+    rBuffer = std::vector<Record>{};
+    records_i.clear();
+
+    construct_tree(node->get_left_node(), lFile, memory_budget, median_sample_size);
+    construct_tree(node->get_right_node(), rFile, memory_budget, median_sample_size);
+    count_subtree(*node);
+}
+
+/*!
+   \brief Replace the indices stored by the nodes of a tree constructed over bamit::CompactRecords with file positions.
+   \param node The root node of the tree.
+   \param file_positions The table the records were added to.
+*/
+inline void resolve_file_positions(std::unique_ptr<IntervalNode> & node, FilePositionTable const & file_positions)
+{
+    if (!node) return;
+    // A node which no record intersects has no file position.
+    if (node->get_file_position() != -1)
+    {
+        node->set_file_position(file_positions[node->get_file_position()]);
+        node->set_last_file_position(file_positions[node->get_last_file_position()]);
+    }
+    resolve_file_positions(node->get_left_node(), file_positions);
+    resolve_file_positions(node->get_right_node(), file_positions);
+}
+
+/*! The IndexBuilder class collects the records of a coordinate sorted alignment file one chromosome at a time and
+ *  constructs the interval tree of each chromosome once all of its records have been added. With more than one
+ *  thread, trees are constructed on a ThreadPool while the caller keeps adding the records of the next chromosomes.
+ *  With a memory budget, records which do not fit into it are written to a RecordFile and the tree of that chromosome
+ *  is constructed from the file. Records held in memory are stored as CompactRecords with a FilePositionTable, which
+ *  takes 12 instead of 16 bytes per record. The few records too long to store their length in a CompactRecord take 8
+ *  bytes more for their entry in the LongRecordEnds of their chromosome. A LinearIndex can be filled alongside the
+ *  trees.
+ */
+class IndexBuilder
+{
+private:
+    std::vector<std::unique_ptr<IntervalNode>> result{};
+    std::vector<std::string> ref_names{};
+    std::vector<CompactRecord> cur_records{};
+    FilePositionTable cur_positions{};
+    LongRecordEnds cur_long_ends{};
+    std::unique_ptr<RecordFile> cur_file{nullptr};
+    uint32_t cur_index{0};
+    bool verbose{false};
+    uint32_t median_sample_size{0};
+    size_t buffer_budget{0};
+    std::unique_ptr<ThreadPool> pool{nullptr};
+    std::deque<std::future<void>> pending{};
+    LinearIndex * linear_index{nullptr};
+
+    /*!
+       \brief Move the collected records of the current chromosome to its RecordFile.
+    */
+    void spill()
+    {
+        if (!cur_file) cur_file = std::make_unique<RecordFile>();
+        // Convert the records in chunks, so that this needs little memory beyond the budget. They are still in the
+        // order of the table.
+        RecordEnd const end_of{&cur_long_ends};
+        std::vector<Record> chunk{};
+        cur_positions.for_each([&] (uint32_t const index, std::streamoff const file_position)
+        {
+            chunk.emplace_back(cur_records[index].start, end_of(cur_records[index]), file_position);
+            if (chunk.size() < 4096) return;
+            cur_file->append(chunk);
+            chunk.clear();
+        });
+        cur_file->append(chunk);
+        cur_records.clear();
+        cur_positions.clear();
+        cur_long_ends.clear();
+    }
+
+    /*!
+       \brief Construct the tree over the collected records of the current chromosome.
+    */
+    void build()
+    {
+        if (cur_file) spill();
+        if (verbose) seqan3::debug_stream << "Indexing chr " << ref_names[cur_index] << "...";
+        if (!pool)
         {
-            if (node->get_file_position() == -1)
+            if (cur_file)
+            {
+                construct_tree(result[cur_index], *cur_file, buffer_budget, median_sample_size);
+            }
+            else
             {
-                node->set_file_position(r.file_position);
-                start = r.start;
+                construct_tree<CompactRecord>(result[cur_index], cur_records, median_sample_size,
+                                              RecordEnd{&cur_long_ends});
+                resolve_file_positions(result[cur_index], cur_positions);
             }
-            end = r.end > end ? r.end : end;
+            if (verbose) seqan3::debug_stream << " Done!\n";
+            cur_records.clear();
+            cur_positions.clear();
+            cur_long_ends.clear();
+            cur_file.reset();
+            return;
         }
+        if (verbose) seqan3::debug_stream << '\n';
+        // Limit the number of chromosomes held in memory to the ones being constructed and the one being collected.
+        while (pending.size() >= pool->size())
+        {
+            pool->wait(pending.front());
+            pending.pop_front();
+        }
+        pending.push_back(pool->submit([&node = result[cur_index], records = std::move(cur_records),
+                                        positions = std::move(cur_positions), long_ends = std::move(cur_long_ends),
+                                        file = std::move(cur_file), &pool = *pool,
+                                        median_sample_size = median_sample_size,
+                                        buffer_budget = buffer_budget] () mutable
+        {
+            if (file)
+            {
+                construct_tree(node, *file, buffer_budget, median_sample_size);
+                return;
+            }
+            construct_tree<CompactRecord>(node, records, pool, parallel_construction_cutoff, median_sample_size,
+                                          RecordEnd{&long_ends});
+            resolve_file_positions(node, positions);
+        }));
+        cur_records = std::vector<CompactRecord>{};
+        cur_positions = FilePositionTable{};
+        cur_long_ends = LongRecordEnds{};
     }
-    node->set_start(start);
-    node->set_end(end);
 
-    // Set left and right subtrees.
-    construct_tree(node->get_left_node(), lRecords);
-    construct_tree(node->get_right_node(), rRecords);
-    return;
-}
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    IndexBuilder()                                  = delete;  //!< Deleted.
+    IndexBuilder(IndexBuilder const &)              = delete;  //!< Deleted.
+    IndexBuilder(IndexBuilder &&)                   = delete;  //!< Deleted.
+    IndexBuilder & operator=(IndexBuilder const &)  = delete;  //!< Deleted.
+    IndexBuilder & operator=(IndexBuilder &&)       = delete;  //!< Deleted.
+    ~IndexBuilder()                                 = default; //!< Defaulted.
+    //!\}
+
+    /*!
+       \brief Prepare one tree per reference sequence.
+       \param ref_names_i The names of the reference sequences, used for verbose output.
+       \param threads The number of threads constructing trees. With 1 thread, trees are constructed by the caller.
+       \param verbose_i Print verbose output.
+       \param median_sample_size_i The sample size passed to bamit::construct_tree.
+       \param memory_budget The number of bytes of records which may be held in memory, shared by the chromosome being
+                            collected and the ones being constructed. 0 means no limit.
+       \param linear_index_i If not nullptr, every record added is also added to this LinearIndex.
+    */
+    IndexBuilder(std::vector<std::string> ref_names_i,
+                 uint16_t const & threads = 1,
+                 bool const & verbose_i = false,
+                 uint32_t const & median_sample_size_i = 0,
+                 size_t const & memory_budget = 0,
+                 LinearIndex * linear_index_i = nullptr) :
+        ref_names{std::move(ref_names_i)},
+        verbose{verbose_i},
+        median_sample_size{median_sample_size_i},
+        linear_index{linear_index_i}
+    {
+        result.reserve(ref_names.size());
+        std::generate_n(std::back_inserter(result), ref_names.size(),
+                        [] { return std::make_unique<IntervalNode>(); });
+        if (threads > 1) pool = std::make_unique<ThreadPool>(threads);
+        // One chromosome is collected while up to one per thread is constructed.
+        if (memory_budget != 0)
+            buffer_budget = std::max<size_t>(memory_budget / (pool ? pool->size() + 1 : 1), sizeof(Record));
+    }
+
+    /*!
+       \brief Add the next mapped record of the alignment file.
+       \param ref_id The reference sequence of the record. Must not be smaller than the one of the previous record.
+       \param record The record.
+    */
+    void add(uint32_t const ref_id, Record const & record)
+    {
+        if (ref_id != cur_index)
+        {
+            build();
+            cur_index = ref_id;
+        }
+        // Grow the buffer up to the budget only, then move its records to the file. The budget also covers the ends
+        // of the long records.
+        if (buffer_budget != 0 && cur_records.size() >= cur_records.capacity())
+        {
+            size_t const long_size = cur_long_ends.size() * sizeof(std::pair<uint32_t, uint32_t>);
+            size_t const limit = buffer_budget > long_size ?
+                                 (buffer_budget - long_size) / (sizeof(CompactRecord) + sizeof(uint16_t)) : 0;
+            if (cur_records.size() >= limit) spill();
+            else cur_records.reserve(std::min(std::max<size_t>(cur_records.capacity() * 2, 1024), limit));
+        }
+        cur_records.push_back(CompactRecord{record.start, record.end, cur_positions.push_back(record.file_position),
+                                            cur_long_ends});
+        if (linear_index) linear_index->add(ref_id, record);
+    }
+
+    /*!
+       \brief Get the pool the trees are constructed on, so that other work of the indexing can share its threads.
+       \return Returns the ThreadPool, or nullptr if the trees are constructed by the caller.
+    */
+    ThreadPool * get_pool()
+    {
+        return pool.get();
+    }
+
+    /*!
+       \brief Construct the tree of the last chromosome and wait for all trees.
+       \return Returns a vector of IntervalNodes, each of which is the root node of an Interval Tree over its
+               respective chromosome.
+    */
+    std::vector<std::unique_ptr<IntervalNode>> finish()
+    {
+        if (!result.empty()) build();
+        for (auto & task : pending)
+            pool->wait(task);
+        pending.clear();
+        return std::move(result);
+    }
+};
 
 /*!
    \brief Entry point into the recursive tree construction.
    \param input_file The input file to construct the tree over.
    \param verbose Print verbose output.
+   \param threads The number of threads used to construct the trees of different chromosomes in parallel while the
+                  input file is read.
+   \param median_sample_size If non-zero, nodes over more records than this use a median approximated from a sample
+                             of this many records, which is faster for very deep files. See bamit::calculate_median.
+   \param memory_budget The number of bytes of records which may be held in memory at once. Records beyond it are
+                        written to temporary files in the system's temporary directory. 0 means no limit. Without
+                        median_sample_size, the resulting trees do not depend on the budget.
+   \param linear_index If not nullptr, receives the bamit::LinearIndex of the input file, which can be passed to the
+                       queries to shorten their scans. The end of the span of the last chromosome stays unknown unless
+                       unplaced records follow it, see bamit::LinearIndex::finish.
    \tparam traits_type The type of the traits for seqan3::sam_file_input
    \tparam fields_type The given fields.
    \tparam format_type The format of the file.
@@ -221,7 +870,11 @@ template <typename traits_type, typename fields_type, typename format_type>
 inline std::vector<std::unique_ptr<IntervalNode>> index(seqan3::sam_file_input<traits_type,
                                                                                fields_type,
                                                                                format_type> & input_file,
-                                                        bool const & verbose = false)
+                                                        bool const & verbose = false,
+                                                        uint16_t const & threads = 1,
+                                                        uint32_t const & median_sample_size = 0,
+                                                        size_t const & memory_budget = 0,
+                                                        LinearIndex * linear_index = nullptr)
 {
     // Very first thing: Check that required fields are non-empty.
     static_assert(fields_type::contains(seqan3::field::ref_id),
@@ -236,38 +889,89 @@ inline std::vector<std::unique_ptr<IntervalNode>> index(seqan3::sam_file_input<t
     if (input_file.header().sorting != "coordinate")
         throw seqan3::format_error{"ERROR: Input file must be sorted by coordinate (e.g. samtools sort)"};
 
-    // Vector containing result, initialized to # of chromosomes in header.
-    std::vector<std::unique_ptr<IntervalNode>> result;
-    result.reserve(input_file.header().ref_ids().size());
-    std::generate_n(std::back_inserter(result), input_file.header().ref_ids().size(),
-                    [] { return std::make_unique<IntervalNode>(); });
+    IndexBuilder builder{std::vector<std::string>(input_file.header().ref_ids().begin(),
+                                                  input_file.header().ref_ids().end()),
+                         threads, verbose, median_sample_size, memory_budget, linear_index};
 
-    // List of records for a single chromosome.
-    std::vector<Record> cur_records;
-
-    uint32_t cur_index{0};
     for (auto it = input_file.begin(); it != input_file.end(); ++it)
     {
-        if (unmapped(*it)) continue;
+        if (unmapped(*it))
+        {
+            // The unmapped records only count for the spans of the LinearIndex.
+            if (linear_index)
+                linear_index->add_unmapped((*it).reference_id().value_or(std::numeric_limits<uint32_t>::max()),
+                                           static_cast<std::streamoff>(it.file_position()));
+            continue;
+        }
         uint32_t ref_id = (*it).reference_id().value();
         uint32_t position = (*it).reference_position().value();
-        if (ref_id != cur_index)
+        builder.add(ref_id, Record{position,
+                                   position + get_length((*it).cigar_sequence()),
+                                   static_cast<std::streamoff>(it.file_position())});
+    }
+
+    return builder.finish();
+}
+
+/*!
+   \brief Entry point into the recursive tree construction for a BAM file, which is read with a bamit::BamScanner.
+   \param bam_path The path to the BAM file to construct the tree over.
+   \param verbose Print verbose output.
+   \param threads The number of threads of the pool which constructs the trees of different chromosomes in parallel,
+                  and decompresses and scans parts of the file in parallel. See bamit::scan_records.
+   \param median_sample_size See the overload for seqan3::sam_file_input.
+   \param memory_budget See the overload for seqan3::sam_file_input. With more than one thread, a quarter of it is
+                        given to the records collected by the parallel scan and the rest to the records collected for
+                        the trees.
+   \param linear_index See the overload for seqan3::sam_file_input.
+   \param binning_index If not nullptr, receives the BAI or CSI index of the file from the same scan, which can be
+                        written with bamit::BinningIndex::write. It must have been constructed for the references of
+                        the file.
+   \return Returns a vector of IntervalNodes, each of which is the root node of an Interval Tree over its respective
+           chromosome. The trees are the same as the ones constructed from a seqan3::sam_file_input over the same file,
+           but only the fields of the records needed for the index are decoded.
+*/
+inline std::vector<std::unique_ptr<IntervalNode>> index(std::filesystem::path const & bam_path,
+                                                        bool const & verbose = false,
+                                                        uint16_t const & threads = 1,
+                                                        uint32_t const & median_sample_size = 0,
+                                                        size_t const & memory_budget = 0,
+                                                        LinearIndex * linear_index = nullptr,
+                                                        BinningIndex * binning_index = nullptr)
+{
+    BamScanner const scanner{bam_path};
+    if (scanner.get_sorting() != "coordinate")
+        throw seqan3::format_error{"ERROR: Input file must be sorted by coordinate (e.g. samtools sort)"};
+
+    size_t const scan_budget = threads > 1 ? memory_budget / 4 : 0;
+    IndexBuilder builder{scanner.get_ref_names(), threads, verbose, median_sample_size, memory_budget - scan_budget,
+                         linear_index};
+
+    if (binning_index || linear_index)
+    {
+        // The BinningIndex needs the unmapped records too, as they are part of its chunks, and the LinearIndex counts
+        // them in the spans of the chromosomes.
+        std::streamoff const end_of_file = scan_records(bam_path, builder.get_pool(),
+                                                        [&builder, binning_index, linear_index] (uint32_t const ref_id,
+                                                                                                 Record const & record,
+                                                                                                 bool const unmapped)
         {
-            if (verbose) seqan3::debug_stream << "Indexing chr " << input_file.header().ref_ids()[cur_index] << "...";
-            construct_tree(result[cur_index], cur_records);
-            if (verbose) seqan3::debug_stream << " Done!\n";
-            cur_records.clear();
-            ++cur_index;
-        }
-        cur_records.emplace_back(position,
-                                 position + get_length((*it).cigar_sequence()),
-                                 static_cast<std::streamoff>(it.file_position()));
+            if (binning_index) binning_index->add(ref_id, record, unmapped);
+            if (!unmapped) builder.add(ref_id, record);
+            else if (linear_index) linear_index->add_unmapped(ref_id, record.file_position);
+        }, parallel_scan_range_size, scan_budget);
+        if (binning_index) binning_index->finish(end_of_file);
+        if (linear_index) linear_index->finish(end_of_file);
+    }
+    else
+    {
+        scan_records(bam_path, builder.get_pool(), [&builder] (uint32_t const ref_id, Record const & record)
+        {
+            builder.add(ref_id, record);
+        }, parallel_scan_range_size, scan_budget);
     }
-    if (verbose) seqan3::debug_stream << "Indexing chr " << input_file.header().ref_ids()[cur_index] << "...";
-    construct_tree(result[cur_index], cur_records);
-    if (verbose) seqan3::debug_stream << " Done!\n";
 
-    return result;
+    return builder.finish();
 }
 
 /*!
@@ -361,29 +1065,30 @@ inline void get_correct_position(seqan3::sam_file_input<traits_type, fields_type
 }
 
 /*!
-   \brief Obtain the file position of the first record which overlaps a query.
-   \param input The sam file input of type bamit::seqan3::sam_file_input.
-   \param node_list The list of interval nodes per chromosome
+   \brief Obtain the file position stored in the Interval Tree which is closest to the left of a query.
+   \param node_list The list of interval trees per chromosome, either as root IntervalNodes or as FlatIntervalTrees.
    \param start The start Position of the search.
    \param end The end Position of the search.
-   \param file_position The resulting file position.
-   \details The main function for obtaining the file position of an overlap query.
+   \param file_position The resulting file position, which stays -1 if no record can overlap the query.
+   \param linear_index The bamit::LinearIndex of the file, which moves the position to the right if the tree's
+                       position lies before the window of start. Empty by default.
+   \details Like bamit::get_current_file_position, but for queries which may span multiple chromosomes. The file is
+            not read, so the resulting position may point to records before the first record overlapping the query.
  */
-template <typename traits_type, typename fields_type, typename format_type>
-inline void get_overlap_file_position(seqan3::sam_file_input<traits_type, fields_type, format_type> & input,
-                                      std::vector<std::unique_ptr<IntervalNode>> const & node_list,
-                                      Position const & start,
-                                      Position const & end,
-                                      std::streamoff & file_position)
+template <typename tree_type>
+inline void get_tree_file_position(std::vector<tree_type> const & node_list,
+                                   Position const & start,
+                                   Position const & end,
+                                   std::streamoff & file_position,
+                                   LinearIndex const & linear_index = LinearIndex{})
 {
     if (std::get<0>(start) == std::get<0>(end)) // Searching in one chromosome.
     {
         get_current_file_position(node_list[std::get<0>(start)], std::get<1>(start), std::get<1>(end), file_position);
-        if (file_position != -1) get_correct_position(input, start, file_position);
     }
     else // Searching across multiple chromosomes.
     {
-        for (uint32_t i = std::get<0>(start); i < (uint32_t) std::get<0>(end); ++i)
+        for (uint32_t i = std::get<0>(start); i <= (uint32_t) std::get<0>(end); ++i)
         {
             // Begin at given start only for the first chromosome, otherwise begin searching from 0.
             // For the first chromosome, we want the actual start position of the query. If no reads
@@ -396,36 +1101,53 @@ inline void get_overlap_file_position(seqan3::sam_file_input<traits_type, fields
 
             // If we find the left-most position we can stop. Otherwise we have to check the next tree if
             // the overlap spans more than one chromosome.
-            if (file_position != -1)
-            {
-                get_correct_position(input, start, file_position);
-                break;
-            }
+            if (file_position != -1) break;
         }
     }
+    linear_index.cap(start, file_position);
 }
 
 /*!
-   \brief Find the records which overlap a given start and end position.
+   \brief Obtain the file position of the first record which overlaps a query.
    \param input The sam file input of type bamit::seqan3::sam_file_input.
-   \param node_list The list of interval trees.
-   \param start The start position of the search.
-   \param end The end position of the search.
-   \param verbose Print verbose output.
-   \param outname The output filename. If not provided the function will only return the file position and
-                  not write to any file.
-
-   \return Returns a vector of seqan3::sam_record objects containing records overlapping the query.
-   \details The main function for obtaining a vector of records which overlap a query. If just the file position is
-            desired, use bamit::get_overlap_file_position instead.
+   \param node_list The list of interval trees per chromosome, either as root IntervalNodes or as FlatIntervalTrees.
+   \param start The start Position of the search.
+   \param end The end Position of the search.
+   \param file_position The resulting file position.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read. Empty by default.
+   \details The main function for obtaining the file position of an overlap query.
+ */
+template <typename traits_type, typename fields_type, typename format_type, typename tree_type>
+inline void get_overlap_file_position(seqan3::sam_file_input<traits_type, fields_type, format_type> & input,
+                                      std::vector<tree_type> const & node_list,
+                                      Position const & start,
+                                      Position const & end,
+                                      std::streamoff & file_position,
+                                      LinearIndex const & linear_index = LinearIndex{})
+{
+    get_tree_file_position(node_list, start, end, file_position, linear_index);
+    if (file_position != -1) get_correct_position(input, start, file_position);
+}
+
+/*!
+   \brief Get a view over the records which overlap a given start and end position.
+   \param input The sam file input of type bamit::seqan3::sam_file_input.
+   \param node_list The list of interval trees, either as root IntervalNodes or as FlatIntervalTrees.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read. Empty by default.
+
+   \return Returns an input range over the records overlapping the query, which are read from the file as the range is
+           iterated. Only one record is held in memory at a time.
+   \details The input is moved to the first overlapping record by this function, so it must not be used otherwise
+            until the range was iterated. Use bamit::get_overlap_records to store the records instead.
 */
-template <typename traits_type, typename fields_type, typename format_type>
-inline auto get_overlap_records(seqan3::sam_file_input<traits_type, fields_type, format_type> & input,
-                                std::vector<std::unique_ptr<IntervalNode>> const & node_list,
-                                Position const & start,
-                                Position const & end,
-                                bool const & verbose = false,
-                                std::filesystem::path const & outname = "")
+template <typename traits_type, typename fields_type, typename format_type, typename tree_type>
+inline auto get_overlap_range(seqan3::sam_file_input<traits_type, fields_type, format_type> & input,
+                              std::vector<tree_type> const & node_list,
+                              Position const & start,
+                              Position const & end,
+                              LinearIndex const & linear_index = LinearIndex{})
 {
     // Very first thing: Check that required fields are non-empty.
     static_assert(fields_type::contains(seqan3::field::ref_id),
@@ -440,15 +1162,655 @@ inline auto get_overlap_records(seqan3::sam_file_input<traits_type, fields_type,
     std::streamoff file_position{-1};
 
     // Get the file position of the first record matching start query.
-    get_overlap_file_position(input, node_list, start, end, file_position);
-
-    // Store reads which start before the end of the query, filtering out unmapped reads and reads within the interval which
-    // end before the start. Example: Read 1 goes from 100 - 200, Read 2 goes from 101 - 151. Both in the same node (median 150), but
-    // when searching for interval 160 - 200, Read 2 will not be included in results, as it is outside the query range.
-    auto results_list = input | std::views::take_while([file_position](auto & rec) {return file_position != -1;})
-                              | std::views::take_while([end](auto & rec) {return std::make_tuple(rec.reference_id().value(), rec.reference_position().value()) < end;})
-                              | std::views::filter([start](auto & rec) {return !unmapped(rec) && std::make_tuple(rec.reference_id().value(), get_length((rec).cigar_sequence()) + rec.reference_position().value()) >= start;})
-                              | seqan3::ranges::to<std::vector>();
+    get_overlap_file_position(input, node_list, start, end, file_position, linear_index);
+
+    // Take reads which start before the end of the query, stopping at the unplaced reads at the end of the file,
+    // filtering out unmapped reads and reads within the interval which end before the start. Example: Read 1 goes from
+    // 100 - 200, Read 2 goes from 101 - 151. Both in the same node (median 150), but when searching for interval
+    // 160 - 200, Read 2 will not be included in results, as it is outside the query range.
+    return input | std::views::take_while([file_position] (auto &)
+                   {
+                       return file_position != -1;
+                   })
+                 | std::views::take_while([end] (auto & rec)
+                   {
+                       return rec.reference_id().has_value() &&
+                              std::make_tuple(rec.reference_id().value(), rec.reference_position().value()) < end;
+                   })
+                 | std::views::filter([start] (auto & rec)
+                   {
+                       if (unmapped(rec)) return false;
+                       int32_t const ref_id = rec.reference_id().value();
+                       return !overlap_needs_end(ref_id, start) ||
+                              std::make_tuple(ref_id, get_length(rec.cigar_sequence()) +
+                                                      rec.reference_position().value()) >= start;
+                   });
+}
+
+/*!
+   \brief Copy the records which overlap a given start and end position from a BAM file into a new BAM file, without
+          decoding them.
+   \param bam_path The BAM file to query.
+   \param node_list The list of interval trees, either as root IntervalNodes or as FlatIntervalTrees.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param out_path The BAM file to write, which gets the header of bam_path.
+   \param level The zlib compression level of the blocks written.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read. Empty by default.
+
+   \return Returns the number of records written.
+   \details The records found are those of bamit::get_overlap_range, but they are copied byte for byte from the
+            decompressed input. The chromosomes which the query covers entirely are copied without reading their
+            records if the LinearIndex knows their spans and none of their records is unmapped, see
+            bamit::LinearIndex::get_span. Their BGZF blocks are copied as they are, and only the blocks they begin and
+            end in are decompressed. Of the other records, a block which starts and ends with a record and holds only
+            overlapping records is copied as it is as well, and the rest is compressed into new blocks. Records are
+            only read in place, and on chromosomes which the query covers from their beginning only their position and
+            flag are looked at.
+*/
+template <typename tree_type>
+inline size_t extract_overlap_records(std::filesystem::path const & bam_path,
+                                      std::vector<tree_type> const & node_list,
+                                      Position const & start,
+                                      Position const & end,
+                                      std::filesystem::path const & out_path,
+                                      int const level = Z_DEFAULT_COMPRESSION,
+                                      LinearIndex const & linear_index = LinearIndex{})
+{
+    BgzfWriter writer{out_path, level};
+    BamScanner{bam_path}.write_header(writer);
+
+    std::streamoff file_position{-1};
+    get_tree_file_position(node_list, start, end, file_position, linear_index);
+    size_t record_count{0};
+    if (file_position == -1)
+    {
+        writer.close();
+        return record_count;
+    }
+
+    // The chromosomes between the ones of start and end are covered entirely, so all their records are written if
+    // none is unmapped. Their spans are merged where they follow each other.
+    std::vector<std::pair<std::streamoff, std::streamoff>> raw_spans{};
+    for (int32_t i = std::get<0>(start) + overlap_needs_end(std::get<0>(start), start); i < std::get<0>(end); ++i)
+    {
+        ChromosomeSpan const & span = linear_index.get_span(i);
+        if (span.begin < file_position || span.end == -1 || span.unmapped != 0) continue;
+        if (!raw_spans.empty() && raw_spans.back().second == span.begin) raw_spans.back().second = span.end;
+        else raw_spans.emplace_back(span.begin, span.end);
+        record_count += span.mapped;
+    }
+
+    std::ifstream file{bam_path, std::ios_base::binary | std::ios_base::in};
+    std::vector<char> compressed(bgzf_max_block_size);
+    std::vector<char> data{};
+    // Read the next block into compressed and return its size, or 0 at the end of the file.
+    auto read_block = [&] ()
+    {
+        if (!file.read(compressed.data(), 18)) return size_t{0};
+        size_t const size = bgzf_block_size(compressed.data(), 18);
+        if (size == 0 || !file.read(compressed.data() + 18, size - 18))
+            throw std::runtime_error{"ERROR: Corrupt BGZF block in " + bam_path.string() + "."};
+        return size;
+    };
+
+    // Copy the data between two file positions. Only the blocks they lie in are decompressed.
+    auto copy_span = [&] (std::streamoff const begin, std::streamoff const span_end)
+    {
+        uint64_t block_offset = static_cast<uint64_t>(begin) >> 16;
+        size_t position = static_cast<uint64_t>(begin) & 0xFFFF;
+        uint64_t const end_block = static_cast<uint64_t>(span_end) >> 16;
+        size_t const end_position = static_cast<uint64_t>(span_end) & 0xFFFF;
+        file.clear();
+        file.seekg(block_offset);
+        while (block_offset < end_block || (block_offset == end_block && position < end_position))
+        {
+            size_t const size = read_block();
+            if (size == 0)
+                throw std::runtime_error{"ERROR: Corrupt BGZF block in " + bam_path.string() + "."};
+            if (position == 0 && block_offset < end_block)
+            {
+                writer.write_compressed_block(compressed.data(), size);
+            }
+            else
+            {
+                bgzf_inflate_block(compressed.data(), size, data);
+                size_t const data_end = block_offset == end_block ? std::min(end_position, data.size()) : data.size();
+                if (position < data_end) writer.write(data.data() + position, data_end - position);
+            }
+            block_offset += size;
+            position = 0;
+        }
+    };
+
+    // Copy the overlapping records from a file position up to the records at stop, reading every record. Returns
+    // true once the first record after the query was reached.
+    std::vector<char> record{}; // The record being read, which may continue in the next block.
+    std::vector<char> kept{};   // The overlapping records completed in the current block.
+    auto copy_records = [&] (std::streamoff const begin, std::streamoff const stop)
+    {
+        uint64_t block_offset = static_cast<uint64_t>(begin) >> 16;
+        size_t position = static_cast<uint64_t>(begin) & 0xFFFF;
+        file.clear();
+        file.seekg(block_offset);
+        record.clear();
+        bool done{false};
+        bool stopped{false};
+        while (!done && !stopped)
+        {
+            if (record.empty() && static_cast<std::streamoff>((block_offset << 16) | position) >= stop) break;
+            size_t const size = read_block();
+            if (size == 0) break;
+            bgzf_inflate_block(compressed.data(), size, data);
+
+            bool whole_block = record.empty() && position == 0;
+            kept.clear();
+            while (position < data.size() && !done)
+            {
+                if (record.empty() && static_cast<std::streamoff>((block_offset << 16) | position) >= stop)
+                {
+                    stopped = true;
+                    break;
+                }
+                // Records lying within the block are read in place, others are collected in record first: the
+                // block_size field, then the rest of the record.
+                char const * record_data{nullptr};
+                size_t record_size{4};
+                int32_t block_size{};
+                if (record.empty() && data.size() - position >= 4)
+                    std::memcpy(&block_size, data.data() + position, 4);
+                if (block_size >= 32 && 4u + block_size <= data.size() - position)
+                {
+                    record_data = data.data() + position;
+                    record_size += block_size;
+                    position += record_size;
+                }
+                else
+                {
+                    if (record.size() >= 4)
+                    {
+                        std::memcpy(&block_size, record.data(), 4);
+                        if (block_size < 32)
+                            throw std::runtime_error{"ERROR: Corrupt BAM record in " + bam_path.string() + "."};
+                        record_size += block_size;
+                    }
+                    size_t const n = std::min(record_size - record.size(), data.size() - position);
+                    record.insert(record.end(), data.begin() + position, data.begin() + position + n);
+                    position += n;
+                    if (record.size() == 4 || record.size() < record_size) continue;
+                    record_data = record.data();
+                }
+
+                int32_t ref_id{}, reference_position{};
+                uint16_t flag{};
+                std::memcpy(&ref_id, record_data + 4, 4);
+                std::memcpy(&reference_position, record_data + 8, 4);
+                std::memcpy(&flag, record_data + 18, 2);
+
+                // Stop at the first record starting after the query and at the unplaced reads, and skip unmapped
+                // reads and reads ending before the query, like bamit::get_overlap_range. Chromosomes which the query
+                // covers from their beginning are copied without looking at the cigar of their records.
+                bool keep{false};
+                if (ref_id == -1 || Position{ref_id, reference_position} >= end)
+                {
+                    done = true;
+                }
+                else if (reference_position != -1 && !(flag & static_cast<uint16_t>(seqan3::sam_flag::unmapped)))
+                {
+                    keep = true;
+                    if (overlap_needs_end(ref_id, start))
+                    {
+                        uint8_t const name_length = static_cast<uint8_t>(record_data[12]);
+                        uint16_t cigar_count{};
+                        std::memcpy(&cigar_count, record_data + 16, 2);
+                        if (36u + name_length + 4u * cigar_count > record_size)
+                            throw std::runtime_error{"ERROR: Corrupt BAM record in " + bam_path.string() + "."};
+                        keep = Position{ref_id, reference_position +
+                                                bam_cigar_length(record_data + 36 + name_length, cigar_count)} >= start;
+                    }
+                }
+                if (keep)
+                {
+                    kept.insert(kept.end(), record_data, record_data + record_size);
+                    ++record_count;
+                }
+                else
+                {
+                    whole_block = false;
+                }
+                record.clear();
+            }
+
+            if (whole_block && !stopped && record.empty() && !kept.empty())
+                writer.write_compressed_block(compressed.data(), size);
+            else
+                writer.write(kept.data(), kept.size());
+            block_offset += size;
+            position = 0;
+        }
+        return done;
+    };
+
+    bool done{false};
+    for (auto const & [span_begin, span_end] : raw_spans)
+    {
+        if (file_position < span_begin) done = copy_records(file_position, span_begin);
+        if (done) break;
+        copy_span(span_begin, span_end);
+        file_position = span_end;
+    }
+    if (!done) copy_records(file_position, std::numeric_limits<std::streamoff>::max());
+    writer.close();
+    return record_count;
+}
+
+/*! The lower and upper bound of the number of records overlapping a query, as given by
+ *  bamit::get_overlap_count_bounds. The bounds are equal if the index alone gives the exact number.
+ */
+struct OverlapCount
+{
+    uint64_t lower{0}, upper{0};
+};
+
+/*!
+   \brief Bound the number of records of one chromosome which end at or after lo and start before hi.
+   \param node The current node.
+   \param lo The start of the query.
+   \param hi The end of the query.
+   \param lower All records in the subtree of node start at or after lower.
+   \param upper All records in the subtree of node end before upper.
+   \param result The bounds to add the records of the subtree to.
+   \param partial If not nullptr, receives the nodes whose records may overlap the query only in part.
+   \details A node whose median lies in the query contributes all its records. A node whose median lies to one side of
+            the query can only contribute records which reach into the query, which is unknown without reading them.
+            Subtrees which lie completely inside the query contribute their record count without being visited, so
+            only the two paths from the root towards the ends of the query are followed.
+*/
+inline void count_overlap_bounds(IntervalNode const * node,
+                                 int64_t const lo,
+                                 int64_t const hi,
+                                 int64_t const lower,
+                                 int64_t const upper,
+                                 OverlapCount & result,
+                                 std::vector<IntervalNode const *> * partial = nullptr)
+{
+    if (!node || upper <= lo || lower >= hi) return;
+    if (lower >= lo && upper <= hi)
+    {
+        result.lower += node->get_subtree_count();
+        result.upper += node->get_subtree_count();
+        return;
+    }
+
+    int64_t const median = node->get_median();
+    if (median < lo)
+    {
+        // The records end at or after the median, the left subtree ends before it.
+        if (node->get_count() > 0 && node->get_end() >= lo)
+        {
+            result.upper += node->get_count();
+            if (partial) partial->push_back(node);
+        }
+        count_overlap_bounds(node->get_right_node().get(), lo, hi, median + 1, upper, result, partial);
+    }
+    else if (median >= hi)
+    {
+        // The records start at or before the median, the right subtree starts after it.
+        if (node->get_count() > 0 && node->get_start() < hi)
+        {
+            result.upper += node->get_count();
+            if (partial) partial->push_back(node);
+        }
+        count_overlap_bounds(node->get_left_node().get(), lo, hi, lower, median, result, partial);
+    }
+    else
+    {
+        result.lower += node->get_count();
+        result.upper += node->get_count();
+        count_overlap_bounds(node->get_left_node().get(), lo, hi, lower, median, result, partial);
+        count_overlap_bounds(node->get_right_node().get(), lo, hi, median + 1, upper, result, partial);
+    }
+}
+
+/*!
+   \brief Check whether a tree stores the record counts of its nodes.
+   \param node The root of the tree of one chromosome.
+   \return Returns `false` if the tree was read from an index file written before the nodes were versioned, see
+           bamit::read_cereal_trees.
+   \details Every tree built by bamit::index counts the records of its root, unless the chromosome has none, in which
+            case the root is empty.
+*/
+inline bool has_record_counts(IntervalNode const * node)
+{
+    return !node || node->get_subtree_count() > 0 ||
+           (node->get_file_position() == -1 && !node->get_left_node() && !node->get_right_node());
+}
+
+/*!
+   \brief Get the query of one chromosome for a query given by Positions.
+   \param chromosome The chromosome, between the chromosomes of start and end.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \return Returns lo and hi such that the records of the chromosome overlapping the query end at or after lo and
+           start before hi.
+*/
+inline std::pair<int64_t, int64_t> chromosome_query(int32_t const chromosome, Position const & start, Position const & end)
+{
+    return {chromosome == std::get<0>(start) ? std::get<1>(start) : 0,
+            chromosome == std::get<0>(end) ? std::get<1>(end) : std::numeric_limits<int64_t>::max()};
+}
+
+/*!
+   \brief Bound the number of records which overlap a given start and end position from the index alone.
+   \param node_list The list of interval trees per chromosome, as returned by bamit::index.
+   \param start The start position of the search.
+   \param end The end position of the search.
+
+   \return Returns the bounds of the number of records bamit::get_overlap_range would find.
+   \details The records intersecting the median of a node overlap the query if the median lies in it, and whole
+            subtrees lie in the query if it spans them. Only the nodes on the paths towards the ends of the query
+            are uncertain, so the bounds are tight for wide queries. Use bamit::get_overlap_count for the exact number.
+            If a tree of the query lacks the record counts, see bamit::has_record_counts, the upper bound is the
+            largest uint64_t.
+*/
+inline OverlapCount get_overlap_count_bounds(std::vector<std::unique_ptr<IntervalNode>> const & node_list,
+                                             Position const & start,
+                                             Position const & end)
+{
+    OverlapCount result{};
+    bool unbounded{false};
+    for (int32_t i = std::get<0>(start); i <= std::get<0>(end); ++i)
+    {
+        auto const [lo, hi] = chromosome_query(i, start, end);
+        if (!has_record_counts(node_list[i].get())) unbounded = true;
+        else count_overlap_bounds(node_list[i].get(), lo, hi, 0, std::numeric_limits<int64_t>::max(), result);
+    }
+    if (unbounded) result.upper = std::numeric_limits<uint64_t>::max();
+    return result;
+}
+
+/*!
+   \brief Count the records which overlap a given start and end position by reading all records which may overlap it.
+   \param scanner The BAM file to query, which is moved to the end of the query.
+   \param node_list The list of interval trees, either as root IntervalNodes or as FlatIntervalTrees.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read.
+   \return Returns the number of records bamit::get_overlap_range would find.
+*/
+template <typename tree_type>
+inline size_t count_overlap_records(BamScanner & scanner,
+                                    std::vector<tree_type> const & node_list,
+                                    Position const & start,
+                                    Position const & end,
+                                    LinearIndex const & linear_index)
+{
+    std::streamoff file_position{-1};
+    get_tree_file_position(node_list, start, end, file_position, linear_index);
+    if (file_position == -1) return 0;
+
+    size_t count{0};
+    scanner.seek(file_position);
+    while (scanner.next())
+    {
+        int32_t const ref_id = scanner.get_reference_id();
+        int32_t const position = scanner.get_reference_position();
+        if (ref_id == -1 || Position{ref_id, position} >= end) break;
+        if (!scanner.unmapped() && Position{ref_id, position + scanner.get_length()} >= start) ++count;
+    }
+    return count;
+}
+
+/*!
+   \brief Count the records which overlap a given start and end position in a BAM file.
+   \param scanner The BAM file to query, which is moved to the end of the query.
+   \param node_list The list of interval trees, either as root IntervalNodes or as FlatIntervalTrees.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read. Empty by default.
+
+   \return Returns the number of records bamit::get_overlap_range would find.
+   \details Only the position, cigar and flag of the records are read, see bamit::BamScanner. The scanner can be used
+            for any number of queries. With IntervalNodes, the records counted by bamit::get_overlap_count_bounds for
+            sure are not read. Only the records of the uncertain nodes are, which lie near the ends of the query.
+            Trees without record counts, see bamit::has_record_counts, are counted by reading all records from the
+            left-most one which may overlap the query.
+*/
+template <typename tree_type>
+inline size_t get_overlap_count(BamScanner & scanner,
+                                std::vector<tree_type> const & node_list,
+                                Position const & start,
+                                Position const & end,
+                                LinearIndex const & linear_index = LinearIndex{})
+{
+    if constexpr (std::same_as<tree_type, std::unique_ptr<IntervalNode>>)
+    {
+        for (int32_t i = std::get<0>(start); i <= std::get<0>(end); ++i)
+        {
+            if (!has_record_counts(node_list[i].get()))
+                return count_overlap_records(scanner, node_list, start, end, linear_index);
+        }
+
+        OverlapCount bounds{};
+        // The uncertain nodes, with the chromosome and the position from which on none of their records overlaps.
+        std::vector<IntervalNode const *> partial{};
+        std::vector<std::tuple<std::streamoff, Position, IntervalNode const *>> scans{};
+        for (int32_t i = std::get<0>(start); i <= std::get<0>(end); ++i)
+        {
+            auto const [lo, hi] = chromosome_query(i, start, end);
+            partial.clear();
+            count_overlap_bounds(node_list[i].get(), lo, hi, 0, std::numeric_limits<int64_t>::max(), bounds, &partial);
+            for (IntervalNode const * node : partial)
+            {
+                int32_t const stop = node->get_median() < lo ? node->get_median() + 1 : hi;
+                // Records ending before lo are not counted, so the scan can begin at the window of lo.
+                std::streamoff file_position = node->get_file_position();
+                linear_index.cap(Position{i, static_cast<int32_t>(lo)}, file_position);
+                scans.emplace_back(file_position, Position{i, stop}, node);
+            }
+        }
+        if (bounds.lower == bounds.upper) return bounds.lower;
+
+        // Read the records from the left-most record of each uncertain node until none of its records can follow,
+        // reading every record at most once. Only records stored by an uncertain node are counted, as all others were
+        // already counted by the bounds.
+        std::ranges::sort(scans);
+        // The uncertain nodes of all chromosomes, sorted so that the node of every record is looked up in log time.
+        std::vector<IntervalNode const *> uncertain{};
+        uncertain.reserve(scans.size());
+        for (auto const & scan : scans)
+            uncertain.push_back(std::get<2>(scan));
+        std::ranges::sort(uncertain);
+        size_t count = bounds.lower;
+        std::streamoff scanned_until{-1};
+        for (auto const & [file_position, stop, scan_node] : scans)
+        {
+            if (file_position > scanned_until) scanner.seek(file_position);
+            else scanner.seek(scanned_until);
+            while (scanner.next())
+            {
+                int32_t const ref_id = scanner.get_reference_id();
+                int32_t const position = scanner.get_reference_position();
+                if (ref_id == -1 || Position{ref_id, position} >= stop) break;
+                if (scanner.unmapped() || Position{ref_id, position} >= end ||
+                    Position{ref_id, position + scanner.get_length()} < start) continue;
+
+                // Find the node storing the record like bamit::split_records.
+                uint32_t const position_end = position + scanner.get_length();
+                IntervalNode const * node = node_list[ref_id].get();
+                while (node)
+                {
+                    if (position_end < node->get_median()) node = node->get_left_node().get();
+                    else if (static_cast<uint32_t>(position) > node->get_median()) node = node->get_right_node().get();
+                    else break;
+                }
+                if (std::ranges::binary_search(uncertain, node)) ++count;
+            }
+            scanned_until = std::max(scanned_until, scanner.get_file_position());
+        }
+        return count;
+    }
+    else
+    {
+        return count_overlap_records(scanner, node_list, start, end, linear_index);
+    }
+}
+
+/*! A part of an alignment file holding records which may overlap a query, as given by bamit::get_overlap_chunks. The
+ *  part begins with the record at begin and ends with the record at end, both included.
+ */
+struct Chunk
+{
+    std::streamoff begin{-1}, end{-1};
+};
+
+/*!
+   \brief Collect the chunks of the nodes of one chromosome whose records may overlap a query.
+   \param node The current node.
+   \param lo The start of the query.
+   \param hi The end of the query.
+   \param chunks The list to add a chunk from the first to the last record of every such node to.
+*/
+inline void collect_overlap_chunks(IntervalNode const * node,
+                                   int64_t const lo,
+                                   int64_t const hi,
+                                   std::vector<Chunk> & chunks)
+{
+    if (!node) return;
+    if (node->get_count() > 0 && node->get_start() < hi && node->get_end() >= lo)
+        chunks.push_back(Chunk{node->get_file_position(), node->get_last_file_position()});
+    // The records of the left subtree end before the median, the ones of the right subtree start after it.
+    int64_t const median = node->get_median();
+    if (lo < median) collect_overlap_chunks(node->get_left_node().get(), lo, hi, chunks);
+    if (median + 1 < hi) collect_overlap_chunks(node->get_right_node().get(), lo, hi, chunks);
+}
+
+/*!
+   \brief Find the parts of the file which hold the records overlapping a given start and end position.
+   \param node_list The list of interval trees per chromosome, as returned by bamit::index.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param linear_index The bamit::LinearIndex of the file, which cuts off records ending before the query. Empty by
+                       default.
+
+   \return Returns disjoint bamit::Chunks sorted by their position in the file, which hold every record overlapping
+           the query. Read them with bamit::read_overlap_chunks.
+   \details Every node which may store an overlapping record contributes the part of the file from its first to its
+            last record. Unlike the single position of bamit::get_overlap_file_position, this skips the records between
+            the nodes, e.g. the many short reads left of a query which a long read reaching into the query is stored
+            with. Overlapping chunks are merged. The file positions are only compared as a whole, so that they may be
+            BGZF virtual offsets of a BAM file or plain offsets of a SAM file. If a tree of the query lacks the record counts, see bamit::has_record_counts, a
+            single chunk from the position of bamit::get_tree_file_position to the end of the file is returned.
+*/
+inline std::vector<Chunk> get_overlap_chunks(std::vector<std::unique_ptr<IntervalNode>> const & node_list,
+                                             Position const & start,
+                                             Position const & end,
+                                             LinearIndex const & linear_index = LinearIndex{})
+{
+    std::vector<Chunk> chunks{};
+    for (int32_t i = std::get<0>(start); i <= std::get<0>(end); ++i)
+    {
+        if (!has_record_counts(node_list[i].get()))
+        {
+            std::streamoff file_position{-1};
+            get_tree_file_position(node_list, start, end, file_position, linear_index);
+            if (file_position == -1) return {};
+            return {Chunk{file_position, std::numeric_limits<std::streamoff>::max()}};
+        }
+        auto const [lo, hi] = chromosome_query(i, start, end);
+        collect_overlap_chunks(node_list[i].get(), lo, hi, chunks);
+    }
+    std::streamoff first{0};
+    linear_index.cap(start, first);
+
+    std::ranges::sort(chunks, {}, &Chunk::begin);
+    std::vector<Chunk> merged{};
+    for (Chunk chunk : chunks)
+    {
+        if (chunk.end < first) continue;
+        chunk.begin = std::max(chunk.begin, first);
+        if (!merged.empty() && chunk.begin <= merged.back().end)
+            merged.back().end = std::max(merged.back().end, chunk.end);
+        else
+            merged.push_back(chunk);
+    }
+    return merged;
+}
+
+/*!
+   \brief Read the records which overlap a given start and end position from the chunks holding them.
+   \param input The sam file input of type bamit::seqan3::sam_file_input.
+   \param chunks The chunks of the query, as returned by bamit::get_overlap_chunks.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param callback Called with every record overlapping the query, in the order of the file.
+   \details The input seeks to the beginning of every chunk and reads it up to its end, so the records between chunks
+            are never decoded. The records found are the ones of bamit::get_overlap_range.
+*/
+template <typename traits_type, typename fields_type, typename format_type, typename callback_type>
+inline void read_overlap_chunks(seqan3::sam_file_input<traits_type, fields_type, format_type> & input,
+                                std::vector<Chunk> const & chunks,
+                                Position const & start,
+                                Position const & end,
+                                callback_type && callback)
+{
+    // Very first thing: Check that required fields are non-empty.
+    static_assert(fields_type::contains(seqan3::field::ref_id),
+                  "Input file must define fields seqan3::field::ref_id, seqan3::field::ref_offset, seqan3::field::cigar, and seqan3::field::flag");
+    static_assert(fields_type::contains(seqan3::field::ref_offset),
+                  "Input file must define fields seqan3::field::ref_id, seqan3::field::ref_offset, seqan3::field::cigar, and seqan3::field::flag");
+    static_assert(fields_type::contains(seqan3::field::cigar),
+                  "Input file must define fields seqan3::field::ref_id, seqan3::field::ref_offset, seqan3::field::cigar, and seqan3::field::flag");
+    static_assert(fields_type::contains(seqan3::field::flag),
+                  "Input file must define fields seqan3::field::ref_id, seqan3::field::ref_offset, seqan3::field::cigar, and seqan3::field::flag");
+
+    auto it = input.begin();
+    for (Chunk const & chunk : chunks)
+    {
+        it.seek_to(static_cast<std::streampos>(chunk.begin));
+        for (; it != input.end() && static_cast<std::streamoff>(it.file_position()) <= chunk.end; ++it)
+        {
+            auto & record = *it;
+            // The unplaced records at the end of the file follow all records which may overlap.
+            if (!record.reference_id().has_value()) return;
+            if (unmapped(record)) continue;
+            Position const record_start{record.reference_id().value(), record.reference_position().value()};
+            // All later chunks start after this record, so none of their records overlaps either.
+            if (record_start >= end) return;
+            if (!overlap_needs_end(std::get<0>(record_start), start) ||
+                Position{std::get<0>(record_start),
+                         std::get<1>(record_start) + get_length(record.cigar_sequence())} >= start) callback(record);
+        }
+    }
+}
+
+/*!
+   \brief Find the records which overlap a given start and end position.
+   \param input The sam file input of type bamit::seqan3::sam_file_input.
+   \param node_list The list of interval trees, either as root IntervalNodes or as FlatIntervalTrees.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param verbose Print verbose output.
+   \param outname The output filename. If not provided the function will only return the file position and
+                  not write to any file.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read. Empty by default.
+
+   \return Returns a vector of seqan3::sam_record objects containing records overlapping the query.
+   \details The main function for obtaining a vector of records which overlap a query. If just the file position is
+            desired, use bamit::get_overlap_file_position instead. To process the records without storing all of them,
+            use bamit::get_overlap_range.
+*/
+template <typename traits_type, typename fields_type, typename format_type, typename tree_type>
+inline auto get_overlap_records(seqan3::sam_file_input<traits_type, fields_type, format_type> & input,
+                                std::vector<tree_type> const & node_list,
+                                Position const & start,
+                                Position const & end,
+                                bool const & verbose = false,
+                                std::filesystem::path const & outname = "",
+                                LinearIndex const & linear_index = LinearIndex{})
+{
+    auto results_list = get_overlap_range(input, node_list, start, end, linear_index)
+                      | seqan3::ranges::to<std::vector>();
     if (results_list.empty() && verbose)
     {
         seqan3::debug_stream << "No overlapping reads found for query "
@@ -467,15 +1829,169 @@ inline auto get_overlap_records(seqan3::sam_file_input<traits_type, fields_type,
     return results_list;
 }
 
-template <class Archive>
-inline void write(std::vector<std::unique_ptr<IntervalNode>> const & node_list, Archive & archive)
+/*!
+   \brief Find the records which overlap any of many queries, reading the file once from left to right.
+   \param input The sam file input of type bamit::seqan3::sam_file_input.
+   \param node_list The list of interval trees, either as root IntervalNodes or as FlatIntervalTrees.
+   \param regions The start and end Positions of the queries, in any order.
+   \param callback Called with every record overlapping at least one query, in the order of the file, and the sorted
+                   indices of all queries in regions which it overlaps.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read. Empty by default.
+   \details The queries are sorted, and overlapping or adjacent queries are coalesced, so that each record is read at
+            most once. For every coalesced query the Interval Tree gives the position to continue at, which is only
+            sought to if it is ahead of the records already read. A record overlaps a query under the same conditions
+            as in bamit::get_overlap_records.
+*/
+template <typename traits_type, typename fields_type, typename format_type, typename tree_type, typename callback_type>
+inline void get_batch_overlap_records(seqan3::sam_file_input<traits_type, fields_type, format_type> & input,
+                                      std::vector<tree_type> const & node_list,
+                                      std::vector<std::pair<Position, Position>> const & regions,
+                                      callback_type && callback,
+                                      LinearIndex const & linear_index = LinearIndex{})
 {
-    archive(node_list);
+    // Very first thing: Check that required fields are non-empty.
+    static_assert(fields_type::contains(seqan3::field::ref_id),
+                  "Input file must define fields seqan3::field::ref_id, seqan3::field::ref_offset, seqan3::field::cigar, and seqan3::field::flag");
+    static_assert(fields_type::contains(seqan3::field::ref_offset),
+                  "Input file must define fields seqan3::field::ref_id, seqan3::field::ref_offset, seqan3::field::cigar, and seqan3::field::flag");
+    static_assert(fields_type::contains(seqan3::field::cigar),
+                  "Input file must define fields seqan3::field::ref_id, seqan3::field::ref_offset, seqan3::field::cigar, and seqan3::field::flag");
+    static_assert(fields_type::contains(seqan3::field::flag),
+                  "Input file must define fields seqan3::field::ref_id, seqan3::field::ref_offset, seqan3::field::cigar, and seqan3::field::flag");
+
+    // Sort the queries by their start and keep the largest end of every prefix of them. The queries overlapping a
+    // record are then found by going left from the last query starting before the record ends, until no query
+    // further left ends after the record starts.
+    std::vector<size_t> order(regions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::stable_sort(order, [&regions](size_t const a, size_t const b)
+    {
+        return regions[a].first < regions[b].first;
+    });
+    std::vector<Position> max_end(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        max_end[i] = i == 0 ? regions[order[i]].second : std::max(max_end[i - 1], regions[order[i]].second);
+
+    std::vector<size_t> overlapping{};
+    auto it = input.begin();
+    bool started{false};
+    for (size_t group_begin = 0; group_begin < order.size();)
+    {
+        // Coalesce the queries overlapping or adjacent to each other into one query.
+        size_t group_end = group_begin + 1;
+        while (group_end < order.size() && regions[order[group_end]].first <= max_end[group_end - 1]) ++group_end;
+        Position const start = regions[order[group_begin]].first;
+        Position const end = max_end[group_end - 1];
+        group_begin = group_end;
+
+        std::streamoff file_position{-1};
+        get_tree_file_position(node_list, start, end, file_position, linear_index);
+        if (file_position == -1) continue;
+        // Records between the tree's position and the current one were already read and given to all queries they
+        // overlap, because the file is sorted. So only seek forward.
+        if (started && it == input.end()) break;
+        if (!started || file_position > static_cast<std::streamoff>(it.file_position()))
+        {
+            it.seek_to(static_cast<std::streampos>(file_position));
+            started = true;
+        }
+
+        for (; it != input.end(); ++it)
+        {
+            auto & record = *it;
+            if (unmapped(record))
+            {
+                if (!record.reference_id().has_value()) break; // Unplaced reads are at the end of a sorted file.
+                continue;
+            }
+            Position const record_start{record.reference_id().value(), record.reference_position().value()};
+            if (record_start >= end) break;
+            Position const record_end{std::get<0>(record_start),
+                                      std::get<1>(record_start) + get_length(record.cigar_sequence())};
+
+            overlapping.clear();
+            size_t i = std::ranges::upper_bound(order, record_end, std::less<>{},
+                                                [&regions](size_t const index) { return regions[index].first; })
+                     - order.begin();
+            for (; i > 0 && record_start < max_end[i - 1]; --i)
+            {
+                auto const & [region_start, region_end] = regions[order[i - 1]];
+                if (record_start < region_end && record_end >= region_start) overlapping.push_back(order[i - 1]);
+            }
+            if (overlapping.empty()) continue;
+            std::ranges::sort(overlapping);
+            callback(record, overlapping);
+        }
+    }
 }
 
-template <class Archive>
-inline void read(std::vector<std::unique_ptr<IntervalNode>> & node_list, Archive & archive)
+/*! Starts the index files written by bamit::write, "BAMITCV2" read as little endian integer. Files written before the
+ *  nodes were versioned start with the number of chromosomes instead, followed by the unversioned nodes.
+ */
+inline constexpr uint64_t cereal_index_magic{0x32564354494D4142};
+
+/*!
+   \brief Read the trees of an index file read with cereal.
+   \param node_list The list to read the interval trees per chromosome into.
+   \param archive The archive, positioned at the start of the file.
+   \return Returns `true` if the file was written by bamit::write, `false` if it was written before the nodes were
+           versioned.
+   \details The trees of older files lack the record counts, see bamit::has_record_counts. The queries fall back to
+            reading the records for them, so they are slower until the index is rebuilt.
+*/
+template <class Archive, typename tree_type>
+inline bool read_cereal_trees(std::vector<tree_type> & node_list, Archive & archive)
 {
-    archive(node_list);
+    uint64_t magic{};
+    archive(magic);
+    if (magic == cereal_index_magic)
+    {
+        archive(node_list);
+        return true;
+    }
+    if constexpr (!std::same_as<tree_type, std::unique_ptr<IntervalNode>>)
+        throw std::runtime_error{"ERROR: The index file was written by an older version of bamit. Please rebuild the "
+                                 "index."};
+
+    // The magic number is the number of chromosomes, followed by the trees as cereal writes std::unique_ptrs.
+    node_list.clear();
+    node_list.resize(magic);
+    for (auto & node : node_list)
+    {
+        uint8_t valid{};
+        archive(valid);
+        if (!valid) continue;
+        node = std::make_unique<IntervalNode>();
+        node->load_unversioned(archive);
+    }
+    return false;
+}
+
+template <class Archive, typename tree_type>
+inline void write(std::vector<tree_type> const & node_list, Archive & archive)
+{
+    archive(cereal_index_magic, node_list);
+}
+
+template <class Archive, typename tree_type>
+inline void read(std::vector<tree_type> & node_list, Archive & archive)
+{
+    read_cereal_trees(node_list, archive);
+}
+
+template <class Archive, typename tree_type>
+inline void write(std::vector<tree_type> const & node_list, LinearIndex const & linear_index, Archive & archive)
+{
+    archive(cereal_index_magic, node_list, linear_index);
+}
+
+template <class Archive, typename tree_type>
+inline void read(std::vector<tree_type> & node_list, LinearIndex & linear_index, Archive & archive)
+{
+    // Files written before the nodes were versioned have no LinearIndex either.
+    if (read_cereal_trees(node_list, archive)) archive(linear_index);
+    else linear_index = LinearIndex{};
 }
 } // namespace bamit
+
+CEREAL_CLASS_VERSION(bamit::IntervalNode, 2);
@@ -0,0 +1,276 @@
+#pragma once
+#include <cereal/archives/binary.hpp>
+
+#include <bamit/IntervalNode.hpp>
+#include <bamit/LinearIndex.hpp>
+#include <bamit/TreeEncoding.hpp>
+
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bamit
+{
+//!\brief The bytes an index file with a per-chromosome offset table begins with.
+inline constexpr std::array<char, 8> lazy_index_magic{'B', 'A', 'M', 'I', 'T', 'O', 'F', 'S'};
+
+//!\brief The version of the index format written by bamit::write_lazy_index. Version 3 stores the windows of the
+//!       LinearIndex with the tree of each chromosome, version 4 adds the span of the chromosome. Files of older
+//!       versions are rejected.
+inline constexpr uint32_t lazy_index_version{4};
+
+/*!
+   \brief Write an index which can be loaded one chromosome at a time by bamit::LazyIndex.
+   \param path The path of the index file, which is overwritten if it exists.
+   \param node_list The list of interval trees per chromosome, as returned by bamit::index.
+   \param linear_index The bamit::LinearIndex of the alignment file, which may be empty.
+   \details The file holds bamit::lazy_index_magic, the version, the window size of the LinearIndex and a table with
+            the offset of every chromosome, followed by the chromosomes. Every chromosome holds the windows and the span
+            of the LinearIndex, see bamit::LinearIndex::get_offsets and bamit::LinearIndex::get_span, and the tree encoded by bamit::encode_tree on its own, so
+            it can be read without reading the ones before it.
+*/
+inline void write_lazy_index(std::filesystem::path const & path,
+                             std::vector<std::unique_ptr<IntervalNode>> const & node_list,
+                             LinearIndex const & linear_index)
+{
+    std::ofstream out{path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc};
+    if (!out.is_open())
+        throw std::runtime_error{"ERROR: Could not open " + path.string() + "."};
+
+    // The offsets of the trees and the end of the last one. The table has a fixed size, so it is written twice: once
+    // to reserve its space and once the offsets are known.
+    std::vector<uint64_t> offsets(node_list.size() + 1);
+    auto write_table = [&] ()
+    {
+        out.write(lazy_index_magic.data(), lazy_index_magic.size());
+        cereal::BinaryOutputArchive archive{out};
+        archive(lazy_index_version, linear_index.get_window_size(), offsets);
+    };
+    write_table();
+    std::string encoded{};
+    for (size_t i = 0; i < node_list.size(); ++i)
+    {
+        offsets[i] = out.tellp();
+        {
+            cereal::BinaryOutputArchive archive{out};
+            archive(linear_index.get_offsets(i), linear_index.get_span(i));
+        }
+        encoded.clear();
+        encode_tree(node_list[i], encoded);
+        out.write(encoded.data(), encoded.size());
+    }
+    offsets.back() = out.tellp();
+
+    out.seekp(0);
+    write_table();
+    out.close();
+    if (out.fail())
+        throw std::runtime_error{"ERROR: Could not write " + path.string() + "."};
+}
+
+/*!
+   \brief Check whether a file is an index written by bamit::write_lazy_index.
+   \param path The path of the index file.
+   \return Returns `true` if the file begins with bamit::lazy_index_magic.
+*/
+inline bool is_lazy_index(std::filesystem::path const & path)
+{
+    std::array<char, 8> magic{};
+    std::ifstream in{path, std::ios_base::binary | std::ios_base::in};
+    return in.read(magic.data(), magic.size()) && magic == lazy_index_magic;
+}
+
+/*! The LazyIndex class reads the interval trees of an index file written by bamit::write_lazy_index when they are
+ *  first needed, together with the windows and the span of the LinearIndex of their chromosome. Opening the index only reads its
+ *  offset table, so the time to answer a query depends on the chromosomes it touches and not on the number of
+ *  chromosomes of the reference.
+ *
+ *  The trees are loaded by bamit::LazyIndex::load, which may be called by several threads at once. Every tree is read
+ *  exactly once, by the first thread needing it, while threads needing other trees read those at the same time.
+ */
+class LazyIndex
+{
+private:
+    std::filesystem::path path{};
+    std::vector<uint64_t> offsets{};
+    std::vector<std::unique_ptr<IntervalNode>> node_list{};
+    std::unique_ptr<std::once_flag[]> loaded{};
+    std::unique_ptr<std::atomic<size_t>> loaded_count{std::make_unique<std::atomic<size_t>>(0)};
+    LinearIndex linear_index{};
+
+    /*!
+       \brief Read the tree and the windows and the span of the LinearIndex of a chromosome.
+       \param ref_id The reference sequence.
+    */
+    void read_tree(size_t const ref_id)
+    {
+        std::ifstream in{path, std::ios_base::binary | std::ios_base::in};
+        in.seekg(offsets[ref_id]);
+        if (!in)
+            throw std::runtime_error{"ERROR: Could not read " + path.string() + "."};
+        std::vector<std::streamoff> windows{};
+        ChromosomeSpan span{};
+        try
+        {
+            cereal::BinaryInputArchive archive{in};
+            archive(windows, span);
+        }
+        catch (cereal::Exception const &)
+        {
+            throw std::runtime_error{"ERROR: Corrupt index file " + path.string() + "."};
+        }
+        uint64_t const tree_offset = in.tellg();
+        if (!in || tree_offset > offsets[ref_id + 1])
+            throw std::runtime_error{"ERROR: Corrupt index file " + path.string() + "."};
+
+        std::string encoded(offsets[ref_id + 1] - tree_offset, '\0');
+        if (!in.read(encoded.data(), encoded.size()))
+            throw std::runtime_error{"ERROR: Could not read " + path.string() + "."};
+        try
+        {
+            node_list[ref_id] = decode_tree(encoded);
+        }
+        catch (std::runtime_error const &)
+        {
+            throw std::runtime_error{"ERROR: Corrupt index file " + path.string() + "."};
+        }
+        linear_index.set_offsets(ref_id, std::move(windows));
+        linear_index.set_span(ref_id, span);
+        ++*loaded_count;
+    }
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    LazyIndex()                                 = delete;  //!< Deleted.
+    LazyIndex(LazyIndex const &)                = delete;  //!< Deleted.
+    LazyIndex(LazyIndex &&)                     = default; //!< Defaulted.
+    LazyIndex & operator=(LazyIndex const &)    = delete;  //!< Deleted.
+    LazyIndex & operator=(LazyIndex &&)         = default; //!< Defaulted.
+    ~LazyIndex()                                = default; //!< Defaulted.
+
+    /*!
+       \brief Open an index file, reading its offset table but none of its trees.
+       \param path_i The path of the index file, as written by bamit::write_lazy_index.
+    */
+    explicit LazyIndex(std::filesystem::path path_i) : path{std::move(path_i)}
+    {
+        std::ifstream in{path, std::ios_base::binary | std::ios_base::in};
+        if (!in.is_open())
+            throw std::runtime_error{"ERROR: Could not open " + path.string() + "."};
+        std::array<char, 8> magic{};
+        if (!in.read(magic.data(), magic.size()) || magic != lazy_index_magic)
+            throw std::runtime_error{"ERROR: " + path.string() + " is not an index file with an offset table."};
+
+        uint32_t window_size{};
+        try
+        {
+            cereal::BinaryInputArchive archive{in};
+            uint32_t version{};
+            archive(version);
+            if (version != lazy_index_version)
+                throw std::runtime_error{"ERROR: " + path.string() + " was written by an incompatible version. "
+                                         "Please recreate the index."};
+            archive(window_size, offsets);
+        }
+        catch (cereal::Exception const &)
+        {
+            throw std::runtime_error{"ERROR: Corrupt index file " + path.string() + "."};
+        }
+        if (offsets.empty() || !std::ranges::is_sorted(offsets) ||
+            offsets.back() > std::filesystem::file_size(path))
+            throw std::runtime_error{"ERROR: Corrupt index file " + path.string() + "."};
+
+        node_list.resize(offsets.size() - 1);
+        loaded = std::make_unique<std::once_flag[]>(node_list.size());
+        try
+        {
+            linear_index = LinearIndex{window_size, std::vector<std::vector<std::streamoff>>(node_list.size()),
+                                       std::vector<ChromosomeSpan>(node_list.size())};
+        }
+        catch (std::invalid_argument const &)
+        {
+            throw std::runtime_error{"ERROR: Corrupt index file " + path.string() + "."};
+        }
+    }
+    //!\}
+
+    /*!
+       \brief Load the tree of a chromosome if it was not loaded yet.
+       \param ref_id The reference sequence.
+       \return Returns the root of the tree, which is nullptr for chromosomes without records.
+    */
+    std::unique_ptr<IntervalNode> const & load(int32_t const ref_id)
+    {
+        if (ref_id < 0 || static_cast<size_t>(ref_id) >= node_list.size())
+            throw std::out_of_range{"ERROR: The index holds no chromosome " + std::to_string(ref_id) + "."};
+        std::call_once(loaded[ref_id], [this, ref_id] () { read_tree(ref_id); });
+        return node_list[ref_id];
+    }
+
+    /*!
+       \brief Load the trees a query needs.
+       \param start The start Position of the query.
+       \param end The end Position of the query.
+       \return Returns the list of interval trees per chromosome, which can be passed to the queries as node_list for
+               this query. Trees of chromosomes not loaded yet are nullptr, so it must not be used for other queries
+               before loading their trees.
+    */
+    std::vector<std::unique_ptr<IntervalNode>> const & load(Position const & start, Position const & end)
+    {
+        for (int32_t i = std::get<0>(start); i <= std::get<0>(end); ++i)
+            load(i);
+        return node_list;
+    }
+
+    /*!
+       \brief Load all trees.
+       \return Returns the list of interval trees per chromosome, as bamit::read would.
+    */
+    std::vector<std::unique_ptr<IntervalNode>> const & load_all()
+    {
+        for (size_t i = 0; i < node_list.size(); ++i)
+            load(static_cast<int32_t>(i));
+        return node_list;
+    }
+
+    /*!
+       \brief Get the interval trees loaded so far.
+       \return Returns the list of interval trees per chromosome, in which the trees not loaded yet are nullptr. Use
+               bamit::LazyIndex::load before querying it.
+    */
+    std::vector<std::unique_ptr<IntervalNode>> const & get_trees() const
+    {
+        return node_list;
+    }
+
+    //!\brief Returns the number of chromosomes of the index.
+    size_t size() const
+    {
+        return node_list.size();
+    }
+
+    //!\brief Returns the number of trees loaded so far.
+    size_t get_loaded_count() const
+    {
+        return *loaded_count;
+    }
+
+    /*!
+       \brief Get the linear index.
+       \return Returns the bamit::LinearIndex stored with the trees. It only knows the windows and spans of the
+               chromosomes whose trees were loaded, and none if no LinearIndex was stored.
+    */
+    LinearIndex const & get_linear_index() const
+    {
+        return linear_index;
+    }
+};
+} // namespace bamit
@@ -0,0 +1,251 @@
+#pragma once
+#include <cereal/types/vector.hpp>
+
+#include <bamit/Record.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <ios>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bamit
+{
+/*! Where the records of one chromosome lie in a coordinate sorted alignment file, as recorded by bamit::LinearIndex.
+ *  The records of a chromosome are stored one after another, so every record between begin and end belongs to it.
+ */
+struct ChromosomeSpan
+{
+    //!\brief The file position of the first record of the chromosome, or -1 if it has none.
+    std::streamoff begin{-1};
+    //!\brief The file position after the last record of the chromosome, or -1 if it is not known.
+    std::streamoff end{-1};
+    //!\brief The number of mapped records of the chromosome.
+    uint64_t mapped{0};
+    //!\brief The number of records of the chromosome which are flagged as unmapped or have no position.
+    uint64_t unmapped{0};
+
+    template <class Archive>
+    void serialize(Archive & archive)
+    {
+        archive(begin, end, mapped, unmapped);
+    }
+};
+
+/*! The LinearIndex class stores, for every window of a fixed size along each chromosome, the file position of the
+ *  first record which ends in or after the window. This is the first record which can overlap a query starting in the
+ *  window, so a scan for the first overlapping record never has to begin before it.
+ *
+ *  The Interval Tree alone gives the left-most record of every node a query touches. A node holding one very long read
+ *  spans a wide range, and its left-most record may lie far to the left of the query. The LinearIndex bounds the scan
+ *  from such a position to the records between the start of the query's window and the query.
+ *
+ *  It also records the ChromosomeSpan of every chromosome, which lets queries covering whole chromosomes copy their
+ *  records without reading them. The spans are stored by bamit::write_lazy_index and bamit::write_mapped_index, but not
+ *  by the cereal serialization, which keeps the layout of older index files.
+ */
+class LinearIndex
+{
+private:
+    uint32_t window_size{1 << 14};
+    std::vector<std::vector<std::streamoff>> offsets{};
+    std::vector<ChromosomeSpan> spans{};
+    uint32_t open_span{std::numeric_limits<uint32_t>::max()}; // The chromosome whose end is not known yet.
+
+    /*!
+       \brief Note the next record of the file in the spans.
+       \param ref_id The reference sequence of the record, `std::numeric_limits<uint32_t>::max()` for unplaced ones.
+       \param file_position The file position of the record.
+       \return Returns the span of the chromosome of the record, or nullptr for unplaced records.
+    */
+    ChromosomeSpan * enter(uint32_t const ref_id, std::streamoff const file_position)
+    {
+        if (ref_id != open_span)
+        {
+            if (open_span < spans.size()) spans[open_span].end = file_position;
+            open_span = ref_id;
+        }
+        if (ref_id == std::numeric_limits<uint32_t>::max()) return nullptr;
+        if (spans.size() <= ref_id) spans.resize(ref_id + 1);
+        if (spans[ref_id].begin == -1) spans[ref_id].begin = file_position;
+        return &spans[ref_id];
+    }
+
+    //!\brief Reject a window size of 0, which would divide by zero.
+    void check_window_size() const
+    {
+        if (window_size == 0)
+            throw std::invalid_argument{"ERROR: The window size of a LinearIndex must not be 0."};
+    }
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    LinearIndex()                                 = default; //!< Defaulted.
+    LinearIndex(LinearIndex const &)              = default; //!< Defaulted.
+    LinearIndex(LinearIndex &&)                   = default; //!< Defaulted.
+    LinearIndex & operator=(LinearIndex const &)  = default; //!< Defaulted.
+    LinearIndex & operator=(LinearIndex &&)       = default; //!< Defaulted.
+    ~LinearIndex()                                = default; //!< Defaulted.
+
+    /*!
+       \brief Create an empty LinearIndex.
+       \param window_size_i The number of positions covered by one window. Throws std::invalid_argument if it is 0.
+    */
+    explicit LinearIndex(uint32_t const window_size_i) : window_size{window_size_i}
+    {
+        check_window_size();
+    }
+
+    /*!
+       \brief Create a LinearIndex from its offsets, e.g. as stored by a bamit::MappedIndex.
+       \param window_size_i The number of positions covered by one window. Throws std::invalid_argument if it is 0.
+       \param offsets_i The offsets of the windows of every chromosome, see bamit::LinearIndex::get_offsets.
+       \param spans_i The spans of the chromosomes, see bamit::LinearIndex::get_span. Empty by default.
+    */
+    LinearIndex(uint32_t const window_size_i,
+                std::vector<std::vector<std::streamoff>> offsets_i,
+                std::vector<ChromosomeSpan> spans_i = {}) :
+        window_size{window_size_i},
+        offsets{std::move(offsets_i)},
+        spans{std::move(spans_i)}
+    {
+        check_window_size();
+    }
+    //!\}
+
+    /*!
+       \brief Add the next mapped record of a coordinate sorted alignment file.
+       \param ref_id The reference sequence of the record. Must not be smaller than the one of the previous record.
+       \param record The record.
+    */
+    void add(uint32_t const ref_id, Record const & record)
+    {
+        if (offsets.size() <= ref_id) offsets.resize(ref_id + 1);
+        // The windows not set yet are the ones after every record added so far ends. This record is the first to reach
+        // into those up to its end.
+        std::vector<std::streamoff> & windows = offsets[ref_id];
+        if (windows.size() <= record.end / window_size) windows.resize(record.end / window_size + 1, record.file_position);
+        ++enter(ref_id, record.file_position)->mapped;
+    }
+
+    /*!
+       \brief Add the next unmapped record of a coordinate sorted alignment file, which only counts for the spans.
+       \param ref_id The reference sequence of the record, `std::numeric_limits<uint32_t>::max()` for records without
+                     one.
+       \param file_position The file position of the record.
+    */
+    void add_unmapped(uint32_t const ref_id, std::streamoff const file_position)
+    {
+        if (ChromosomeSpan * span = enter(ref_id, file_position)) ++span->unmapped;
+    }
+
+    /*!
+       \brief Close the span of the last chromosome after all records were added.
+       \param end_position The file position after the last record, e.g. as returned by bamit::scan_records.
+       \details Without it, the end of the last chromosome stays unknown unless unplaced records follow it.
+    */
+    void finish(std::streamoff const end_position)
+    {
+        enter(std::numeric_limits<uint32_t>::max(), end_position);
+    }
+
+    /*!
+       \brief Move a file position to the right, onto the first record which can overlap a query.
+       \param start The start Position of the query.
+       \param file_position The file position to move, which must not be past the first record overlapping the query.
+                            It is left as it is if it is -1 or if the LinearIndex knows no records ending in or after
+                            the window of start.
+    */
+    void cap(Position const & start, std::streamoff & file_position) const
+    {
+        if (file_position == -1 || static_cast<size_t>(std::get<0>(start)) >= offsets.size()) return;
+        std::vector<std::streamoff> const & windows = offsets[std::get<0>(start)];
+        size_t const window = static_cast<uint32_t>(std::get<1>(start)) / window_size;
+        if (window < windows.size()) file_position = std::max(file_position, windows[window]);
+    }
+
+    /*!
+       \brief Get the window size.
+       \return Returns the number of positions covered by one window.
+    */
+    uint32_t get_window_size() const
+    {
+        return window_size;
+    }
+
+    /*!
+       \brief Get the offsets of the windows of a chromosome.
+       \param ref_id The reference sequence.
+       \return Returns the file position of the first record ending in or after every window, up to the window in
+               which the last record ends. Empty for chromosomes without records.
+    */
+    std::vector<std::streamoff> const & get_offsets(uint32_t const ref_id) const
+    {
+        static std::vector<std::streamoff> const empty{};
+        return ref_id < offsets.size() ? offsets[ref_id] : empty;
+    }
+
+    /*!
+       \brief Set the offsets of the windows of a chromosome, e.g. when the chromosome is loaded from an index file.
+       \param ref_id The reference sequence. Throws std::out_of_range if the LinearIndex was not created with offsets
+                     for it.
+       \param windows The offsets of the windows of the chromosome, see bamit::LinearIndex::get_offsets.
+       \details The chromosomes are not resized, so the offsets of different chromosomes may be set by several threads
+                at once.
+    */
+    void set_offsets(uint32_t const ref_id, std::vector<std::streamoff> windows)
+    {
+        if (ref_id >= offsets.size())
+            throw std::out_of_range{"ERROR: The linear index holds no chromosome " + std::to_string(ref_id) + "."};
+        offsets[ref_id] = std::move(windows);
+    }
+
+    /*!
+       \brief Get the span of a chromosome.
+       \param ref_id The reference sequence.
+       \return Returns where the records of the chromosome lie and how many of them are unmapped. Its begin is -1 for
+               chromosomes without records, and for all chromosomes if the spans were not recorded.
+    */
+    ChromosomeSpan const & get_span(uint32_t const ref_id) const
+    {
+        static ChromosomeSpan const unknown{};
+        return ref_id < spans.size() ? spans[ref_id] : unknown;
+    }
+
+    /*!
+       \brief Set the span of a chromosome, e.g. when the chromosome is loaded from an index file.
+       \param ref_id The reference sequence. Throws std::out_of_range if the LinearIndex was not created with spans
+                     for it.
+       \param span The span of the chromosome, see bamit::LinearIndex::get_span.
+       \details Like bamit::LinearIndex::set_offsets, this may be called for different chromosomes by several threads
+                at once.
+    */
+    void set_span(uint32_t const ref_id, ChromosomeSpan const & span)
+    {
+        if (ref_id >= spans.size())
+            throw std::out_of_range{"ERROR: The linear index holds no chromosome " + std::to_string(ref_id) + "."};
+        spans[ref_id] = span;
+    }
+
+    /*!
+       \brief Check whether the LinearIndex knows any record.
+       \return Returns true if no records were added, in which case bamit::LinearIndex::cap does nothing.
+    */
+    bool empty() const
+    {
+        return offsets.empty();
+    }
+
+    template <class Archive>
+    void serialize(Archive & archive)
+    {
+        archive(window_size, offsets);
+        if (window_size == 0)
+            throw std::runtime_error{"ERROR: Corrupt linear index with a window size of 0."};
+    }
+};
+} // namespace bamit
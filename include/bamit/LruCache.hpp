@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace bamit
+{
+/*! The LruCache class keeps recently used values by their key within a memory budget. When the memory taken by the
+ *  entries exceeds the budget, the least recently used ones are dropped. It is the base of bamit::BlockCache and
+ *  bamit::QueryCache.
+ *
+ *  The memory of an entry is the memory the cache needs for it, plus the memory given by size_type for the value,
+ *  which should count what the value holds on the heap. All member functions may be called by several threads at once.
+ *
+ *  \tparam key_type The type of the keys.
+ *  \tparam value_type The type of the values, which should be cheap to copy, e.g. by sharing their data.
+ *  \tparam size_type A default constructible callable which returns the number of bytes taken by a value.
+ *  \tparam hash_type The hash of the keys.
+ */
+template <typename key_type, typename value_type, typename size_type, typename hash_type = std::hash<key_type>>
+class LruCache
+{
+private:
+    using list_type = std::list<std::pair<key_type, value_type>>;
+
+    //!\brief The memory taken by an entry besides its value: the list node, the hash map node and its bucket.
+    static constexpr size_t entry_overhead{sizeof(typename list_type::value_type) + 2 * sizeof(void *) +
+                                           sizeof(key_type) + sizeof(typename list_type::iterator) +
+                                           2 * sizeof(void *)};
+
+    mutable std::mutex mutex{};
+    list_type entries{}; // The most recently used entry first.
+    std::unordered_map<key_type, typename list_type::iterator, hash_type> lookup{};
+    size_t memory_budget{0};
+    size_t memory_used{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    LruCache()                              = delete;  //!< Deleted.
+    LruCache(LruCache const &)              = delete;  //!< Deleted.
+    LruCache(LruCache &&)                   = delete;  //!< Deleted.
+    LruCache & operator=(LruCache const &)  = delete;  //!< Deleted.
+    LruCache & operator=(LruCache &&)       = delete;  //!< Deleted.
+    ~LruCache()                             = default; //!< Defaulted.
+
+    /*!
+       \brief Create an empty cache.
+       \param memory_budget_i The number of bytes the entries may take.
+    */
+    explicit LruCache(size_t const memory_budget_i) : memory_budget{memory_budget_i}
+    {}
+    //!\}
+
+    /*!
+       \brief Get the memory taken by an entry.
+       \param value The value of the entry.
+       \return Returns the number of bytes of the entry including its value.
+    */
+    static size_t entry_size(value_type const & value)
+    {
+        return entry_overhead + size_type{}(value);
+    }
+
+    /*!
+       \brief Look up a key and mark its entry as most recently used.
+       \param key The key.
+       \param is_hit Called with the value found to decide whether the lookup counts as a hit, e.g. if the caller
+                     needs more than some values hold.
+       \return Returns the value, or std::nullopt if the key is not cached.
+    */
+    template <typename hit_type>
+    std::optional<value_type> find(key_type const & key, hit_type && is_hit)
+    {
+        std::optional<value_type> result{};
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (auto it = lookup.find(key); it != lookup.end())
+            {
+                entries.splice(entries.begin(), entries, it->second);
+                result = it->second->second;
+            }
+        }
+        if (result && is_hit(*result)) ++hits;
+        else ++misses;
+        return result;
+    }
+
+    /*!
+       \brief Look up a key and mark its entry as most recently used.
+       \param key The key.
+       \return Returns the value, or std::nullopt if the key is not cached. Every value found counts as a hit.
+    */
+    std::optional<value_type> find(key_type const & key)
+    {
+        return find(key, [] (value_type const &) { return true; });
+    }
+
+    /*!
+       \brief Store a value as the most recently used entry, replacing the entry of the same key.
+       \param key The key.
+       \param value The value. It is not stored if its entry alone exceeds the budget.
+       \details Callers which miss the same key at the same time both compute its value, the later one replaces the
+                entry of the earlier one.
+    */
+    void insert(key_type const & key, value_type value)
+    {
+        size_t const size = entry_size(value);
+        if (size > memory_budget) return;
+
+        std::lock_guard<std::mutex> lock{mutex};
+        if (auto it = lookup.find(key); it != lookup.end())
+        {
+            memory_used -= entry_size(it->second->second);
+            it->second->second = std::move(value);
+            entries.splice(entries.begin(), entries, it->second);
+        }
+        else
+        {
+            entries.emplace_front(key, std::move(value));
+            lookup.emplace(key, entries.begin());
+        }
+        memory_used += size;
+
+        while (memory_used > memory_budget && !entries.empty())
+        {
+            memory_used -= entry_size(entries.back().second);
+            lookup.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    /*!
+       \brief Drop all entries, e.g. after the file changed. The counters are kept.
+    */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        entries.clear();
+        lookup.clear();
+        memory_used = 0;
+    }
+
+    //!\brief Returns the number of lookups which found what they needed.
+    uint64_t get_hits() const
+    {
+        return hits;
+    }
+
+    //!\brief Returns the number of lookups which did not find what they needed.
+    uint64_t get_misses() const
+    {
+        return misses;
+    }
+
+    //!\brief Returns the number of entries.
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return entries.size();
+    }
+
+    //!\brief Returns the number of bytes taken by the entries.
+    size_t get_memory_used() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return memory_used;
+    }
+
+    //!\brief Returns the number of bytes the entries may take.
+    size_t get_memory_budget() const
+    {
+        return memory_budget;
+    }
+};
+} // namespace bamit
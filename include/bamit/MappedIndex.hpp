@@ -0,0 +1,369 @@
+#pragma once
+#include <seqan3/core/debug_stream.hpp>
+
+#include <bamit/FlatIntervalTree.hpp>
+#include <bamit/IntervalNode.hpp>
+#include <bamit/LinearIndex.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace bamit
+{
+//!\brief The bytes a memory-mappable index file begins with.
+inline constexpr std::array<char, 8> mapped_index_magic{'B', 'A', 'M', 'I', 'T', 'M', 'A', 'P'};
+
+//!\brief The version of the memory-mappable index format written by bamit::write_mapped_index. Version 2 adds the
+//!       spans of the chromosomes.
+inline constexpr uint32_t mapped_index_version{2};
+
+/*! The layout of a memory-mappable index file. All values are stored in the byte order of the machine which wrote the
+ *  file, which is recorded by byte_order so that other machines reject the file. The header is followed by one
+ *  MappedIndexChromosome per chromosome, and the arrays they point to. Every array begins at a multiple of 8 bytes.
+ */
+struct MappedIndexHeader
+{
+    std::array<char, 8> magic{mapped_index_magic};
+    uint32_t version{mapped_index_version};
+    uint32_t byte_order{0x01020304};
+    uint32_t chromosome_count{0};
+    uint32_t window_size{0};
+};
+
+//!\brief The location of the arrays of one chromosome in a memory-mappable index file.
+struct MappedIndexChromosome
+{
+    //!\brief The number of slots of the breadth-first layout, see bamit::FlatIntervalTree.
+    uint64_t slots{0};
+    //!\brief The offset of the file positions of the slots, followed by their starts and their ends.
+    uint64_t tree_offset{0};
+    //!\brief The number of windows of the bamit::LinearIndex.
+    uint64_t windows{0};
+    //!\brief The offset of the file positions of the windows.
+    uint64_t windows_offset{0};
+    //!\brief The span of the chromosome in the bamit::LinearIndex.
+    ChromosomeSpan span{};
+};
+
+/*! The MappedIntervalTree class gives access to the interval tree of a single chromosome stored in a memory-mapped
+ *  index file. It has the same breadth-first layout and interface as a FlatIntervalTree, but reads the arrays in place.
+ */
+class MappedIntervalTree
+{
+private:
+    std::span<uint32_t const> starts{};
+    std::span<uint32_t const> ends{};
+    std::span<std::streamoff const> file_positions{};
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    MappedIntervalTree()                                        = default; //!< Defaulted.
+    MappedIntervalTree(MappedIntervalTree const &)              = default; //!< Defaulted.
+    MappedIntervalTree(MappedIntervalTree &&)                   = default; //!< Defaulted.
+    MappedIntervalTree & operator=(MappedIntervalTree const &)  = default; //!< Defaulted.
+    MappedIntervalTree & operator=(MappedIntervalTree &&)       = default; //!< Defaulted.
+    ~MappedIntervalTree()                                       = default; //!< Defaulted.
+
+    /*!
+       \brief Refer to the arrays of a tree.
+       \param starts_i The starts of the slots.
+       \param ends_i The ends of the slots.
+       \param file_positions_i The file positions of the slots, FlatIntervalTree::no_node for slots without a node.
+    */
+    MappedIntervalTree(std::span<uint32_t const> starts_i,
+                       std::span<uint32_t const> ends_i,
+                       std::span<std::streamoff const> file_positions_i) :
+        starts{starts_i},
+        ends{ends_i},
+        file_positions{file_positions_i}
+    {}
+    //!\}
+
+    //!\copydoc bamit::FlatIntervalTree::size
+    size_t size() const
+    {
+        return starts.size();
+    }
+
+    //!\copydoc bamit::FlatIntervalTree::has_node
+    bool has_node(size_t const index) const
+    {
+        return index < file_positions.size() && file_positions[index] != FlatIntervalTree::no_node;
+    }
+
+    //!\copydoc bamit::FlatIntervalTree::get_start
+    uint32_t const & get_start(size_t const index) const
+    {
+        return starts[index];
+    }
+
+    //!\copydoc bamit::FlatIntervalTree::get_end
+    uint32_t const & get_end(size_t const index) const
+    {
+        return ends[index];
+    }
+
+    //!\copydoc bamit::FlatIntervalTree::get_file_position
+    std::streamoff const & get_file_position(size_t const index) const
+    {
+        return file_positions[index];
+    }
+
+    //!\copydoc bamit::FlatIntervalTree::print
+    void print() const
+    {
+        for (size_t i = 0; i < size(); ++i)
+        {
+            if (!has_node(i)) continue;
+            seqan3::debug_stream << "Index: " << i << '\n' <<
+                                    "Start, end: " << starts[i] << ", " << ends[i] << '\n' <<
+                                    "File position: " << file_positions[i] << '\n';
+        }
+    }
+};
+
+/*!
+   \brief Write an index in the memory-mappable format read by bamit::MappedIndex.
+   \param path The path of the index file, which is overwritten if it exists.
+   \param node_list The list of interval trees per chromosome, as returned by bamit::index.
+   \param linear_index The bamit::LinearIndex of the alignment file, which may be empty.
+   \details The trees are stored in the breadth-first layout of bamit::FlatIntervalTree, one chromosome at a time.
+*/
+inline void write_mapped_index(std::filesystem::path const & path,
+                               std::vector<std::unique_ptr<IntervalNode>> const & node_list,
+                               LinearIndex const & linear_index)
+{
+    std::ofstream out{path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc};
+    if (!out.is_open())
+        throw std::runtime_error{"ERROR: Could not open " + path.string() + "."};
+
+    MappedIndexHeader header{};
+    header.chromosome_count = node_list.size();
+    header.window_size = linear_index.get_window_size();
+    std::vector<MappedIndexChromosome> chromosomes(node_list.size());
+    uint64_t offset = sizeof(MappedIndexHeader) + chromosomes.size() * sizeof(MappedIndexChromosome);
+
+    // The table is written once the offsets are known.
+    out.seekp(offset);
+    auto write_array = [&out, &offset] (auto const & values)
+    {
+        out.write(reinterpret_cast<char const *>(values.data()), values.size() * sizeof(values[0]));
+        offset += values.size() * sizeof(values[0]);
+        std::array<char, 8> const padding{};
+        out.write(padding.data(), (8 - offset % 8) % 8);
+        offset += (8 - offset % 8) % 8;
+    };
+    std::vector<std::streamoff> file_positions{};
+    std::vector<uint32_t> starts{}, ends{};
+    for (size_t i = 0; i < node_list.size(); ++i)
+    {
+        FlatIntervalTree const tree{node_list[i]};
+        file_positions.resize(tree.size());
+        starts.resize(tree.size());
+        ends.resize(tree.size());
+        for (size_t j = 0; j < tree.size(); ++j)
+        {
+            file_positions[j] = tree.get_file_position(j);
+            starts[j] = tree.get_start(j);
+            ends[j] = tree.get_end(j);
+        }
+        chromosomes[i].slots = tree.size();
+        chromosomes[i].tree_offset = offset;
+        write_array(file_positions);
+        write_array(starts);
+        write_array(ends);
+
+        std::vector<std::streamoff> const & windows = linear_index.get_offsets(i);
+        chromosomes[i].windows = windows.size();
+        chromosomes[i].windows_offset = offset;
+        write_array(windows);
+        chromosomes[i].span = linear_index.get_span(i);
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    out.write(reinterpret_cast<char const *>(chromosomes.data()), chromosomes.size() * sizeof(MappedIndexChromosome));
+    out.close();
+    if (out.fail())
+        throw std::runtime_error{"ERROR: Could not write " + path.string() + "."};
+}
+
+/*!
+   \brief Check whether a file is an index in the memory-mappable format.
+   \param path The path of the index file.
+   \return Returns `true` if the file begins with bamit::mapped_index_magic.
+*/
+inline bool is_mapped_index(std::filesystem::path const & path)
+{
+    std::array<char, 8> magic{};
+    std::ifstream in{path, std::ios_base::binary | std::ios_base::in};
+    return in.read(magic.data(), magic.size()) && magic == mapped_index_magic;
+}
+
+/*! The MappedIndex class maps an index file written by bamit::write_mapped_index into memory and queries it in place.
+ *  Loading it only checks the header, so a query touches just the pages of the nodes it visits, which the operating
+ *  system reads on demand and shares between processes using the same index. The trees are
+ *  bamit::MappedIntervalTrees, which work with every query taking a list of FlatIntervalTrees.
+ */
+class MappedIndex
+{
+private:
+    void * data{nullptr};
+    size_t size{0};
+    std::vector<MappedIntervalTree> trees{};
+    LinearIndex linear_index{};
+
+    /*!
+       \brief Get a typed array of the mapped file.
+       \param offset The offset of the array.
+       \param count The number of values.
+       \param path The path of the file, for error messages.
+       \return Returns a span over the values, which lie in the mapped memory.
+    */
+    template <typename value_type>
+    std::span<value_type const> array(uint64_t const offset, uint64_t const count, std::filesystem::path const & path) const
+    {
+        if (offset % alignof(value_type) != 0 || offset > size || count > (size - offset) / sizeof(value_type))
+            throw std::runtime_error{"ERROR: Corrupt index file " + path.string() + "."};
+        return {reinterpret_cast<value_type const *>(static_cast<char const *>(data) + offset), count};
+    }
+
+    //!\brief Unmap the file.
+    void unmap()
+    {
+        if (data) munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    MappedIndex()                                 = delete;  //!< Deleted.
+    MappedIndex(MappedIndex const &)              = delete;  //!< Deleted.
+    MappedIndex & operator=(MappedIndex const &)  = delete;  //!< Deleted.
+
+    //!\brief Take over the mapping of another MappedIndex.
+    MappedIndex(MappedIndex && other) noexcept :
+        data{std::exchange(other.data, nullptr)},
+        size{std::exchange(other.size, 0)},
+        trees{std::move(other.trees)},
+        linear_index{std::move(other.linear_index)}
+    {}
+
+    //!\brief Take over the mapping of another MappedIndex.
+    MappedIndex & operator=(MappedIndex && other) noexcept
+    {
+        if (this == &other) return *this;
+        unmap();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+        trees = std::move(other.trees);
+        linear_index = std::move(other.linear_index);
+        return *this;
+    }
+
+    //!\brief Unmap the file. Trees obtained from the MappedIndex must not be used afterwards.
+    ~MappedIndex()
+    {
+        unmap();
+    }
+
+    /*!
+       \brief Map an index file into memory.
+       \param path The path of the index file, as written by bamit::write_mapped_index.
+    */
+    explicit MappedIndex(std::filesystem::path const & path)
+    {
+        int const fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw std::runtime_error{"ERROR: Could not open " + path.string() + "."};
+        struct stat status{};
+        if (fstat(fd, &status) == -1 || static_cast<size_t>(status.st_size) < sizeof(MappedIndexHeader))
+        {
+            close(fd);
+            throw std::runtime_error{"ERROR: Corrupt index file " + path.string() + "."};
+        }
+        size = status.st_size;
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            data = nullptr;
+            throw std::runtime_error{"ERROR: Could not map " + path.string() + " into memory."};
+        }
+
+        try
+        {
+            MappedIndexHeader header{};
+            std::memcpy(&header, data, sizeof(header));
+            if (header.magic != mapped_index_magic)
+                throw std::runtime_error{"ERROR: " + path.string() + " is not a memory-mappable index file."};
+            if (header.version != mapped_index_version || header.byte_order != MappedIndexHeader{}.byte_order)
+                throw std::runtime_error{"ERROR: " + path.string() + " was written by an incompatible version or "
+                                         "machine. Please recreate the index."};
+
+            std::span<MappedIndexChromosome const> const chromosomes =
+                array<MappedIndexChromosome>(sizeof(MappedIndexHeader), header.chromosome_count, path);
+            std::vector<std::vector<std::streamoff>> windows{};
+            std::vector<ChromosomeSpan> spans{};
+            trees.reserve(chromosomes.size());
+            for (MappedIndexChromosome const & chromosome : chromosomes)
+            {
+                // The file positions are checked first, so that the offsets of the other arrays cannot overflow.
+                auto const file_positions = array<std::streamoff>(chromosome.tree_offset, chromosome.slots, path);
+                uint64_t const starts_offset = chromosome.tree_offset + chromosome.slots * sizeof(std::streamoff);
+                uint64_t const ends_offset = starts_offset + (chromosome.slots * sizeof(uint32_t) + 7) / 8 * 8;
+                trees.emplace_back(array<uint32_t>(starts_offset, chromosome.slots, path),
+                                   array<uint32_t>(ends_offset, chromosome.slots, path),
+                                   file_positions);
+                std::span<std::streamoff const> const chromosome_windows =
+                    array<std::streamoff>(chromosome.windows_offset, chromosome.windows, path);
+                windows.emplace_back(chromosome_windows.begin(), chromosome_windows.end());
+                spans.push_back(chromosome.span);
+            }
+            // The LinearIndex is small, one value per window of 16 kbp, and is copied.
+            if (header.window_size != 0)
+                linear_index = LinearIndex{header.window_size, std::move(windows), std::move(spans)};
+        }
+        catch (...)
+        {
+            unmap();
+            throw;
+        }
+    }
+    //!\}
+
+    /*!
+       \brief Get the interval trees.
+       \return Returns one bamit::MappedIntervalTree per chromosome, which can be passed to the queries as node_list.
+    */
+    std::vector<MappedIntervalTree> const & get_trees() const
+    {
+        return trees;
+    }
+
+    /*!
+       \brief Get the linear index.
+       \return Returns the bamit::LinearIndex stored with the trees, which is empty if none was stored.
+    */
+    LinearIndex const & get_linear_index() const
+    {
+        return linear_index;
+    }
+};
+} // namespace bamit
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <bamit/BamScanner.hpp>
+#include <bamit/IntervalNode.hpp>
+#include <bamit/LinearIndex.hpp>
+#include <bamit/LruCache.hpp>
+
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace bamit
+{
+/*! The result of a query as stored by a bamit::QueryCache. */
+struct CachedQuery
+{
+    //!\brief The file position of the first record ending at or after the start of the query, as given by
+    //!       bamit::get_overlap_file_position. -1 if there is none.
+    std::streamoff file_position{-1};
+    //!\brief The records overlapping the query as stored in the BAM file, or nullptr if only the file position is known.
+    std::shared_ptr<std::vector<char> const> records{nullptr};
+    //!\brief The number of records in records.
+    size_t record_count{0};
+};
+
+//!\brief Hashes the start and end Position of a query.
+struct QueryHash
+{
+    size_t operator()(std::pair<Position, Position> const & query) const
+    {
+        auto pack = [] (Position const & position)
+        {
+            return static_cast<uint64_t>(static_cast<uint32_t>(std::get<0>(position))) << 32 |
+                   static_cast<uint32_t>(std::get<1>(position));
+        };
+        return std::hash<uint64_t>{}(pack(query.first) * 0x9E3779B97F4A7C15ULL ^ pack(query.second));
+    }
+};
+
+//!\brief Gets the memory taken by the records of a bamit::CachedQuery.
+struct CachedQuerySize
+{
+    size_t operator()(CachedQuery const & query) const
+    {
+        return query.records ? query.records->capacity() : 0;
+    }
+};
+
+/*! The QueryCache keeps the results of recent queries, so that repeated queries neither walk the Interval Tree nor
+ *  read the file again. Entries are the resolved file position of a query and, optionally, its records, looked up by
+ *  the start and end Position of the query, see bamit::LruCache. Records handed out stay valid after their entry was
+ *  dropped.
+ */
+using QueryCache = LruCache<std::pair<Position, Position>, CachedQuery, CachedQuerySize, QueryHash>;
+
+/*!
+   \brief Obtain the file position of the first record which overlaps a query, looking it up in a cache first.
+   \param input The sam file input of type bamit::seqan3::sam_file_input.
+   \param node_list The list of interval trees per chromosome, either as root IntervalNodes or as FlatIntervalTrees.
+   \param start The start Position of the search.
+   \param end The end Position of the search.
+   \param file_position The resulting file position.
+   \param cache The cache, to which the file position is added if it was not found.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read. Empty by default.
+   \details Like bamit::get_overlap_file_position, but a repeated query neither walks the tree nor reads the file.
+ */
+template <typename traits_type, typename fields_type, typename format_type, typename tree_type>
+inline void get_overlap_file_position(seqan3::sam_file_input<traits_type, fields_type, format_type> & input,
+                                      std::vector<tree_type> const & node_list,
+                                      Position const & start,
+                                      Position const & end,
+                                      std::streamoff & file_position,
+                                      QueryCache & cache,
+                                      LinearIndex const & linear_index = LinearIndex{})
+{
+    if (std::optional<CachedQuery> cached = cache.find({start, end}))
+    {
+        file_position = cached->file_position;
+        return;
+    }
+    get_overlap_file_position(input, node_list, start, end, file_position, linear_index);
+    cache.insert({start, end}, CachedQuery{file_position});
+}
+
+/*!
+   \brief Get the records which overlap a query from a BAM file as they are stored in it, looking them up in a cache
+          first.
+   \param scanner The BAM file to query.
+   \param node_list The list of interval trees, either as root IntervalNodes or as FlatIntervalTrees.
+   \param start The start position of the search.
+   \param end The end position of the search.
+   \param cache The cache, to which the result is added if it was not found.
+   \param linear_index The bamit::LinearIndex of the file, which limits how many records are read. Empty by default.
+
+   \return Returns the file position of the first record ending at or after start, and the records
+           bamit::get_overlap_range would find, one after the other as stored in the BAM file.
+   \details If the cache only knows the file position of the query, reading begins there without walking the tree.
+*/
+template <typename tree_type>
+inline CachedQuery get_overlap_record_data(BamScanner & scanner,
+                                           std::vector<tree_type> const & node_list,
+                                           Position const & start,
+                                           Position const & end,
+                                           QueryCache & cache,
+                                           LinearIndex const & linear_index = LinearIndex{})
+{
+    // An entry without records counts as a miss, but its file position saves walking the tree.
+    std::optional<CachedQuery> cached = cache.find({start, end}, [] (CachedQuery const & query)
+    {
+        return query.records != nullptr;
+    });
+    if (cached && cached->records) return *cached;
+
+    std::streamoff file_position{-1};
+    if (cached) file_position = cached->file_position;
+    else get_tree_file_position(node_list, start, end, file_position, linear_index);
+
+    CachedQuery result{};
+    auto records = std::make_shared<std::vector<char>>();
+    if (file_position != -1)
+    {
+        scanner.seek(file_position);
+        for (size_t size = records->size(); scanner.next(*records); size = records->size())
+        {
+            int32_t const ref_id = scanner.get_reference_id();
+            int32_t const position = scanner.get_reference_position();
+            if (ref_id == -1)
+            {
+                records->resize(size);
+                break;
+            }
+            bool const ends_after_start = !scanner.unmapped() &&
+                                          Position{ref_id, position + scanner.get_length()} >= start;
+            if (ends_after_start && result.file_position == -1) result.file_position = scanner.get_file_position();
+            if (Position{ref_id, position} >= end || !ends_after_start)
+            {
+                records->resize(size);
+                if (Position{ref_id, position} >= end) break;
+                continue;
+            }
+            ++result.record_count;
+        }
+    }
+    records->shrink_to_fit();
+    result.records = std::move(records);
+    // If the records alone exceed the budget, only the file position is stored.
+    if (QueryCache::entry_size(result) > cache.get_memory_budget())
+        cache.insert({start, end}, CachedQuery{result.file_position});
+    else
+        cache.insert({start, end}, result);
+    return result;
+}
+} // namespace bamit
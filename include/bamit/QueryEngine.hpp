@@ -0,0 +1,155 @@
+#pragma once
+
+#include <seqan3/io/sam_file/input.hpp>
+
+#include <bamit/IntervalNode.hpp>
+#include <bamit/ThreadPool.hpp>
+
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace bamit
+{
+/*! The QueryEngine class answers many overlap queries on one alignment file in parallel. All workers share the same
+ *  read-only index, but every worker reads through its own handle to the file, as a seqan3::sam_file_input keeps the
+ *  state of its stream. The queries are handed out to the workers one at a time, and results are returned in the order
+ *  of the queries.
+ *
+ *  The handles are seqan3::sam_file_input by default. Each is opened with seqan3::contrib::bgzf_thread_count set to 1,
+ *  as the workers already read in parallel and a decompression pool per handle would oversubscribe the cores; the
+ *  previous value is restored afterwards. Any type constructible from the path can be used instead, e.g.
+ *  bamit::BamScanner for queries which do not need decoded records. BamScanner handles can share a bamit::BlockCache,
+ *  so that the blocks of nearby queries are decompressed once.
+ */
+template <typename tree_type, typename input_type = seqan3::sam_file_input<>>
+class QueryEngine
+{
+private:
+    std::vector<tree_type> const & index;
+    std::vector<std::unique_ptr<input_type>> inputs{};
+    ThreadPool pool;
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    QueryEngine()                                 = delete;  //!< Deleted.
+    QueryEngine(QueryEngine const &)              = delete;  //!< Deleted.
+    QueryEngine(QueryEngine &&)                   = delete;  //!< Deleted.
+    QueryEngine & operator=(QueryEngine const &)  = delete;  //!< Deleted.
+    QueryEngine & operator=(QueryEngine &&)       = delete;  //!< Deleted.
+    ~QueryEngine()                                = default; //!< Defaulted.
+
+    /*!
+       \brief Open a handle to the alignment file for every worker.
+       \param path The alignment file the index was built over.
+       \param index_i The list of interval trees per chromosome, which must outlive the QueryEngine.
+       \param threads The number of workers. 0 is treated as 1.
+       \param args Further arguments passed to the constructor of every handle, e.g. a bamit::BlockCache * shared by
+                   bamit::BamScanner handles.
+    */
+    template <typename ...arg_types>
+    QueryEngine(std::filesystem::path const & path, std::vector<tree_type> const & index_i, size_t const threads,
+                arg_types const & ...args) :
+        index{index_i},
+        pool{std::max<size_t>(threads, 1)}
+    {
+        auto const thread_count = seqan3::contrib::bgzf_thread_count;
+        seqan3::contrib::bgzf_thread_count = 1;
+        try
+        {
+            for (size_t i = 0; i < pool.size(); ++i)
+                inputs.push_back(std::make_unique<input_type>(path, args...));
+        }
+        catch (...)
+        {
+            seqan3::contrib::bgzf_thread_count = thread_count;
+            throw;
+        }
+        seqan3::contrib::bgzf_thread_count = thread_count;
+    }
+    //!\}
+
+    /*!
+       \brief Run a function on every query in parallel.
+       \param regions The start and end Positions of the queries.
+       \param function Called as `function(input, index, start, end)` with the worker's handle, the index, and the
+                       start and end of one query.
+       \return Returns a std::vector holding the result of the function for every query, in the order of regions.
+       \details A worker stops at the first exception thrown by the function, which is rethrown once all workers have
+                stopped.
+    */
+    template <typename function_type>
+    auto query(std::vector<std::pair<Position, Position>> const & regions, function_type && function)
+    {
+        using result_type = std::invoke_result_t<function_type &, input_type &, std::vector<tree_type> const &,
+                                                 Position const &, Position const &>;
+        static_assert(!std::is_same_v<result_type, bool>, "std::vector<bool> cannot be written by several threads.");
+
+        std::vector<result_type> results(regions.size());
+        std::atomic<size_t> next{0};
+        std::vector<std::future<void>> workers{};
+        for (auto & input : inputs)
+        {
+            workers.push_back(pool.submit([&regions, &function, &results, &next, &input, this] ()
+            {
+                for (size_t i = next++; i < regions.size(); i = next++)
+                    results[i] = function(*input, index, regions[i].first, regions[i].second);
+            }));
+        }
+
+        // Wait for all workers before rethrowing, as they refer to the local variables.
+        std::exception_ptr error{};
+        for (auto & worker : workers)
+        {
+            try
+            {
+                pool.wait(worker);
+            }
+            catch (...)
+            {
+                if (!error) error = std::current_exception();
+            }
+        }
+        if (error) std::rethrow_exception(error);
+        return results;
+    }
+
+    /*!
+       \brief Find the records which overlap every query in parallel.
+       \param regions The start and end Positions of the queries.
+       \return Returns a std::vector holding the records overlapping each query, as returned by
+               bamit::get_overlap_records, in the order of regions.
+    */
+    auto get_overlap_records(std::vector<std::pair<Position, Position>> const & regions)
+    {
+        return query(regions, [] (input_type & input, std::vector<tree_type> const & node_list,
+                                  Position const & start, Position const & end)
+        {
+            return bamit::get_overlap_records(input, node_list, start, end);
+        });
+    }
+
+    /*!
+       \brief Get the header of the alignment file.
+       \return Returns the header read by the handle of the first worker.
+    */
+    auto & header()
+    {
+        return inputs.front()->header();
+    }
+
+    /*!
+       \brief Get the number of workers.
+       \return Returns the number of workers, each with its own handle to the alignment file.
+    */
+    size_t size() const
+    {
+        return inputs.size();
+    }
+};
+} // namespace bamit
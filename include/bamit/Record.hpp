@@ -4,6 +4,10 @@
 #include <seqan3/io/sam_file/output.hpp>
 #include <cereal/types/tuple.hpp>
 
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
 namespace bamit
 {
 
@@ -16,6 +20,19 @@ inline bool unmapped(auto const & rec)
            (static_cast<bool>(rec.flag() & seqan3::sam_flag::unmapped));
 }
 
+/*!
+   \brief Check whether the end of a record is needed to decide if it overlaps a query.
+   \param ref_id The reference sequence of the record.
+   \param start The start Position of the query.
+   \return Returns `false` if the query covers the chromosome of the record from its beginning, so that the record
+           overlaps the query if it starts before the end of the query. Computing the end from the cigar can then be
+           skipped, e.g. for all chromosomes but the first of a query spanning several chromosomes.
+*/
+inline bool overlap_needs_end(int32_t const ref_id, Position const & start)
+{
+    return ref_id < std::get<0>(start) || (ref_id == std::get<0>(start) && std::get<1>(start) > 0);
+}
+
 /*! A Record object contains pertinent information about an alignment. */
 struct Record
 {
@@ -48,6 +65,232 @@ struct Record
     }
 };
 
+class LongRecordEnds;
+
+/*! A CompactRecord object stores a record during tree construction in 10 instead of 16 bytes. Its end is stored as
+ *  length relative to its start, which fits 16 bits for all but very long alignments. Longer records store
+ *  bamit::CompactRecord::long_length instead and their end is kept in the bamit::LongRecordEnds of their chromosome,
+ *  so a few very long reads do not change the size of the other records. Instead of its file position, it stores the
+ *  number of records which precede it in the file on the same chromosome. As the records of a chromosome are read in
+ *  file order, this number compares like the file position, and the file position can be looked up in the
+ *  FilePositionTable the records were added to. The fields are packed to 2 byte alignment, so that an array has no
+ *  padding. Use bamit::RecordEnd to get the end of a record.
+ */
+#pragma pack(push, 2)
+struct CompactRecord
+{
+    //!\brief The length stored by records whose end is kept in a bamit::LongRecordEnds.
+    static constexpr uint16_t long_length{std::numeric_limits<uint16_t>::max()};
+
+    uint32_t start{};
+    //!\brief The index of the record in its FilePositionTable, used in place of a file position.
+    uint32_t file_position{};
+    //!\brief The end of the record relative to its start, or bamit::CompactRecord::long_length.
+    uint16_t length{};
+
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    constexpr CompactRecord()                               = default; //!< Defaulted.
+    CompactRecord(CompactRecord const &)                    = default; //!< Defaulted.
+    CompactRecord(CompactRecord &&)                         = default; //!< Defaulted.
+    CompactRecord & operator=(CompactRecord const &)        = default; //!< Defaulted.
+    CompactRecord & operator=(CompactRecord &&)             = default; //!< Defaulted.
+    ~CompactRecord()                                        = default; //!< Defaulted.
+     //!\}
+
+    /*!
+       \brief Store a record whose length fits 16 bits, see bamit::CompactRecord::fits.
+       \param start_i The start of the record.
+       \param end_i The end of the record. Throws std::runtime_error if the record does not fit.
+       \param file_position_i The index of the record in its FilePositionTable.
+    */
+    CompactRecord(uint32_t const start_i, uint32_t const end_i, uint32_t const file_position_i) :
+        start{start_i},
+        file_position{file_position_i},
+        length{static_cast<uint16_t>(end_i - start_i)}
+    {
+        if (!fits(start_i, end_i))
+            throw std::runtime_error{"ERROR: Record too long for a CompactRecord."};
+    }
+
+    /*!
+       \brief Store any record, keeping the end of a record which does not fit in a table.
+       \param start_i The start of the record.
+       \param end_i The end of the record, which must not be smaller than the start.
+       \param file_position_i The index of the record in its FilePositionTable. Must be larger than the one of every
+                              record added to long_ends before.
+       \param long_ends The ends of the long records of the chromosome, to which the end is added if it does not fit.
+    */
+    inline CompactRecord(uint32_t const start_i, uint32_t const end_i, uint32_t const file_position_i,
+                         LongRecordEnds & long_ends);
+
+    /*!
+       \brief Check whether the end of a record can be stored in a CompactRecord itself.
+       \param start_i The start of the record.
+       \param end_i The end of the record.
+       \return Returns `true` if the length of the record is smaller than bamit::CompactRecord::long_length.
+    */
+    static constexpr bool fits(uint32_t const start_i, uint32_t const end_i)
+    {
+        return end_i >= start_i && end_i - start_i < long_length;
+    }
+};
+#pragma pack(pop)
+
+/*! The LongRecordEnds class keeps the ends of the bamit::CompactRecords of one chromosome which are too long to store
+ *  their length in 16 bits, by the index of the records in their FilePositionTable. Such records are rare, even in
+ *  long read data, so they are looked up by binary search.
+ */
+class LongRecordEnds
+{
+private:
+    std::vector<std::pair<uint32_t, uint32_t>> ends{};
+
+public:
+    /*!
+       \brief Add the end of a record.
+       \param index The index of the record, which must be larger than the one of the previous record.
+       \param end The end of the record.
+    */
+    void push_back(uint32_t const index, uint32_t const end)
+    {
+        ends.emplace_back(index, end);
+    }
+
+    /*!
+       \brief Look up the end of a record.
+       \param index The index of the record, which must have been added.
+       \return Returns the end of the record.
+    */
+    uint32_t operator[](uint32_t const index) const
+    {
+        return std::ranges::lower_bound(ends, index, {}, &std::pair<uint32_t, uint32_t>::first)->second;
+    }
+
+    /*!
+       \brief Get the number of records.
+       \return Returns the number of records whose end is kept.
+    */
+    size_t size() const
+    {
+        return ends.size();
+    }
+
+    /*!
+       \brief Remove all records.
+    */
+    void clear()
+    {
+        ends.clear();
+    }
+};
+
+CompactRecord::CompactRecord(uint32_t const start_i, uint32_t const end_i, uint32_t const file_position_i,
+                             LongRecordEnds & long_ends) :
+    start{start_i},
+    file_position{file_position_i},
+    length{fits(start_i, end_i) ? static_cast<uint16_t>(end_i - start_i) : long_length}
+{
+    if (length == long_length) long_ends.push_back(file_position_i, end_i);
+}
+
+/*! Gets the end of a bamit::Record or bamit::CompactRecord. The ends of CompactRecords storing
+ *  bamit::CompactRecord::long_length are looked up in the bamit::LongRecordEnds of their chromosome.
+ */
+struct RecordEnd
+{
+    //!\brief The ends of the long CompactRecords. May be nullptr if there are none.
+    LongRecordEnds const * long_ends{nullptr};
+
+    //!\brief Returns the end of a record.
+    uint32_t operator()(Record const & record) const
+    {
+        return record.end;
+    }
+
+    //!\overload
+    uint32_t operator()(CompactRecord const & record) const
+    {
+        if (record.length != CompactRecord::long_length) return record.start + record.length;
+        return (*long_ends)[record.file_position];
+    }
+};
+
+/*! The FilePositionTable class stores the file positions of the records of one chromosome in the order of the file,
+ *  using two bytes per record. The file position of a record is a BGZF virtual offset: the offset of a compressed block
+ *  shifted left by 16 bits, combined with the offset within the decompressed block. The block offset is stored once
+ *  per block and the offset within the block once per record.
+ */
+class FilePositionTable
+{
+private:
+    std::vector<uint16_t> offsets{};
+    std::vector<std::pair<uint32_t, uint64_t>> blocks{};
+
+public:
+    /*!
+       \brief Append the file position of the next record.
+       \param file_position The file position, which must not be smaller than the previous one.
+       \return Returns the index of the record in the table.
+    */
+    uint32_t push_back(std::streamoff const file_position)
+    {
+        if (offsets.size() == std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error{"ERROR: Too many records on one chromosome."};
+        uint32_t const index = offsets.size();
+        uint64_t const block = static_cast<uint64_t>(file_position) >> 16;
+        if (blocks.empty() || blocks.back().second != block) blocks.emplace_back(index, block);
+        offsets.push_back(static_cast<uint16_t>(file_position & 0xFFFF));
+        return index;
+    }
+
+    /*!
+       \brief Look up the file position of a record.
+       \param index The index of the record, as returned by bamit::FilePositionTable::push_back.
+       \return Returns the file position of the record.
+    */
+    std::streamoff operator[](uint32_t const index) const
+    {
+        auto block = std::ranges::upper_bound(blocks, index, {}, &std::pair<uint32_t, uint64_t>::first);
+        return static_cast<std::streamoff>((std::prev(block)->second << 16) | offsets[index]);
+    }
+
+    /*!
+       \brief Call a function on the file position of every record in the order of the table, without searching the
+              block of each record like bamit::FilePositionTable::operator[].
+       \param function The callable, called with the index and the file position of each record.
+    */
+    template <typename function_type>
+    void for_each(function_type && function) const
+    {
+        for (size_t b = 0; b < blocks.size(); ++b)
+        {
+            uint32_t const last = b + 1 < blocks.size() ? blocks[b + 1].first : offsets.size();
+            for (uint32_t index = blocks[b].first; index < last; ++index)
+                function(index, static_cast<std::streamoff>((blocks[b].second << 16) | offsets[index]));
+        }
+    }
+
+    /*!
+       \brief Get the number of records.
+       \return Returns the number of records in the table.
+    */
+    size_t size() const
+    {
+        return offsets.size();
+    }
+
+    /*!
+       \brief Remove all records.
+    */
+    void clear()
+    {
+        offsets.clear();
+        blocks.clear();
+    }
+};
+
 /*! Used to sort two Record objects in ascending order by start position. */
 struct RecordComparatorStart
 {
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <bamit/Record.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <span>
+#include <vector>
+
+namespace bamit
+{
+/*! The RecordFile class stores a list of records in a temporary binary file, so that it does not have to be held in
+ *  memory. Records are first appended and can then be read back in order as often as needed. The file is removed when
+ *  the RecordFile is destroyed or cleared.
+ */
+class RecordFile
+{
+private:
+    std::filesystem::path directory{};
+    std::filesystem::path path{};
+    std::fstream stream{};
+    uint64_t count{0};
+
+    //!\brief The number of records read from the file at once.
+    static constexpr size_t chunk_size{1 << 16};
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    RecordFile(RecordFile const &)              = delete;  //!< Deleted.
+    RecordFile(RecordFile &&)                   = delete;  //!< Deleted.
+    RecordFile & operator=(RecordFile const &)  = delete;  //!< Deleted.
+    RecordFile & operator=(RecordFile &&)       = delete;  //!< Deleted.
+
+    /*!
+       \brief Create an empty temporary file.
+       \param directory_i The directory to create the file in. Defaults to the temporary directory of the system,
+                          which can be set with the TMPDIR environment variable.
+    */
+    explicit RecordFile(std::filesystem::path directory_i = std::filesystem::temp_directory_path()) :
+        directory{std::move(directory_i)}
+    {
+        std::random_device rd;
+        do
+        {
+            path = directory / ("bamit_records_" + std::to_string(rd()) + std::to_string(rd()) + ".tmp");
+        } while (std::filesystem::exists(path));
+        stream.open(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out | std::ios_base::trunc);
+        if (!stream.is_open())
+            throw std::runtime_error{"ERROR: Could not create temporary file " + path.string()};
+    }
+
+    //!\brief Remove the temporary file.
+    ~RecordFile()
+    {
+        clear();
+    }
+    //!\}
+
+    /*!
+       \brief Append records to the end of the file.
+       \param records The records to append.
+    */
+    void append(std::span<Record const> records)
+    {
+        stream.seekp(0, std::ios_base::end);
+        stream.write(reinterpret_cast<char const *>(records.data()), records.size_bytes());
+        if (!stream)
+            throw std::runtime_error{"ERROR: Could not write to temporary file " + path.string()};
+        count += records.size();
+    }
+
+    /*!
+       \brief Call a function on every record in the order they were appended.
+       \param function The callable to call with each bamit::Record.
+    */
+    template <typename function_type>
+    void for_each(function_type && function)
+    {
+        std::vector<Record> chunk(std::min<uint64_t>(count, chunk_size));
+        stream.flush();
+        stream.seekg(0);
+        for (uint64_t remaining = count; remaining > 0; remaining -= chunk.size())
+        {
+            chunk.resize(std::min<uint64_t>(remaining, chunk_size));
+            stream.read(reinterpret_cast<char *>(chunk.data()), chunk.size() * sizeof(Record));
+            if (!stream)
+                throw std::runtime_error{"ERROR: Could not read from temporary file " + path.string()};
+            for (auto const & r : chunk)
+                function(r);
+        }
+    }
+
+    /*!
+       \brief Read all records into memory.
+       \return Returns the records in the order they were appended.
+    */
+    std::vector<Record> load()
+    {
+        std::vector<Record> records{};
+        records.reserve(count);
+        for_each([&records] (Record const & r) { records.push_back(r); });
+        return records;
+    }
+
+    /*!
+       \brief Remove all records and the temporary file. No records can be appended afterwards.
+    */
+    void clear()
+    {
+        if (stream.is_open()) stream.close();
+        std::error_code ec{};
+        std::filesystem::remove(path, ec);
+        count = 0;
+    }
+
+    /*!
+       \brief Get the number of records.
+       \return Returns the number of records in the file.
+    */
+    uint64_t size() const
+    {
+        return count;
+    }
+
+    /*!
+       \brief Get the directory of the temporary file.
+       \return Returns the directory, which is also used for the files of subsets of the records.
+    */
+    std::filesystem::path const & get_directory() const
+    {
+        return directory;
+    }
+};
+} // namespace bamit
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bamit
+{
+/*! The ThreadPool class runs submitted tasks on a fixed number of worker threads. Workers take tasks from the front
+ *  of a shared queue. A thread which waits for a task through ThreadPool::wait runs queued tasks itself, taking the
+ *  most recently submitted ones first, until the task it waits for is done. Tasks may therefore submit and wait for
+ *  further tasks (fork-join) without blocking all workers.
+ */
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers{};
+    std::deque<std::packaged_task<void()>> tasks{};
+    std::mutex mutex{};
+    std::condition_variable condition{};
+    bool stopping{false};
+
+    /*!
+       \brief The loop run by every worker thread. Returns once the pool is stopping and no tasks are left.
+    */
+    void work()
+    {
+        while (true)
+        {
+            std::packaged_task<void()> task{};
+            {
+                std::unique_lock lock{mutex};
+                condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    /*!\name Constructors, destructor and assignment
+     * \{
+     */
+    ThreadPool()                                = delete;  //!< Deleted.
+    ThreadPool(ThreadPool const &)              = delete;  //!< Deleted.
+    ThreadPool(ThreadPool &&)                   = delete;  //!< Deleted.
+    ThreadPool & operator=(ThreadPool const &)  = delete;  //!< Deleted.
+    ThreadPool & operator=(ThreadPool &&)       = delete;  //!< Deleted.
+
+    /*!
+       \brief Start the worker threads.
+       \param thread_count The number of worker threads.
+    */
+    explicit ThreadPool(size_t const thread_count)
+    {
+        workers.reserve(thread_count);
+        for (size_t i = 0; i < thread_count; ++i)
+            workers.emplace_back(&ThreadPool::work, this);
+    }
+
+    //!\brief Finish all queued tasks and join the worker threads.
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto & worker : workers)
+            worker.join();
+    }
+    //!\}
+
+    /*!
+       \brief Queue a task.
+       \param function The callable to run, taking no arguments.
+       \return Returns a std::future which becomes ready once the task is done and rethrows its exception, if any.
+    */
+    template <typename function_type>
+    std::future<void> submit(function_type && function)
+    {
+        std::packaged_task<void()> task{std::forward<function_type>(function)};
+        std::future<void> result = task.get_future();
+        {
+            std::lock_guard lock{mutex};
+            tasks.push_back(std::move(task));
+        }
+        condition.notify_one();
+        return result;
+    }
+
+    /*!
+       \brief Run the most recently queued task on the calling thread.
+       \return Returns `false` if there was no queued task.
+    */
+    bool run_pending_task()
+    {
+        std::packaged_task<void()> task{};
+        {
+            std::lock_guard lock{mutex};
+            if (tasks.empty()) return false;
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        }
+        task();
+        return true;
+    }
+
+    /*!
+       \brief Wait for a task, running queued tasks on the calling thread in the meantime.
+       \param result The std::future returned by ThreadPool::submit.
+       \details Rethrows the exception of the task, if any. Once there is nothing left to help with, the calling thread
+                blocks, as the task it waits for is then being run by another thread.
+    */
+    void wait(std::future<void> & result)
+    {
+        while (result.wait_for(std::chrono::seconds{0}) != std::future_status::ready)
+        {
+            if (!run_pending_task()) result.wait();
+        }
+        result.get();
+    }
+
+    /*!
+       \brief Get the number of worker threads.
+       \return Returns the number of worker threads.
+    */
+    size_t size() const
+    {
+        return workers.size();
+    }
+};
+} // namespace bamit
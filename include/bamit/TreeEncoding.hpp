@@ -0,0 +1,162 @@
+#pragma once
+
+#include <bamit/IntervalNode.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace bamit
+{
+namespace detail
+{
+//!\brief The number of levels of a tree up to which bamit::encode_tree and bamit::decode_tree work, to keep corrupt
+//!       input off the stack. Trees built by bamit::construct_tree have at most 33 levels.
+inline constexpr size_t max_tree_depth{1024};
+
+//!\brief Append a value as LEB128 varint.
+inline void write_varint(std::string & out, uint64_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.push_back(static_cast<char>(value | 0x80));
+    out.push_back(static_cast<char>(value));
+}
+
+//!\brief Append a difference as zigzag encoded varint.
+inline void write_difference(std::string & out, int64_t const value)
+{
+    write_varint(out, static_cast<uint64_t>(value) << 1 ^ static_cast<uint64_t>(value >> 63));
+}
+
+//!\brief The state of bamit::encode_tree: the start and file position of the node written last.
+struct TreeEncoder
+{
+    std::string & out;
+    int64_t start{0};
+    int64_t file_position{0};
+
+    void encode(IntervalNode const & node, size_t const depth = 0)
+    {
+        if (depth == max_tree_depth)
+            throw std::runtime_error{"ERROR: The interval tree is too deep to be encoded."};
+        write_varint(out, static_cast<uint64_t>(node.get_count()) << 2 |
+                          static_cast<uint64_t>(node.get_right_node() != nullptr) << 1 |
+                          static_cast<uint64_t>(node.get_left_node() != nullptr));
+        if (node.get_left_node()) encode(*node.get_left_node(), depth + 1);
+
+        write_difference(out, static_cast<int64_t>(node.get_start()) - start);
+        write_difference(out, static_cast<int64_t>(node.get_median()) - node.get_start());
+        write_difference(out, static_cast<int64_t>(node.get_end()) - node.get_median());
+        write_difference(out, node.get_file_position() - file_position);
+        write_difference(out, node.get_last_file_position() - node.get_file_position());
+        start = node.get_start();
+        file_position = node.get_file_position();
+
+        if (node.get_right_node()) encode(*node.get_right_node(), depth + 1);
+    }
+};
+
+//!\brief The state of bamit::decode_tree: the rest of the input and the start and file position of the node read last.
+struct TreeDecoder
+{
+    char const * it;
+    char const * const stop;
+    int64_t start{0};
+    int64_t file_position{0};
+
+    [[noreturn]] static void corrupt()
+    {
+        throw std::runtime_error{"ERROR: Corrupt encoded interval tree."};
+    }
+
+    uint64_t read_varint()
+    {
+        uint64_t value{0};
+        for (size_t shift = 0; shift < 64; shift += 7)
+        {
+            if (it == stop) corrupt();
+            uint8_t const byte = static_cast<uint8_t>(*it++);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (byte < 0x80) return value;
+        }
+        corrupt();
+    }
+
+    int64_t read_difference()
+    {
+        uint64_t const value = read_varint();
+        return static_cast<int64_t>(value >> 1 ^ -(value & 1));
+    }
+
+    //!\brief Decode a value which must fit into a uint32_t.
+    static uint32_t narrow(int64_t const value)
+    {
+        if (value < 0 || value > std::numeric_limits<uint32_t>::max()) corrupt();
+        return static_cast<uint32_t>(value);
+    }
+
+    std::unique_ptr<IntervalNode> decode(size_t const depth)
+    {
+        if (depth == max_tree_depth) corrupt();
+        auto node = std::make_unique<IntervalNode>();
+        uint64_t const header = read_varint();
+        if (header >> 2 > std::numeric_limits<uint32_t>::max()) corrupt();
+        node->set_count(header >> 2);
+        if (header & 1) node->get_left_node() = decode(depth + 1);
+
+        start += read_difference();
+        node->set_start(narrow(start));
+        int64_t const median = start + read_difference();
+        node->set_median(narrow(median));
+        node->set_end(narrow(median + read_difference()));
+        file_position += read_difference();
+        node->set_file_position(file_position);
+        node->set_last_file_position(file_position + read_difference());
+
+        if (header & 2) node->get_right_node() = decode(depth + 1);
+        count_subtree(*node);
+        return node;
+    }
+};
+} // namespace detail
+
+/*!
+   \brief Encode an interval tree compactly.
+   \param node The root of the tree, as returned by bamit::index.
+   \param out The string to append the encoding to. Nothing is appended for an empty tree.
+   \details The nodes are stored in order of their medians, so that consecutive nodes have close starts and file
+            positions. Every node is written as
+
+            1. a header, `count << 2 | has_right << 1 | has_left`, before its left subtree,
+            2. after its left subtree, its start relative to the start of the node written before, its median relative
+               to its start, its end relative to its median, its file position relative to the file position of the
+               node written before and its last file position relative to its file position,
+            3. followed by its right subtree.
+
+            All numbers are LEB128 varints, differences are zigzag encoded. The shape of the tree is implied by the
+            headers and the subtree counts are recomputed, so a node usually takes around ten bytes instead of the
+            fixed-width fields and pointer flags of its cereal serialization. Trees of bamit::detail::max_tree_depth
+            levels or more, which bamit::decode_tree would reject, throw a std::runtime_error.
+*/
+inline void encode_tree(std::unique_ptr<IntervalNode> const & node, std::string & out)
+{
+    if (node) detail::TreeEncoder{out}.encode(*node);
+}
+
+/*!
+   \brief Decode an interval tree encoded by bamit::encode_tree.
+   \param data The encoding of exactly one tree.
+   \return Returns the root of the tree, which is nullptr if data is empty.
+*/
+inline std::unique_ptr<IntervalNode> decode_tree(std::string_view const data)
+{
+    if (data.empty()) return nullptr;
+    detail::TreeDecoder decoder{data.data(), data.data() + data.size()};
+    std::unique_ptr<IntervalNode> node = decoder.decode(0);
+    if (decoder.it != decoder.stop) decoder.corrupt();
+    return node;
+}
+} // namespace bamit
@@ -2,5 +2,15 @@
 /*!\file
  * \brief Meta-include for the BAM Interval Tree.
  */
+#include <bamit/BinningIndex.hpp>
+#include <bamit/BlockCache.hpp>
+#include <bamit/FlatIntervalTree.hpp>
 #include <bamit/IntervalNode.hpp>
+#include <bamit/LazyIndex.hpp>
+#include <bamit/LinearIndex.hpp>
+#include <bamit/LruCache.hpp>
+#include <bamit/MappedIndex.hpp>
+#include <bamit/QueryCache.hpp>
+#include <bamit/QueryEngine.hpp>
 #include <bamit/Record.hpp>
+#include <bamit/TreeEncoding.hpp>
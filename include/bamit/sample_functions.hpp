@@ -7,6 +7,7 @@
 
 #include <bamit/Record.hpp>
 #include <bamit/IntervalNode.hpp>
+#include <bamit/QueryEngine.hpp>
 
 #include <seqan3/io/sam_file/input.hpp>
 #include <seqan3/core/debug_stream.hpp>
@@ -30,10 +31,81 @@ struct EstimationResult
     }
 };
 
+/*!
+   \brief Draw random positions uniformly from the chromosomes of an alignment file.
+   \param ref_lengths The lengths of the chromosomes.
+   \param sample_value The number of positions to draw.
+   \param seed The seed to use for the random generator.
+   \return Returns the positions in the order they were drawn.
+ */
+inline std::vector<Position> sample_positions(std::vector<uint32_t> const & ref_lengths,
+                                              uint64_t const & sample_value,
+                                              uint64_t const & seed)
+{
+    std::vector<Position> positions{};
+    positions.reserve(sample_value);
+    std::mt19937 gen(seed); // seed the generator
+    std::uniform_int_distribution<> distr_chr(0, ref_lengths.size() - 1); // define the range
+    for (uint64_t i = 0; i < sample_value; ++i)
+    {
+        // Obtain a random chromosome, then obtain a random position constrained by the chromosome size.
+        int32_t rand_chr = distr_chr(gen);
+        std::uniform_int_distribution<> distr_pos(0, ref_lengths[rand_chr] - 1);
+        positions.emplace_back(rand_chr, distr_pos(gen));
+    }
+    return positions;
+}
+
+/*!
+   \brief Get the lengths of the chromosomes from the header of an alignment file.
+   \param header The header of the alignment file.
+   \return Returns the length of every chromosome.
+ */
+template <typename header_type>
+inline std::vector<uint32_t> get_ref_lengths(header_type & header)
+{
+    std::vector<uint32_t> ref_lengths{};
+    for (auto const & info : header.ref_id_info)
+        ref_lengths.push_back(std::get<0>(info));
+    return ref_lengths;
+}
+
+/*!
+   \brief Calculate the statistics over sampled read depths.
+   \param read_depths The read depth at each sampled position.
+   \return Returns a struct containing statistics over the sampled points.
+ */
+inline EstimationResult estimate_read_depth(std::vector<uint64_t> read_depths)
+{
+    uint64_t const sample_value = read_depths.size();
+    std::map<double, uint64_t> depth_counts{}; // Counts how often each depth occurs.
+    std::sort(read_depths.begin(), read_depths.end());
+    std::for_each(read_depths.begin(), read_depths.end(),
+                  [&depth_counts](uint64_t const & value) {++(depth_counts[value]);});
+
+    EstimationResult result;
+    result.mean = std::accumulate(read_depths.begin(), read_depths.end(), 0) / (double) sample_value;
+    // If sample_value is even, median is average of two middle numbers. Otherwise, it is just the one number.
+    result.median = sample_value % 2 == 0 ? (read_depths[sample_value / 2 - 1] + read_depths[sample_value / 2]) / (double) 2
+                                          : read_depths[std::floor(sample_value / 2)];
+    result.mode = (std::max_element(depth_counts.begin(), depth_counts.end(),
+                                    [](std::pair<double, uint64_t> const & a,
+                                       std::pair<double, uint64_t> const & b) {
+                                           return a.second < b.second;
+                                    }))->first;
+    result.variance = std::accumulate(read_depths.begin(), read_depths.end(), 0.0,
+                                      [&result](const double & a, const double & b) {
+                                          return a + (std::pow((b - result.mean), 2));
+                                      }) / (sample_value - 1);
+    result.sd = std::sqrt(result.variance);
+
+    return result;
+}
+
 /*!
    \brief A function to sample read depth from an alignment file, given the input file, index, and number of positions.
    \param input_file The input alignment file in sam/bam format.
-   \param bamit_index The vector of indices for each chromosome.
+   \param bamit_index The vector of indices for each chromosome, either as root IntervalNodes or as FlatIntervalTrees.
    \param sample_value The number of positions to sample.
    \param seed The seed to use for the random generator. Enables reproducibility. Default is 0.
 
@@ -43,58 +115,77 @@ struct EstimationResult
 
    \return Returns a struct containing statistics over the sampled points.
  */
-template <typename traits_type, typename fields_type, typename format_type>
+template <typename traits_type, typename fields_type, typename format_type, typename tree_type>
 inline EstimationResult sample_read_depth(seqan3::sam_file_input<traits_type, fields_type, format_type> & input_file,
-                                          std::vector<std::unique_ptr<IntervalNode>> const & bamit_index,
+                                          std::vector<tree_type> const & bamit_index,
                                           uint64_t const & sample_value,
                                           uint64_t const & seed = 0)
     {
         if (sample_value <= 1) throw std::invalid_argument("sample_value must be greater than 1.");
-        auto & header = input_file.header(); // Obtain the header from the input file.
         // Intialize vector of read depths at # of positions defined by sample_value.
-        std::vector<uint64_t> read_depths(sample_value);
-        std::map<double, uint64_t> depth_counts{}; // Counts how often each depth occurs.
-        std::mt19937 gen(seed); // seed the generator
-        std::uniform_int_distribution<> distr_chr(0, header.ref_ids().size() - 1); // define the range
+        std::vector<uint64_t> read_depths{};
+        read_depths.reserve(sample_value);
 
-        uint64_t rand_pos, rand_chr;
-        std::tuple<uint64_t, uint64_t> pos_tuple;
-        auto it = input_file.begin();
+        // For each sample, count the mapped reads overlapping the position.
+        for (Position const & position : sample_positions(get_ref_lengths(input_file.header()), sample_value, seed))
+        {
+            // Count the records of the above location.
+            read_depths.push_back(std::ranges::distance(get_overlap_range(input_file, bamit_index, position, position)));
+        }
+        return estimate_read_depth(std::move(read_depths));
+    }
 
-        // For each sample, increment its associated read_depths[i] for each mapped read overlapping the position.
-        for (auto & i : read_depths)
+/*!
+   \brief Sample read depth from an alignment file like bamit::sample_read_depth, querying the positions in parallel.
+   \param input_path The input alignment file in sam/bam format.
+   \param bamit_index The vector of indices for each chromosome, either as root IntervalNodes or as FlatIntervalTrees.
+   \param sample_value The number of positions to sample.
+   \param seed The seed to use for the random generator. Enables reproducibility. Default is 0.
+   \param threads The number of threads, each reading the file through its own handle. Default is 1.
+   \param cache The cache of decompressed blocks of a BAM file, shared by the threads. None by default.
+
+   \details Gives the same result as bamit::sample_read_depth for the same seed. BAM files are read with
+            bamit::get_overlap_count, which counts the reads without decoding them. With a cache, positions close to
+            each other decompress their blocks once.
+
+   \return Returns a struct containing statistics over the sampled points.
+ */
+template <typename tree_type>
+inline EstimationResult sample_read_depth(std::filesystem::path const & input_path,
+                                          std::vector<tree_type> const & bamit_index,
+                                          uint64_t const & sample_value,
+                                          uint64_t const & seed = 0,
+                                          size_t const threads = 1,
+                                          BlockCache * const cache = nullptr)
+    {
+        if (sample_value <= 1) throw std::invalid_argument("sample_value must be greater than 1.");
+        auto to_regions = [] (std::vector<Position> const & positions)
         {
-            // Obtain a random chromosome from what is listed in the header, then obtain a random
-            // position constrained by the chromosome size.
-            rand_chr = distr_chr(gen);
-            std::uniform_int_distribution<> distr_pos(0, std::get<0>(header.ref_id_info[rand_chr]) - 1);
-            rand_pos = distr_pos(gen);
-            pos_tuple = std::make_tuple(rand_chr, rand_pos);
-
-            // Get list of records of the above location.
-            auto results = get_overlap_records(input_file, bamit_index, pos_tuple, pos_tuple);
-            i = results.size();
+            std::vector<std::pair<Position, Position>> regions{};
+            for (Position const & position : positions)
+                regions.emplace_back(position, position);
+            return regions;
+        };
+
+        if (input_path.extension() == ".bam")
+        {
+            std::vector<uint32_t> const ref_lengths = BamScanner{input_path}.get_ref_lengths();
+            QueryEngine<tree_type, BamScanner> engine{input_path, bamit_index, threads, cache};
+            return estimate_read_depth(engine.query(to_regions(sample_positions(ref_lengths, sample_value, seed)),
+                                                    [] (BamScanner & scanner, auto const & node_list,
+                                                        Position const & start, Position const & end)
+            {
+                return static_cast<uint64_t>(get_overlap_count(scanner, node_list, start, end));
+            }));
         }
-        std::sort(read_depths.begin(), read_depths.end());
-        std::for_each(read_depths.begin(), read_depths.end(),
-                      [&depth_counts](uint64_t const & value) {++(depth_counts[value]);});
-
-        EstimationResult result;
-        result.mean = std::accumulate(read_depths.begin(), read_depths.end(), 0) / (double) sample_value;
-        // If sample_value is even, median is average of two middle numbers. Otherwise, it is just the one number.
-        result.median = sample_value % 2 == 0 ? (read_depths[sample_value / 2 - 1] + read_depths[sample_value / 2]) / (double) 2
-                                              : read_depths[std::floor(sample_value / 2)];
-        result.mode = (std::max_element(depth_counts.begin(), depth_counts.end(),
-                                        [](std::pair<double, uint64_t> const & a,
-                                           std::pair<double, uint64_t> const & b) {
-                                               return a.second < b.second;
-                                        }))->first;
-        result.variance = std::accumulate(read_depths.begin(), read_depths.end(), 0.0,
-                                          [&result](const double & a, const double & b) {
-                                              return a + (std::pow((b - result.mean), 2));
-                                          }) / (sample_value - 1);
-        result.sd = std::sqrt(result.variance);
-
-        return result;
+
+        QueryEngine<tree_type> engine{input_path, bamit_index, threads};
+        return estimate_read_depth(engine.query(to_regions(sample_positions(get_ref_lengths(engine.header()),
+                                                                            sample_value, seed)),
+                                                [] (auto & input, auto const & node_list,
+                                                    Position const & start, Position const & end)
+        {
+            return static_cast<uint64_t>(std::ranges::distance(get_overlap_range(input, node_list, start, end)));
+        }));
     }
 } // namespace bamit
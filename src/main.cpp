@@ -10,14 +10,21 @@ struct IndexOptions
 {
     std::filesystem::path input_path{};
     uint16_t threads{1};
+    uint32_t median_sample_size{0};
+    uint64_t memory_budget{0};
+    bool flat{false};
+    bool bai{false};
+    bool csi{false};
     bool verbose{false};
 };
 
 struct OverlapOptions : IndexOptions
 {
     std::filesystem::path out_file{};
+    std::filesystem::path bed_file{};
     std::string start{};
     std::string end{};
+    bool count{false};
 };
 
 void initialize_top_parser(seqan3::argument_parser & parser)
@@ -43,6 +50,24 @@ void initialize_index_parser(seqan3::argument_parser & parser, IndexOptions & op
                       seqan3::option_spec::standard,
                       seqan3::arithmetic_range_validator{std::numeric_limits<uint16_t>::min(),
                                                          std::numeric_limits<uint16_t>::max()});
+    parser.add_option(options.median_sample_size, 'm', "median_sample",
+                      "Approximate the median of tree nodes over more reads than this from a sample of this many reads."
+                      " Speeds up indexing very deep files. 0 always computes the exact median.",
+                      seqan3::option_spec::advanced);
+    parser.add_option(options.memory_budget, 'M', "memory",
+                      "The memory in MiB which may be used for the reads of the chromosomes being indexed. Reads beyond it"
+                      " are written to temporary files in TMPDIR. 0 means no limit. With several threads, a quarter of it"
+                      " holds the reads of the parts of a BAM file which are read in parallel.",
+                      seqan3::option_spec::standard);
+    parser.add_flag(options.flat, 'f', "flat",
+                    "Write the index in a flat format which overlap queries map into memory instead of loading it."
+                    " Loading is faster for short queries, but reads cannot be counted from the index alone.");
+    parser.add_flag(options.bai, '\0', "bai",
+                    "Also write a BAI index (input.bam.bai) for samtools and other htslib tools, from the same pass"
+                    " through the BAM file.");
+    parser.add_flag(options.csi, '\0', "csi",
+                    "Like --bai, but write a CSI index (input.bam.csi), which also supports references longer than 512"
+                    " Mbp. Cannot be combined with --bai.");
     parser.add_flag(options.verbose, 'v', "verbose", "Print verbose output.");
 }
 
@@ -61,17 +86,25 @@ void initialize_overlap_parser(seqan3::argument_parser & parser, OverlapOptions
     parser.add_option(options.start, 's', "start",
                       "The start of the interval to query, in the format chrA,posA."
                       " Note that when start and end are the same, this queries for reads overlapping a point.",
-                      seqan3::option_spec::required,
+                      seqan3::option_spec::standard,
                       query_validator);
     parser.add_option(options.end, 'e', "end",
                       "The end of the interval to query, in the format chrB,posB."
                       " Note that when start and end are the same, this queries for reads overlapping a point.",
-                      seqan3::option_spec::required,
+                      seqan3::option_spec::standard,
                       query_validator);
+    parser.add_option(options.bed_file, 'b', "bed",
+                      "A BED file of intervals to query instead of start and end. All intervals are searched in a single"
+                      " pass through the SAM/BAM file and every read overlapping any of them is output once.",
+                      seqan3::option_spec::standard,
+                      seqan3::input_file_validator{{"bed"}});
     parser.add_option(options.threads, 't', "threads", "The number of threads to use for parallel work.",
                       seqan3::option_spec::standard,
                       seqan3::arithmetic_range_validator{std::numeric_limits<uint16_t>::min(),
                                                          std::numeric_limits<uint16_t>::max()});
+    parser.add_flag(options.count, 'c', "count",
+                    "Print the number of overlapping reads. With a BED file, the number is printed for every interval."
+                    " For BAM files without an output file, the reads are counted without decoding them.");
     parser.add_flag(options.verbose, 'v', "verbose", "Print verbose output.");
 }
 
@@ -135,29 +168,130 @@ int parse_overlap_query(bamit::Position & start,
     return 0;
 }
 
-int run_index(std::vector<std::unique_ptr<bamit::IntervalNode>> & node_list, IndexOptions const & options)
+/*!
+   \brief Extract the chromosome lengths from a SAM/BAM header, as needed for the header of an output file.
+   \param header The header of the input file.
+   \return Returns the length of every reference chromosome.
+*/
+std::vector<int32_t> get_ref_lengths(auto & header)
+{
+    std::vector<int32_t> ref_lengths{};
+    std::transform(std::begin(header.ref_id_info), std::end(header.ref_id_info),
+                   std::back_inserter(ref_lengths), [](auto const & pair){ return std::get<0>(pair); });
+    return ref_lengths;
+}
+
+/*!
+   \brief Parse the intervals of a BED file into pairs of bamit::Position.
+   \param regions Where the resulting start and end bamit::Positions will go.
+   \param bed_path The BED file to parse. Only the first three columns are used, and header lines are skipped.
+   \param ref_ids The reference chromosome names, stored in a deque by seqan3.
+   \return 0 if the parsing was successful, -1 otherwise.
+   \details The BED start and end are used like the start and end of a single query. Intervals on chromosomes which
+            are not in the SAM/BAM file cannot overlap any read and are skipped with a warning.
+*/
+int parse_bed_file(std::vector<std::pair<bamit::Position, bamit::Position>> & regions,
+                   std::filesystem::path const & bed_path,
+                   std::deque<std::string> const & ref_ids)
 {
-    std::vector<std::vector<bamit::Record>> records{};
-    seqan3::contrib::bgzf_thread_count = options.threads;
-    seqan3::sam_file_input<seqan3::sam_file_input_default_traits<>,
-                           seqan3::fields<seqan3::field::ref_id,
-                                          seqan3::field::ref_offset,
-                                          seqan3::field::cigar,
-                                          seqan3::field::flag>,
-                           seqan3::type_list<seqan3::format_bam,
-                                             seqan3::format_sam>> input_file{options.input_path};
+    std::ifstream bed_file{bed_path};
+    if (!bed_file.is_open())
+    {
+        seqan3::debug_stream << "[ERROR] Could not open " << bed_path << ".\n";
+        return -1;
+    }
+
+    std::string line{};
+    size_t line_number{0};
+    size_t skipped{0};
+    while (std::getline(bed_file, line))
+    {
+        ++line_number;
+        if (line.empty() || line[0] == '#' || line.starts_with("track") || line.starts_with("browser")) continue;
+
+        std::istringstream fields{line};
+        std::string chromosome{};
+        int64_t start_position{-1}, end_position{-1};
+        if (!(fields >> chromosome >> start_position >> end_position) || start_position < 0 ||
+            end_position < start_position || end_position > std::numeric_limits<int32_t>::max())
+        {
+            seqan3::debug_stream << "[ERROR] There was a formatting error in line " << line_number << " of the BED file!\n";
+            return -1;
+        }
+
+        auto ref_id_it = std::find(ref_ids.begin(), ref_ids.end(), chromosome);
+        if (ref_id_it == ref_ids.end())
+        {
+            ++skipped;
+            continue;
+        }
+        int32_t const ref_id = ref_id_it - ref_ids.begin();
+        regions.emplace_back(bamit::Position{ref_id, static_cast<int32_t>(start_position)},
+                             bamit::Position{ref_id, static_cast<int32_t>(end_position)});
+    }
+    if (skipped > 0)
+    {
+        seqan3::debug_stream << "[WARNING] Skipped " << skipped
+                             << " BED intervals on chromosomes which are not in the input file.\n";
+    }
+    return 0;
+}
 
+int run_index(std::vector<std::unique_ptr<bamit::IntervalNode>> & node_list,
+              bamit::LinearIndex & linear_index,
+              IndexOptions const & options)
+{
     seqan3::debug_stream << "Creating Interval Tree.\n";
-    node_list = bamit::index(input_file, options.verbose);
+    if (options.bai && options.csi)
+    {
+        seqan3::debug_stream << "[ERROR] Only one of --bai and --csi can be given!\n";
+        return -1;
+    }
+    if ((options.bai || options.csi) && options.input_path.extension() != ".bam")
+    {
+        seqan3::debug_stream << "[ERROR] BAI and CSI indices can only be written for BAM files!\n";
+        return -1;
+    }
+    if (options.input_path.extension() == ".bam")
+    {
+        // BAM files are scanned directly, decoding only the fields needed for the index.
+        std::optional<bamit::BinningIndex> binning_index{};
+        if (options.bai || options.csi)
+            binning_index.emplace(bamit::BamScanner{options.input_path}.get_ref_lengths(), options.csi);
+        node_list = bamit::index(options.input_path, options.verbose, options.threads, options.median_sample_size,
+                                 options.memory_budget << 20, &linear_index,
+                                 binning_index ? &*binning_index : nullptr);
+        if (binning_index)
+        {
+            std::filesystem::path binning_index_path{options.input_path};
+            binning_index_path += options.csi ? ".csi" : ".bai";
+            binning_index->write(binning_index_path);
+        }
+    }
+    else
+    {
+        seqan3::contrib::bgzf_thread_count = options.threads;
+        seqan3::sam_file_input<seqan3::sam_file_input_default_traits<>,
+                               seqan3::fields<seqan3::field::ref_id,
+                                              seqan3::field::ref_offset,
+                                              seqan3::field::cigar,
+                                              seqan3::field::flag>,
+                               seqan3::type_list<seqan3::format_bam,
+                                                 seqan3::format_sam>> input_file{options.input_path};
+        node_list = bamit::index(input_file, options.verbose, options.threads, options.median_sample_size,
+                                 options.memory_budget << 20, &linear_index);
+    }
     seqan3::debug_stream << "Writing to file.\n";
     {
         std::filesystem::path index_path{options.input_path};
         index_path.replace_extension("bam.bit");
-        std::ofstream out_file(index_path,
-                               std::ios_base::binary | std::ios_base::out);
-        cereal::BinaryOutputArchive archive(out_file);
-        bamit::write(node_list, archive);
-        out_file.close();
+        if (options.flat)
+        {
+            bamit::write_mapped_index(index_path, node_list, linear_index);
+            return 0;
+        }
+        // The trees are stored with an offset table, so that queries read only those of their chromosomes.
+        bamit::write_lazy_index(index_path, node_list, linear_index);
     }
     return 0;
 }
@@ -179,7 +313,151 @@ int parse_index(seqan3::argument_parser & parser)
         return -1;
     }
     std::vector<std::unique_ptr<bamit::IntervalNode>> node_list{};
-    run_index(node_list, options);
+    bamit::LinearIndex linear_index{};
+    return run_index(node_list, linear_index, options);
+}
+
+//!\brief The memory in bytes for the decompressed BGZF blocks kept while counting the reads of the intervals of a BED
+//!       file.
+constexpr size_t overlap_block_cache_size{64 << 20};
+
+/*!
+   \brief Answer the overlap query or the BED file of queries given by the options.
+   \param node_list The list of interval trees per chromosome, either as root IntervalNodes or as MappedIntervalTrees.
+   \param linear_index The bamit::LinearIndex of the input file.
+   \param options The options of the overlap command.
+   \param input The input file.
+   \param load Called with the start and end of the queries before they are answered, to load the trees they need.
+   \return 0 if the queries were answered, -1 otherwise.
+*/
+template <typename tree_type>
+int run_overlap(std::vector<tree_type> const & node_list,
+                bamit::LinearIndex const & linear_index,
+                OverlapOptions const & options,
+                auto & input,
+                auto && load)
+{
+    seqan3::debug_stream << "Searching...\n";
+    if (!options.bed_file.empty())
+    {
+        std::vector<std::pair<bamit::Position, bamit::Position>> regions{};
+        if (parse_bed_file(regions, options.bed_file, input.header().ref_ids()) == -1) return -1;
+        for (auto const & [start, end] : regions)
+            load(start, end);
+
+        size_t record_count{0};
+        std::vector<size_t> region_counts(regions.size());
+        auto count = [&](std::vector<size_t> const & indices)
+        {
+            ++record_count;
+            for (size_t index : indices) ++region_counts[index];
+        };
+        bool const count_from_trees = options.count && options.out_file.empty() &&
+                                      options.input_path.extension() == ".bam";
+        if (count_from_trees)
+        {
+            // Like a single query, every interval is counted from the trees, reading only the uncertain records.
+            // Nearby or repeated intervals read the same blocks, which are decompressed once.
+            bamit::BlockCache cache{overlap_block_cache_size};
+            bamit::BamScanner scanner{options.input_path, &cache};
+            for (size_t i = 0; i < regions.size(); ++i)
+            {
+                region_counts[i] = bamit::get_overlap_count(scanner, node_list, regions[i].first, regions[i].second,
+                                                            linear_index);
+            }
+            if (options.verbose) seqan3::debug_stream << "Counted the reads of " << regions.size() << " intervals.\n";
+        }
+        else if (options.out_file.empty())
+        {
+            bamit::get_batch_overlap_records(input, node_list, regions,
+                                             [&](auto const &, std::vector<size_t> const & indices) { count(indices); },
+                                             linear_index);
+        }
+        else
+        {
+            seqan3::sam_file_output fout{options.out_file, input.header().ref_ids(), get_ref_lengths(input.header())};
+            bamit::get_batch_overlap_records(input, node_list, regions,
+                                             [&](auto const & record, std::vector<size_t> const & indices)
+            {
+                fout.push_back(record);
+                count(indices);
+            }, linear_index);
+        }
+        if (options.verbose && !count_from_trees)
+        {
+            seqan3::debug_stream << "Found " << record_count << " reads overlapping " << regions.size()
+                                 << " intervals.\n";
+        }
+        if (options.count)
+        {
+            for (size_t i = 0; i < regions.size(); ++i)
+            {
+                std::cout << input.header().ref_ids()[std::get<0>(regions[i].first)] << '\t'
+                          << std::get<1>(regions[i].first) << '\t' << std::get<1>(regions[i].second) << '\t'
+                          << region_counts[i] << '\n';
+            }
+        }
+        return 0;
+    }
+    if (options.start.empty() || options.end.empty())
+    {
+        seqan3::debug_stream << "[ERROR] Either a BED file or both a start and an end must be given!\n";
+        return -1;
+    }
+    bamit::Position start, end;
+    if (parse_overlap_query(start, end, options, input.header().ref_ids()) == -1) return -1;
+    load(start, end);
+    if (options.verbose) seqan3::debug_stream << "Search: " << input.header().ref_ids()[std::get<0>(start)] << ":"
+                                              << std::get<1>(start) << " through "
+                                              << input.header().ref_ids()[std::get<0>(end)]
+                                              << ":" << std::get<1>(end) << "\n";
+    // With the trees of bamit::index, only the parts of the file which may hold overlapping records are read.
+    auto for_each_record = [&](auto && callback)
+    {
+        if constexpr (std::same_as<tree_type, std::unique_ptr<bamit::IntervalNode>>)
+        {
+            bamit::read_overlap_chunks(input, bamit::get_overlap_chunks(node_list, start, end, linear_index), start,
+                                       end, callback);
+        }
+        else
+        {
+            for (auto & record : bamit::get_overlap_range(input, node_list, start, end, linear_index))
+                callback(record);
+        }
+    };
+    size_t record_count{0};
+    if (options.out_file.empty() && options.input_path.extension() == ".bam")
+    {
+        bamit::BamScanner scanner{options.input_path};
+        record_count = bamit::get_overlap_count(scanner, node_list, start, end, linear_index);
+    }
+    else if (options.out_file.empty())
+    {
+        for_each_record([&](auto const &) { ++record_count; });
+    }
+    else if (options.input_path.extension() == ".bam" && options.out_file.extension() == ".bam")
+    {
+        // From BAM to BAM, the records are copied as they are instead of being decoded and encoded again.
+        record_count = bamit::extract_overlap_records(options.input_path, node_list, start, end, options.out_file,
+                                                      Z_DEFAULT_COMPRESSION, linear_index);
+    }
+    else
+    {
+        // Stream the records into the output as they are read, so that wide queries need constant memory.
+        seqan3::sam_file_output fout{options.out_file, input.header().ref_ids(), get_ref_lengths(input.header())};
+        for_each_record([&](auto const & record)
+        {
+            fout.push_back(record);
+            ++record_count;
+        });
+    }
+    if (record_count == 0 && options.verbose)
+    {
+        seqan3::debug_stream << "No overlapping reads found for query "
+                             << input.header().ref_ids()[std::get<0>(start)] << ":" << std::get<1>(start) << " through "
+                             << input.header().ref_ids()[std::get<0>(end)] << ":" << std::get<1>(end) << "\n";
+    }
+    if (options.count) std::cout << record_count << '\n';
 
     return 0;
 }
@@ -206,28 +484,49 @@ int parse_overlap(seqan3::argument_parser & parser)
     seqan3::sam_file_input input{options.input_path};
     std::filesystem::path index_path{options.input_path};
     std::vector<std::unique_ptr<bamit::IntervalNode>> node_list;
+    bamit::LinearIndex linear_index{};
     index_path.replace_extension("bam.bit");
-    if (!std::filesystem::exists(index_path)) run_index(node_list, options);
+    auto load_nothing = [] (bamit::Position const &, bamit::Position const &) {};
+    if (!std::filesystem::exists(index_path)) run_index(node_list, linear_index, options);
+    else if (bamit::is_mapped_index(index_path))
+    {
+        seqan3::debug_stream << "Mapping index file...\n";
+        bamit::MappedIndex const mapped_index{index_path};
+        return run_overlap(mapped_index.get_trees(), mapped_index.get_linear_index(), options, input, load_nothing);
+    }
+    else if (bamit::is_lazy_index(index_path))
+    {
+        // Only the trees of the chromosomes queried are read.
+        seqan3::debug_stream << "Reading index file...\n";
+        bamit::LazyIndex lazy_index{index_path};
+        return run_overlap(lazy_index.get_trees(), lazy_index.get_linear_index(), options, input,
+                           [&lazy_index] (bamit::Position const & start, bamit::Position const & end)
+        {
+            lazy_index.load(start, end);
+        });
+    }
     else
     {
         seqan3::debug_stream << "Reading index file...\n";
         {
             std::ifstream in_file{index_path, std::ios_base::binary | std::ios_base::in};
             cereal::BinaryInputArchive iarchive(in_file);
-            bamit::read(node_list, iarchive);
+            // Index files written before the nodes were versioned are read without the record counts, which makes
+            // the queries read more records.
+            if (!bamit::read_cereal_trees(node_list, iarchive))
+            {
+                seqan3::debug_stream << "[WARNING] The index file was written by an older version of bamit. Run bamit "
+                                        "index again to speed up the queries.\n";
+            }
+            // Index files written before the LinearIndex was added end after the trees.
+            else if (in_file.peek() != std::ifstream::traits_type::eof())
+            {
+                iarchive(linear_index);
+            }
             in_file.close();
         }
     }
-    seqan3::debug_stream << "Searching...\n";
-    bamit::Position start, end;
-    if (parse_overlap_query(start, end, options, input.header().ref_ids()) == -1) return -1;
-    if (options.verbose) seqan3::debug_stream << "Search: " << input.header().ref_ids()[std::get<0>(start)] << ":"
-                                              << std::get<1>(start) << " through "
-                                              << input.header().ref_ids()[std::get<0>(end)]
-                                              << ":" << std::get<1>(end) << "\n";
-    bamit::get_overlap_records(input, node_list, start, end, options.verbose, options.out_file);
-
-    return 0;
+    return run_overlap(node_list, linear_index, options, input, load_nothing);
 }
 
 int parse_print(seqan3::argument_parser & parser)
@@ -252,6 +551,20 @@ int parse_print(seqan3::argument_parser & parser)
     seqan3::contrib::bgzf_thread_count = 1;
 
     std::filesystem::path index_path{options.input_path};
+    if (bamit::is_mapped_index(index_path))
+    {
+        bamit::MappedIndex const mapped_index{index_path};
+        for (auto const & tree : mapped_index.get_trees())
+            tree.print();
+        return 0;
+    }
+    if (bamit::is_lazy_index(index_path))
+    {
+        bamit::LazyIndex lazy_index{index_path};
+        for (auto const & node : lazy_index.load_all())
+            if (node) node->print(0);
+        return 0;
+    }
     std::ifstream in_file{index_path, std::ios_base::binary | std::ios_base::in};
     cereal::BinaryInputArchive iarchive(in_file);
     bamit::read(node_list, iarchive);
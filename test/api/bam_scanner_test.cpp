@@ -0,0 +1,312 @@
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <set>
+
+#include <bamit/all.hpp>
+
+#include "tree_test_helpers.hpp"
+
+// Write the decompressed data of a BAM file to a new BAM file, compressing every block_size bytes in their own block.
+// With at_records, a block is only ended where a record starts, as htslib does.
+void write_small_blocks(std::filesystem::path const & input, std::filesystem::path const & output, size_t block_size,
+                        bool const at_records = false)
+{
+    std::set<std::streamoff> record_starts{};
+    if (at_records)
+    {
+        bamit::BamScanner scanner{input};
+        while (scanner.next())
+            record_starts.insert(scanner.get_file_position());
+    }
+
+    bamit::BgzfReader reader{input};
+    std::ofstream out{output, std::ios_base::binary};
+    std::vector<char> data{};
+    std::vector<char> compressed(bamit::bgzf_max_block_size);
+    auto write_block = [&] ()
+    {
+        z_stream stream{};
+        ASSERT_EQ(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY), Z_OK);
+        stream.next_in = reinterpret_cast<Bytef *>(data.data());
+        stream.avail_in = data.size();
+        stream.next_out = reinterpret_cast<Bytef *>(compressed.data() + 18);
+        stream.avail_out = compressed.size() - 26;
+        ASSERT_EQ(deflate(&stream, Z_FINISH), Z_STREAM_END);
+        size_t const total = 26 + stream.total_out;
+        deflateEnd(&stream);
+
+        char const header[18]{31, -117, 8, 4, 0, 0, 0, 0, 0, -1, 6, 0, 'B', 'C', 2, 0,
+                              static_cast<char>((total - 1) & 0xFF), static_cast<char>((total - 1) >> 8)};
+        std::memcpy(compressed.data(), header, 18);
+        uint32_t const crc = crc32(0, reinterpret_cast<Bytef const *>(data.data()), data.size());
+        uint32_t const isize = data.size();
+        std::memcpy(compressed.data() + total - 8, &crc, 4);
+        std::memcpy(compressed.data() + total - 4, &isize, 4);
+        out.write(compressed.data(), total);
+        data.clear();
+    };
+
+    char c{};
+    while (true)
+    {
+        if (data.size() >= block_size && (!at_records || record_starts.contains(reader.tell()))) write_block();
+        if (reader.read(&c, 1) == 0) break;
+        data.push_back(c);
+    }
+    if (!data.empty()) write_block();
+    write_block(); // The last, empty block marks the end of the file.
+}
+
+TEST(bam_scanner, records)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    bamit::BamScanner scanner{input};
+
+    EXPECT_EQ(scanner.get_sorting(), "coordinate");
+    EXPECT_EQ(scanner.get_ref_names(), std::vector<std::string>(input_file.header().ref_ids().begin(),
+                                                                input_file.header().ref_ids().end()));
+
+    // Every record must match the one decoded by seqan3.
+    for (auto it = input_file.begin(); it != input_file.end(); ++it)
+    {
+        ASSERT_TRUE(scanner.next());
+        EXPECT_EQ(scanner.get_file_position(), static_cast<std::streamoff>(it.file_position()));
+        EXPECT_EQ(scanner.unmapped(), bamit::unmapped(*it));
+        EXPECT_EQ(scanner.get_reference_id(), (*it).reference_id().value_or(-1));
+        EXPECT_EQ(scanner.get_reference_position(), (*it).reference_position().value_or(-1));
+        EXPECT_EQ(scanner.get_length(), bamit::get_length((*it).cigar_sequence()));
+    }
+    EXPECT_FALSE(scanner.next());
+}
+
+TEST(bam_scanner, seek)
+{
+    std::filesystem::path input{DATADIR"simulated_chr1_small_golden.bam"};
+    bamit::BamScanner scanner{input};
+    std::vector<std::tuple<std::streamoff, int32_t, int32_t>> records{};
+    while (scanner.next())
+        records.emplace_back(scanner.get_file_position(), scanner.get_reference_position(), scanner.get_length());
+    ASSERT_FALSE(records.empty());
+
+    // Seek backwards through the file.
+    for (size_t i = records.size(); i > 0; i -= std::min<size_t>(i, 97))
+    {
+        scanner.seek(std::get<0>(records[i - 1]));
+        ASSERT_TRUE(scanner.next());
+        EXPECT_EQ(std::make_tuple(scanner.get_file_position(), scanner.get_reference_position(), scanner.get_length()),
+                  records[i - 1]);
+    }
+}
+
+TEST(bam_scanner, index)
+{
+    for (std::filesystem::path input : {DATADIR"simulated_chr1_small_golden.bam",
+                                        DATADIR"simulated_mult_chr_small_golden.bam"})
+    {
+        seqan3::sam_file_input input_file{input};
+        std::vector<std::unique_ptr<bamit::IntervalNode>> expected = bamit::index(input_file);
+        for (uint16_t threads : {1, 4})
+        {
+            std::vector<std::unique_ptr<bamit::IntervalNode>> actual = bamit::index(input, false, threads);
+            ASSERT_EQ(expected.size(), actual.size());
+            for (size_t i = 0; i < expected.size(); ++i)
+                compare_trees(expected[i], actual[i]);
+        }
+    }
+}
+
+TEST(bam_scanner, scan_records)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    std::vector<std::pair<uint32_t, bamit::Record>> expected{};
+    bamit::scan_records(input, 1, [&expected] (uint32_t ref_id, bamit::Record const & record)
+    {
+        expected.emplace_back(ref_id, record);
+    });
+
+    // Split the file into many parts, with record starts in most blocks (1000) or in few blocks (97).
+    for (size_t block_size : {1000u, 97u})
+    {
+        std::filesystem::path blocks{OUTPUTDIR"small_blocks.bam"};
+        write_small_blocks(input, blocks, block_size);
+        bamit::BamScanner scanner{blocks};
+        std::vector<std::pair<uint32_t, bamit::Record>> sequential{};
+        size_t record_count{0};
+        while (scanner.next())
+        {
+            ++record_count;
+            if (!scanner.unmapped())
+                sequential.emplace_back(scanner.get_reference_id(),
+                                        bamit::Record{static_cast<uint32_t>(scanner.get_reference_position()),
+                                                      static_cast<uint32_t>(scanner.get_reference_position() +
+                                                                            scanner.get_length()),
+                                                      scanner.get_file_position()});
+        }
+        std::streamoff const end_of_file = scanner.get_file_position();
+        ASSERT_EQ(sequential.size(), expected.size());
+
+        for (uint64_t range_size : {1000u, 2500u, 100000u})
+        {
+            std::vector<std::pair<uint32_t, bamit::Record>> actual{};
+            bamit::scan_records(blocks, 4, [&actual] (uint32_t ref_id, bamit::Record const & record)
+            {
+                actual.emplace_back(ref_id, record);
+            }, range_size);
+            ASSERT_EQ(actual.size(), sequential.size());
+            for (size_t i = 0; i < actual.size(); ++i)
+            {
+                EXPECT_EQ(actual[i].first, sequential[i].first);
+                EXPECT_EQ(actual[i].second, sequential[i].second);
+                EXPECT_EQ(actual[i].second.file_position, sequential[i].second.file_position);
+            }
+
+            // With a memory budget, a part holds only the records fitting its share, here 3, and the rest of it is
+            // scanned by the caller. The pool may be shared with other work.
+            bamit::ThreadPool pool{4};
+            std::vector<std::pair<uint32_t, bamit::Record>> bounded{};
+            bamit::scan_records(blocks, &pool, [&bounded] (uint32_t ref_id, bamit::Record const & record)
+            {
+                bounded.emplace_back(ref_id, record);
+            }, range_size, 3 * 2 * pool.size() * sizeof(bamit::BamRange::entry_type));
+            ASSERT_EQ(bounded.size(), sequential.size());
+            for (size_t i = 0; i < bounded.size(); ++i)
+            {
+                EXPECT_EQ(bounded[i].first, sequential[i].first);
+                EXPECT_EQ(bounded[i].second, sequential[i].second);
+                EXPECT_EQ(bounded[i].second.file_position, sequential[i].second.file_position);
+            }
+
+            // A function taking a third argument gets the unmapped records as well.
+            size_t all_count{0}, mapped_count{0};
+            EXPECT_EQ(bamit::scan_records(blocks, 4, [&] (uint32_t, bamit::Record const &, bool const unmapped)
+            {
+                ++all_count;
+                if (!unmapped) ++mapped_count;
+            }, range_size), end_of_file);
+            EXPECT_EQ(all_count, record_count);
+            EXPECT_EQ(mapped_count, sequential.size());
+        }
+
+        // The index over the parallel scan is the same as the one constructed with seqan3.
+        seqan3::sam_file_input input_file{blocks};
+        std::vector<std::unique_ptr<bamit::IntervalNode>> expected_trees = bamit::index(input_file);
+        std::vector<std::unique_ptr<bamit::IntervalNode>> actual_trees = bamit::index(blocks, false, 4);
+        ASSERT_EQ(expected_trees.size(), actual_trees.size());
+        for (size_t i = 0; i < expected_trees.size(); ++i)
+            compare_trees(expected_trees[i], actual_trees[i]);
+        // Also when the scan and the records of the trees share a small memory budget.
+        actual_trees = bamit::index(blocks, false, 4, 0, 4096);
+        ASSERT_EQ(expected_trees.size(), actual_trees.size());
+        for (size_t i = 0; i < expected_trees.size(); ++i)
+            compare_trees(expected_trees[i], actual_trees[i]);
+    }
+}
+
+// Read the compressed blocks of a BGZF file.
+std::vector<std::string> read_blocks(std::filesystem::path const & path)
+{
+    std::ifstream file{path, std::ios_base::binary};
+    std::vector<std::string> blocks{};
+    std::vector<char> header(18);
+    while (file.read(header.data(), header.size()))
+    {
+        std::string block(bamit::bgzf_block_size(header.data(), header.size()), '\0');
+        std::memcpy(block.data(), header.data(), header.size());
+        file.read(block.data() + header.size(), block.size() - header.size());
+        blocks.push_back(std::move(block));
+    }
+    return blocks;
+}
+
+TEST(bam_scanner, corrupt_blocks)
+{
+    // The empty end-of-file block.
+    std::array<char, 28> block{31, -117, 8, 4, 0, 0, 0, 0, 0, -1, 6, 0, 'B', 'C', 2, 0, 27, 0, 3, 0};
+    EXPECT_EQ(bamit::bgzf_block_size(block.data(), block.size()), 28u);
+    std::filesystem::path path{OUTPUTDIR"corrupt_block.bam"};
+    auto write = [&path] (std::array<char, 28> const & data)
+    {
+        std::ofstream out{path, std::ios_base::binary};
+        out.write(data.data(), data.size());
+    };
+
+    // A block too small for its header and footer is not a block.
+    for (char const size : {0, 10, 17, 24})
+    {
+        std::array<char, 28> small{block};
+        small[16] = size;
+        EXPECT_EQ(bamit::bgzf_block_size(small.data(), small.size()), 0u);
+        write(small);
+        EXPECT_THROW(bamit::BgzfReader{path}, std::runtime_error);
+    }
+
+    // A block cannot decompress to more than 64 KiB.
+    std::array<char, 28> large{block};
+    large[27] = 1;
+    write(large);
+    EXPECT_THROW(bamit::BgzfReader{path}, std::runtime_error);
+    std::filesystem::remove(path);
+}
+
+TEST(bam_scanner, extract_overlap_records)
+{
+    std::filesystem::path input{OUTPUTDIR"extract_small_blocks.bam"};
+    std::filesystem::path output{OUTPUTDIR"extract_result.bam"};
+    // Blocks which end within a record are never copied when the records are read, but the ones within chromosomes
+    // covered entirely are copied using the spans of the LinearIndex.
+    for (bool const at_records : {true, false})
+    {
+        write_small_blocks(DATADIR"simulated_mult_chr_small_golden.bam", input, 1000, at_records);
+        bamit::LinearIndex linear_index{};
+        std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input, false, 1, 0, 0,
+                                                                                   &linear_index);
+        std::vector<std::string> const input_blocks = read_blocks(input);
+        bamit::BamScanner input_scanner{input};
+
+        for (auto [start, end] : std::vector<std::pair<bamit::Position, bamit::Position>>{{{1, 100}, {1, 110}},
+                                                                                           {{0, 500}, {0, 1500}},
+                                                                                           {{0, 0}, {1, 1000000}},
+                                                                                           {{1, 1000000}, {1, 1000001}},
+                                                                                           {{0, 1500}, {2, 300}},
+                                                                                           {{0, 0}, {2, 1000000}}})
+        {
+            for (bool const with_spans : {false, true})
+            {
+                size_t const count = bamit::extract_overlap_records(input, node_list, start, end, output,
+                                                                    Z_DEFAULT_COMPRESSION,
+                                                                    with_spans ? linear_index : bamit::LinearIndex{});
+
+                // The same records as found by seqan3 are written, with the header of the input.
+                seqan3::sam_file_input expected_file{input};
+                auto expected = bamit::get_overlap_records(expected_file, node_list, start, end);
+                EXPECT_EQ(count, expected.size());
+                seqan3::sam_file_input result{output};
+                size_t i{0};
+                for (auto & rec : result)
+                {
+                    ASSERT_LT(i, expected.size());
+                    EXPECT_EQ(rec.id(), expected[i++].id());
+                }
+                EXPECT_EQ(i, expected.size());
+                bamit::BamScanner output_scanner{output};
+                EXPECT_EQ(output_scanner.get_header_text(), input_scanner.get_header_text());
+                EXPECT_EQ(output_scanner.get_ref_lengths(), input_scanner.get_ref_lengths());
+
+                // Blocks holding only overlapping records are copied without compressing them again.
+                std::vector<std::string> const output_blocks = read_blocks(output);
+                size_t const copied = std::ranges::count_if(output_blocks, [&input_blocks] (std::string const & block)
+                {
+                    return std::ranges::find(input_blocks, block) != input_blocks.end();
+                });
+                if (std::get<0>(start) != std::get<0>(end) && (at_records || with_spans))
+                {
+                    EXPECT_GT(copied, 10u);
+                }
+            }
+        }
+    }
+    std::filesystem::remove(input);
+    std::filesystem::remove(output);
+}
@@ -0,0 +1,282 @@
+#include <gtest/gtest.h>
+
+#include <bamit/all.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+
+// The contents of a BAI or CSI index.
+struct ParsedIndex
+{
+    int32_t min_shift{14};
+    int32_t depth{5};
+    // Per reference the loffset and chunks of every bin, and the windows of the linear index.
+    std::vector<std::map<uint32_t, std::pair<uint64_t, std::vector<std::pair<uint64_t, uint64_t>>>>> bins{};
+    std::vector<std::vector<uint64_t>> windows{};
+    uint64_t no_coordinate{0};
+};
+
+std::string read_file(std::filesystem::path const & path)
+{
+    std::ifstream in{path, std::ios_base::binary};
+    return std::string{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+ParsedIndex parse_index(std::filesystem::path const & path, bool const csi)
+{
+    std::string data{};
+    if (csi)
+    {
+        bamit::BgzfReader reader{path};
+        char buffer[4096];
+        for (size_t n = reader.read(buffer, sizeof(buffer)); n > 0; n = reader.read(buffer, sizeof(buffer)))
+            data.append(buffer, n);
+    }
+    else
+    {
+        data = read_file(path);
+    }
+
+    size_t position{0};
+    auto read = [&] <typename value_type> (value_type & value)
+    {
+        EXPECT_LE(position + sizeof(value), data.size());
+        std::memcpy(&value, data.data() + position, sizeof(value));
+        position += sizeof(value);
+    };
+    ParsedIndex index{};
+    EXPECT_EQ(data.substr(0, 4), csi ? std::string{"CSI\1"} : std::string{"BAI\1"});
+    position = 4;
+    if (csi)
+    {
+        int32_t aux_length{};
+        read(index.min_shift);
+        read(index.depth);
+        read(aux_length);
+        position += aux_length;
+    }
+    int32_t ref_count{};
+    read(ref_count);
+    index.bins.resize(ref_count);
+    index.windows.resize(ref_count);
+    for (int32_t i = 0; i < ref_count; ++i)
+    {
+        int32_t bin_count{};
+        read(bin_count);
+        for (int32_t j = 0; j < bin_count; ++j)
+        {
+            uint32_t bin{};
+            uint64_t loffset{};
+            int32_t chunk_count{};
+            read(bin);
+            if (csi) read(loffset);
+            read(chunk_count);
+            auto & chunks = index.bins[i][bin];
+            chunks.first = loffset;
+            chunks.second.resize(chunk_count);
+            for (auto & [begin, end] : chunks.second)
+            {
+                read(begin);
+                read(end);
+            }
+        }
+        if (csi) continue;
+        int32_t window_count{};
+        read(window_count);
+        index.windows[i].resize(window_count);
+        for (uint64_t & offset : index.windows[i])
+            read(offset);
+    }
+    read(index.no_coordinate);
+    EXPECT_EQ(position, data.size());
+    return index;
+}
+
+// The end of a record as used by htslib.
+int64_t record_end(bamit::BamScanner const & scanner)
+{
+    int64_t const begin = scanner.get_reference_position();
+    return scanner.unmapped() ? begin + 1 : std::max<int64_t>(begin + scanner.get_length(), begin + 1);
+}
+
+// Find the records overlapping a region from the index like htslib does, returning their file positions.
+std::set<std::streamoff> query(ParsedIndex const & index, bamit::BamScanner & scanner, int32_t const ref_id,
+                               int64_t const begin, int64_t const end)
+{
+    auto const & bins = index.bins[ref_id];
+    uint64_t min_offset{0};
+    if (!index.windows[ref_id].empty())
+    {
+        auto const & windows = index.windows[ref_id];
+        min_offset = windows[std::min<size_t>(begin >> index.min_shift, windows.size() - 1)];
+    }
+    else
+    {
+        uint32_t bin = ((1u << 3 * index.depth) - 1) / 7 + (begin >> index.min_shift);
+        for (;; bin = (bin - 1) >> 3)
+        {
+            if (auto it = bins.find(bin); it != bins.end())
+            {
+                min_offset = it->second.first;
+                break;
+            }
+            if (bin == 0) break;
+        }
+    }
+
+    std::vector<std::pair<uint64_t, uint64_t>> chunks{};
+    for (int32_t level = 0; level <= index.depth; ++level)
+    {
+        int32_t const shift = index.min_shift + 3 * (index.depth - level);
+        uint32_t const first = ((1u << 3 * level) - 1) / 7;
+        for (int64_t i = begin >> shift; i <= (end - 1) >> shift; ++i)
+        {
+            if (auto it = bins.find(first + i); it != bins.end())
+            {
+                for (auto const & chunk : it->second.second)
+                    if (chunk.second > min_offset) chunks.push_back(chunk);
+            }
+        }
+    }
+
+    std::set<std::streamoff> result{};
+    for (auto const & [chunk_begin, chunk_end] : chunks)
+    {
+        scanner.seek(std::max(chunk_begin, min_offset));
+        while (static_cast<uint64_t>(scanner.tell()) < chunk_end && scanner.next())
+        {
+            if (scanner.get_reference_id() == ref_id && scanner.get_reference_position() < end &&
+                record_end(scanner) > begin) result.insert(scanner.get_file_position());
+        }
+    }
+    return result;
+}
+
+TEST(binning_index, tell_at_end)
+{
+    // At the end of the file, the position is the start of the end-of-file marker, however it was reached. The
+    // records are written to many blocks, so that the marker does not directly follow the first block.
+    std::filesystem::path const path = std::filesystem::temp_directory_path()/"tell_at_end.bam";
+    {
+        bamit::BamScanner scanner{DATADIR"simulated_mult_chr_small_golden.bam"};
+        bamit::BgzfWriter writer{path};
+        scanner.write_header(writer);
+        std::vector<char> record{};
+        for (size_t i = 0; scanner.next(record); ++i)
+        {
+            writer.write(record.data(), record.size());
+            record.clear();
+            if (i % 3 == 2) writer.flush();
+        }
+    }
+    std::streamoff const eof_marker = static_cast<std::streamoff>(std::filesystem::file_size(path) - 28) << 16;
+    {
+        bamit::BgzfReader reader{path};
+        char buffer[4096];
+        while (reader.read(buffer, sizeof(buffer)) > 0) {}
+        EXPECT_EQ(reader.tell(), eof_marker);
+    }
+    {
+        bamit::BgzfReader reader{path};
+        reader.seek(eof_marker);
+        EXPECT_TRUE(reader.at_end());
+        EXPECT_EQ(reader.tell(), eof_marker);
+    }
+    {
+        bamit::BamScanner scanner{path};
+        scanner.seek(eof_marker);
+        EXPECT_FALSE(scanner.next());
+        EXPECT_EQ(scanner.tell(), eof_marker);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(binning_index, samtools_bai)
+{
+    // The index is the one written by samtools index, also when the file is scanned in parallel.
+    for (std::string name : {"simulated_chr1_small_golden.bam", "simulated_mult_chr_small_golden.bam"})
+    {
+        std::filesystem::path input{DATADIR + name};
+        std::filesystem::path index_path{OUTPUTDIR + name + ".bai"};
+        for (uint16_t threads : {1, 4})
+        {
+            bamit::BinningIndex binning_index{bamit::BamScanner{input}.get_ref_lengths()};
+            bamit::index(input, false, threads, 0, 0, nullptr, &binning_index);
+            binning_index.write(index_path);
+            EXPECT_EQ(read_file(index_path), read_file(DATADIR + name + ".bai"));
+        }
+        std::filesystem::remove(index_path);
+    }
+}
+
+TEST(binning_index, queries)
+{
+    // Write the records into many small blocks, so that the chunks and windows point into different blocks.
+    std::filesystem::path input{OUTPUTDIR"binning_index_blocks.bam"};
+    {
+        bamit::BamScanner scanner{DATADIR"simulated_mult_chr_small_golden.bam"};
+        bamit::BgzfWriter writer{input};
+        scanner.write_header(writer);
+        std::vector<char> record{};
+        for (size_t i = 0; scanner.next(record); ++i)
+        {
+            writer.write(record.data(), record.size());
+            record.clear();
+            if (i % 3 == 2) writer.flush();
+        }
+    }
+
+    // The records every query should find.
+    bamit::BamScanner scanner{input};
+    std::vector<std::tuple<int32_t, int64_t, int64_t, std::streamoff>> records{};
+    while (scanner.next())
+    {
+        if (scanner.get_reference_id() != -1 && scanner.get_reference_position() != -1)
+            records.emplace_back(scanner.get_reference_id(), scanner.get_reference_position(), record_end(scanner),
+                                 scanner.get_file_position());
+    }
+
+    for (bool csi : {false, true})
+    {
+        std::filesystem::path index_path{input.string() + (csi ? ".csi" : ".bai")};
+        bamit::BinningIndex binning_index{scanner.get_ref_lengths(), csi, 8};
+        bamit::LinearIndex linear_index{};
+        std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input, false, 2, 0, 0,
+                                                                                   &linear_index, &binning_index);
+        // The trees do not depend on the BinningIndex.
+        std::vector<std::unique_ptr<bamit::IntervalNode>> expected_trees = bamit::index(input);
+        for (size_t i = 0; i < node_list.size(); ++i)
+            EXPECT_EQ(node_list[i]->get_subtree_count(), expected_trees[i]->get_subtree_count());
+
+        binning_index.write(index_path);
+        EXPECT_EQ(binning_index.is_csi(), csi);
+        ParsedIndex const parsed = parse_index(index_path, csi);
+        ASSERT_EQ(parsed.bins.size(), 3u);
+        EXPECT_EQ(parsed.min_shift, csi ? 8 : 14);
+
+        for (int32_t ref_id = 0; ref_id < 3; ++ref_id)
+        {
+            for (int64_t begin = 0; begin < 2200; begin += 37)
+            {
+                for (int64_t length : {1, 50, 300, 1000})
+                {
+                    std::set<std::streamoff> expected{};
+                    for (auto const & [record_ref_id, record_begin, record_end, file_position] : records)
+                    {
+                        if (record_ref_id == ref_id && record_begin < begin + length && record_end > begin)
+                            expected.insert(file_position);
+                    }
+                    EXPECT_EQ(query(parsed, scanner, ref_id, begin, begin + length), expected);
+                }
+            }
+        }
+        std::filesystem::remove(index_path);
+    }
+    std::filesystem::remove(input);
+
+    // BAI indices cannot hold long references.
+    EXPECT_THROW(bamit::BinningIndex(std::vector<uint32_t>{1u << 29}), std::runtime_error);
+    EXPECT_NO_THROW(bamit::BinningIndex(std::vector<uint32_t>{1u << 29}, true));
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include <bamit/all.hpp>
+
+#include <thread>
+
+TEST(block_cache, least_recently_used)
+{
+    bamit::BlockCache cache{100000};
+    auto block = std::make_shared<std::vector<char> const>(40000, 'x');
+    cache.insert(0, bamit::CachedBlock{block, 100});
+    cache.insert(100, bamit::CachedBlock{block, 200});
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_LE(cache.get_memory_used(), 100000u);
+
+    // Looking up the first block makes the second one the least recently used, which is dropped for the third.
+    ASSERT_TRUE(cache.find(0).has_value());
+    cache.insert(200, bamit::CachedBlock{std::make_shared<std::vector<char> const>(40000, 'y'), 300});
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_FALSE(cache.find(100).has_value());
+    EXPECT_EQ(cache.find(0)->data, block);
+    EXPECT_EQ(cache.find(200)->next_offset, 300u);
+    EXPECT_EQ(cache.get_hits(), 3u);
+    EXPECT_EQ(cache.get_misses(), 1u);
+
+    // Blocks larger than the budget are not stored.
+    cache.insert(300, bamit::CachedBlock{std::make_shared<std::vector<char> const>(200000, 'z'), 400});
+    EXPECT_FALSE(cache.find(300).has_value());
+    EXPECT_EQ(cache.size(), 2u);
+
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0u);
+    EXPECT_EQ(cache.get_memory_used(), 0u);
+}
+
+TEST(block_cache, shared_readers)
+{
+    // Write the records into many small blocks, so that queries read different blocks.
+    std::filesystem::path input{OUTPUTDIR"block_cache_blocks.bam"};
+    {
+        bamit::BamScanner scanner{DATADIR"simulated_mult_chr_small_golden.bam"};
+        bamit::BgzfWriter writer{input};
+        scanner.write_header(writer);
+        std::vector<char> record{};
+        for (size_t i = 0; scanner.next(record); ++i)
+        {
+            writer.write(record.data(), record.size());
+            record.clear();
+            if (i % 3 == 2) writer.flush();
+        }
+    }
+
+    // Reading through the cache gives the same data, a second reader decompresses nothing.
+    auto read_all = [&input] (bamit::BlockCache * cache)
+    {
+        bamit::BgzfReader reader{input, cache};
+        std::vector<char> data{};
+        char buffer[1000];
+        for (size_t n = reader.read(buffer, sizeof(buffer)); n > 0; n = reader.read(buffer, sizeof(buffer)))
+            data.insert(data.end(), buffer, buffer + n);
+        EXPECT_EQ(static_cast<uint64_t>(reader.tell()) >> 16, std::filesystem::file_size(input) - 28);
+        return data;
+    };
+    bamit::BlockCache cache{1 << 24};
+    std::vector<char> const expected = read_all(nullptr);
+    EXPECT_EQ(read_all(&cache), expected);
+    size_t const blocks = cache.size();
+    uint64_t const misses = cache.get_misses();
+    EXPECT_GT(blocks, 10u);
+    EXPECT_EQ(read_all(&cache), expected);
+    EXPECT_EQ(cache.get_misses(), misses);
+    EXPECT_GE(cache.get_hits(), blocks);
+
+    // A small budget keeps only the most recent blocks.
+    bamit::BlockCache small_cache{20000};
+    EXPECT_EQ(read_all(&small_cache), expected);
+    EXPECT_LE(small_cache.get_memory_used(), 20000u);
+    EXPECT_LT(small_cache.size(), blocks);
+
+    // Queries from several threads sharing the cache find the same records as without it.
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input);
+    std::vector<std::pair<bamit::Position, bamit::Position>> regions{};
+    for (int32_t start = 0; start < 2000; start += 23)
+    {
+        for (int32_t ref_id = 0; ref_id < 3; ++ref_id)
+            regions.push_back({{ref_id, start}, {ref_id, start + 100}});
+    }
+    auto count = [] (bamit::BamScanner & scanner, auto const & index, bamit::Position const & start,
+                     bamit::Position const & end)
+    {
+        return bamit::get_overlap_count(scanner, index, start, end);
+    };
+    bamit::BlockCache query_cache{1 << 20};
+    bamit::QueryEngine<std::unique_ptr<bamit::IntervalNode>, bamit::BamScanner> engine{input, node_list, 1};
+    bamit::QueryEngine<std::unique_ptr<bamit::IntervalNode>, bamit::BamScanner> cached_engine{input, node_list, 4,
+                                                                                               &query_cache};
+    EXPECT_EQ(cached_engine.query(regions, count), engine.query(regions, count));
+    EXPECT_GT(query_cache.get_hits(), query_cache.get_misses());
+    std::filesystem::remove(input);
+}
@@ -1,8 +1,11 @@
 #include <gtest/gtest.h>
 #include <math.h>
+#include <random>
 
 #include <bamit/all.hpp>
 
+#include "tree_test_helpers.hpp"
+
 // Recursive function to go through the tree and check the medians.
 void check_tree(std::unique_ptr<bamit::IntervalNode> const & root, int level, int pos,
                 std::vector<std::tuple<uint32_t, uint32_t>> const & expected_values)
@@ -19,17 +22,6 @@ void check_tree(std::unique_ptr<bamit::IntervalNode> const & root, int level, in
 
 }
 
-void compare_trees(std::unique_ptr<bamit::IntervalNode> const & t1, std::unique_ptr<bamit::IntervalNode> const & t2)
-{
-    if (!t1 && !t2) {return;}
-    if (!t1 || !t2) {EXPECT_EQ(1, 0);}
-
-    EXPECT_EQ(std::make_tuple(t1->get_start(), t1->get_end(), t1->get_file_position()),
-              std::make_tuple(t2->get_start(), t2->get_end(), t2->get_file_position()));
-    compare_trees(t1->get_left_node(), t2->get_left_node());
-    compare_trees(t1->get_right_node(), t2->get_right_node());
-}
-
 TEST(tree_construct, simulated_chr1_small_golden)
 {
     std::vector<std::vector<bamit::Record>> records{};
@@ -124,3 +116,316 @@ TEST(tree_construct, different_fields)
         compare_trees(node_list_default[i], node_list_minimal[i]);
     }
 }
+
+TEST(tree_construct, parallel_chromosomes)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    seqan3::sam_file_input input_file_parallel{input};
+
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list_parallel = bamit::index(input_file_parallel, false, 4);
+    ASSERT_EQ(node_list.size(), node_list_parallel.size());
+
+    for (size_t i = 0; i < node_list.size(); ++i)
+    {
+        compare_trees(node_list[i], node_list_parallel[i]);
+    }
+}
+
+TEST(tree_construct, parallel_subtrees)
+{
+    // Coordinate sorted random records with a mix of short and long reads.
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<uint32_t> distr_start(0, 100000);
+    std::uniform_int_distribution<uint32_t> distr_length(50, 5000);
+    std::vector<bamit::Record> records{};
+    for (std::streamoff i = 0; i < 20000; ++i)
+    {
+        uint32_t start = distr_start(gen);
+        records.emplace_back(start, start + distr_length(gen), 0);
+    }
+    std::sort(records.begin(), records.end(), bamit::RecordComparatorStart{});
+    for (size_t i = 0; i < records.size(); ++i)
+        records[i].file_position = i;
+    std::vector<bamit::Record> records_parallel{records};
+
+    std::unique_ptr<bamit::IntervalNode> root{};
+    std::unique_ptr<bamit::IntervalNode> root_parallel{};
+    bamit::construct_tree(root, records);
+    {
+        bamit::ThreadPool pool{4};
+        bamit::construct_tree(root_parallel, records_parallel, pool, 16);
+    }
+    compare_trees(root, root_parallel);
+
+    // A cutoff of 0 splits down to single records.
+    std::unique_ptr<bamit::IntervalNode> root_unbounded{};
+    {
+        bamit::ThreadPool pool{4};
+        bamit::construct_tree(root_unbounded, std::span{records_parallel}.first(2000), pool, 0);
+    }
+    std::unique_ptr<bamit::IntervalNode> root_serial{};
+    bamit::construct_tree(root_serial, std::span{records_parallel}.first(2000));
+    compare_trees(root_serial, root_unbounded);
+}
+
+TEST(tree_construct, compact_records)
+{
+    std::mt19937 gen(11);
+    std::uniform_int_distribution<uint32_t> distr_start(0, 100000);
+    std::uniform_int_distribution<uint32_t> distr_length(50, 5000);
+    std::uniform_int_distribution<uint32_t> distr_step(0, 2000);
+    std::vector<bamit::Record> records{};
+    for (size_t i = 0; i < 20000; ++i)
+    {
+        uint32_t start = distr_start(gen);
+        records.emplace_back(start, start + distr_length(gen), 0);
+    }
+    std::sort(records.begin(), records.end(), bamit::RecordComparatorStart{});
+
+    // File positions increase in the order of the records and cross many blocks.
+    bamit::FilePositionTable table{};
+    std::vector<bamit::CompactRecord> compact{};
+    std::streamoff file_position{(12345ll << 16) | 100};
+    for (auto & r : records)
+    {
+        file_position += distr_step(gen);
+        if ((file_position & 0xFFFF) > 60000) file_position = ((file_position >> 16) + 3000) << 16;
+        r.file_position = file_position;
+        compact.push_back(bamit::CompactRecord{r.start, r.end, table.push_back(file_position)});
+    }
+    ASSERT_EQ(table.size(), records.size());
+    for (size_t i = 0; i < records.size(); i += 101)
+        EXPECT_EQ(table[i], records[i].file_position);
+
+    std::unique_ptr<bamit::IntervalNode> root{};
+    std::unique_ptr<bamit::IntervalNode> root_compact{};
+    bamit::construct_tree(root, records);
+    bamit::construct_tree<bamit::CompactRecord>(root_compact, compact);
+    bamit::resolve_file_positions(root_compact, table);
+    compare_trees(root, root_compact);
+    EXPECT_EQ(sizeof(bamit::CompactRecord), 10u);
+    EXPECT_THROW(bamit::CompactRecord(0, 1 << 16, 0), std::runtime_error);
+
+    // The ends of records too long for 16 bits are kept in a LongRecordEnds, the other records stay compact.
+    // construct_tree reordered the records, so restore the order of the table first.
+    std::ranges::sort(records, {}, &bamit::Record::file_position);
+    bamit::LongRecordEnds long_ends{};
+    compact.clear();
+    for (uint32_t i = 0; i < records.size(); ++i)
+    {
+        if (i % 997 == 3) records[i].end = records[i].start + 70000 + i;
+        compact.push_back(bamit::CompactRecord{records[i].start, records[i].end, i, long_ends});
+    }
+    EXPECT_EQ(long_ends.size(), (records.size() + 993) / 997);
+    EXPECT_EQ(compact[3].length, bamit::CompactRecord::long_length);
+    bamit::RecordEnd const end_of{&long_ends};
+    for (uint32_t i = 0; i < records.size(); i += 7)
+        EXPECT_EQ(end_of(compact[i]), records[i].end);
+    bamit::construct_tree(root, records);
+    bamit::construct_tree<bamit::CompactRecord>(root_compact, compact, 0, end_of);
+    bamit::resolve_file_positions(root_compact, table);
+    compare_trees(root, root_compact);
+}
+
+TEST(tree_construct, long_records)
+{
+    // The ends of records too long for a CompactRecord are kept in a LongRecordEnds table, with or without a budget
+    // and threads.
+    std::mt19937 gen(5);
+    std::uniform_int_distribution<uint32_t> distr_start(0, 1000000);
+    std::uniform_int_distribution<uint32_t> distr_length(50, 5000);
+    std::vector<std::pair<uint32_t, bamit::Record>> records{};
+    for (uint32_t ref_id = 0; ref_id < 3; ++ref_id)
+    {
+        std::vector<uint32_t> starts(3000);
+        std::ranges::generate(starts, [&] { return distr_start(gen); });
+        std::ranges::sort(starts);
+        for (size_t i = 0; i < starts.size(); ++i)
+        {
+            uint32_t const length = ref_id != 1 && i % 500 == 7 ? 100000 + i : distr_length(gen);
+            records.emplace_back(ref_id, bamit::Record{starts[i], starts[i] + length,
+                                                       static_cast<std::streamoff>(records.size() * 300)});
+        }
+    }
+
+    std::vector<std::unique_ptr<bamit::IntervalNode>> expected(3);
+    for (uint32_t ref_id = 0; ref_id < 3; ++ref_id)
+    {
+        std::vector<bamit::Record> chromosome{};
+        for (auto const & [id, record] : records)
+            if (id == ref_id) chromosome.push_back(record);
+        bamit::construct_tree(expected[ref_id], chromosome);
+    }
+    for (auto [threads, budget] : {std::pair<uint16_t, size_t>{1, 0}, {2, 0}, {1, 500 * sizeof(bamit::Record)},
+                                   {2, 2000 * sizeof(bamit::Record)}})
+    {
+        bamit::IndexBuilder builder{{"a", "b", "c"}, threads, false, 0, budget};
+        for (auto const & [ref_id, record] : records)
+            builder.add(ref_id, record);
+        std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = builder.finish();
+        for (size_t i = 0; i < node_list.size(); ++i)
+            compare_trees(expected[i], node_list[i]);
+    }
+}
+
+TEST(tree_construct, calculate_median)
+{
+    std::vector<bamit::Record> records{{10, 20, 0}, {12, 100, 1}, {15, 18, 2}, {30, 40, 3}, {31, 90, 4}};
+    // Sorted starts and ends: 10 12 15 18 20 30 31 40 90 100, the middle two are 20 and 30.
+    EXPECT_EQ(bamit::calculate_median(records), 25u);
+
+    // With a sample, the median is the upper middle value of the sampled records (0, 2 and 4 with a step of 2).
+    // Sorted sampled starts and ends: 10 15 18 20 31 90.
+    std::vector<uint32_t> values{};
+    EXPECT_EQ(bamit::calculate_median(records, values, 2), 20u);
+    // Samples are not taken when there are not more records than the sample size.
+    EXPECT_EQ(bamit::calculate_median(records, values, 5), 25u);
+}
+
+TEST(tree_construct, sampled_median)
+{
+    std::filesystem::path input{DATADIR"simulated_chr1_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    seqan3::sam_file_input input_file_sampled{input};
+
+    // Trees built with approximate medians differ, but must give the same query results.
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list_sampled = bamit::index(input_file_sampled, false, 1, 4);
+    for (int32_t start = 0; start < 2100; start += 50)
+    {
+        bamit::Position query_start{0, start}, query_end{0, start + 20};
+        auto results = bamit::get_overlap_records(input_file, node_list, query_start, query_end);
+        auto results_sampled = bamit::get_overlap_records(input_file_sampled, node_list_sampled, query_start, query_end);
+        ASSERT_EQ(results.size(), results_sampled.size());
+        for (size_t i = 0; i < results.size(); ++i)
+            EXPECT_EQ(results[i].id(), results_sampled[i].id());
+    }
+}
+
+// Check that no subtree holds more than half of the records of its parent.
+void check_balance(std::unique_ptr<bamit::IntervalNode> const & node)
+{
+    if (!node) return;
+    for (auto const * child : {&node->get_left_node(), &node->get_right_node()})
+    {
+        if (!*child) continue;
+        EXPECT_LE(2 * (*child)->get_subtree_count(), node->get_subtree_count());
+        check_balance(*child);
+    }
+}
+
+TEST(tree_construct, uneven_sampled_median)
+{
+    // Every sampled record lies far to the right of all others, so the approximate medians would split unevenly.
+    std::vector<bamit::Record> records{};
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        uint32_t const start = i % 100 == 0 ? 1000000 + i : 10 * i;
+        records.emplace_back(start, start + 5, i);
+    }
+    std::unique_ptr<bamit::IntervalNode> root{};
+    bamit::construct_tree(root, records, 10);
+    EXPECT_EQ(root->get_subtree_count(), 1000u);
+    check_balance(root);
+    EXPECT_LE(bamit::FlatIntervalTree{root}.size(), 2 * records.size());
+}
+
+TEST(tree_construct, calculate_median_without_buffer)
+{
+    // Enough records for the median to be selected by counting instead of in a buffer.
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<uint32_t> distr_start(0, 250000000);
+    std::uniform_int_distribution<uint32_t> distr_length(1, 100000);
+    std::vector<bamit::Record> records{};
+    std::vector<uint32_t> values{};
+    for (std::streamoff i = 0; i < 100001; ++i)
+    {
+        uint32_t start = distr_start(gen);
+        records.emplace_back(start, start + distr_length(gen), i);
+        values.push_back(records.back().start);
+        values.push_back(records.back().end);
+    }
+    std::sort(values.begin(), values.end());
+
+    EXPECT_EQ(bamit::calculate_median(records), (values[values.size() / 2] + values[values.size() / 2 - 1]) / 2);
+}
+
+TEST(tree_construct, memory_budget)
+{
+    std::mt19937 gen(3);
+    std::uniform_int_distribution<uint32_t> distr_start(0, 1000000);
+    std::uniform_int_distribution<uint32_t> distr_length(50, 20000);
+    std::vector<bamit::Record> records{};
+    for (std::streamoff i = 0; i < 50000; ++i)
+    {
+        uint32_t start = distr_start(gen);
+        records.emplace_back(start, start + distr_length(gen), 0);
+    }
+    std::sort(records.begin(), records.end(), bamit::RecordComparatorStart{});
+    for (size_t i = 0; i < records.size(); ++i)
+        records[i].file_position = i;
+
+    // Only 1000 records fit into memory at once, so most subtrees are split in files.
+    bamit::RecordFile file{};
+    file.append(records);
+    EXPECT_EQ(file.size(), records.size());
+    std::unique_ptr<bamit::IntervalNode> root{};
+    std::unique_ptr<bamit::IntervalNode> root_file{};
+    bamit::construct_tree(root, records);
+    bamit::construct_tree(root_file, file, 1000 * sizeof(bamit::Record));
+    compare_trees(root, root_file);
+    EXPECT_EQ(file.size(), 0u);
+}
+
+TEST(tree_construct, index_memory_budget)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    seqan3::sam_file_input input_file_budget{input};
+    seqan3::sam_file_input input_file_parallel{input};
+
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list_budget = bamit::index(input_file_budget, false, 1, 0,
+                                                                                      10 * sizeof(bamit::Record));
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list_parallel = bamit::index(input_file_parallel, false, 2, 0,
+                                                                                        30 * sizeof(bamit::Record));
+    ASSERT_EQ(node_list.size(), node_list_budget.size());
+    ASSERT_EQ(node_list.size(), node_list_parallel.size());
+    for (size_t i = 0; i < node_list.size(); ++i)
+    {
+        compare_trees(node_list[i], node_list_budget[i]);
+        compare_trees(node_list[i], node_list_parallel[i]);
+    }
+}
+
+// Recursive function to check that every node counts the records of its subtree and that its records intersect the
+// median. Returns the number of records in the subtree.
+uint64_t check_counts(std::unique_ptr<bamit::IntervalNode> const & node)
+{
+    if (!node) return 0;
+    uint64_t const subtree_count = node->get_count() + check_counts(node->get_left_node()) +
+                                   check_counts(node->get_right_node());
+    EXPECT_EQ(node->get_subtree_count(), subtree_count);
+    if (node->get_count() > 0)
+    {
+        EXPECT_LE(node->get_start(), node->get_median());
+        EXPECT_GE(node->get_end(), node->get_median());
+    }
+    return subtree_count;
+}
+
+TEST(tree_construct, record_counts)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    std::vector<uint64_t> expected(node_list.size());
+    seqan3::sam_file_input count_file{input};
+    for (auto & rec : count_file)
+        if (!bamit::unmapped(rec)) ++expected[rec.reference_id().value()];
+    for (size_t i = 0; i < node_list.size(); ++i)
+        EXPECT_EQ(check_counts(node_list[i]), expected[i]);
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <bamit/all.hpp>
+
+// Recursive function to check that every node is found at its breadth-first index in the flat tree.
+void compare_layout(std::unique_ptr<bamit::IntervalNode> const & node, size_t index, bamit::FlatIntervalTree const & tree)
+{
+    if (!node)
+    {
+        EXPECT_FALSE(tree.has_node(index));
+        return;
+    }
+    ASSERT_TRUE(tree.has_node(index));
+    EXPECT_EQ(std::make_tuple(node->get_start(), node->get_end(), node->get_file_position()),
+              std::make_tuple(tree.get_start(index), tree.get_end(index), tree.get_file_position(index)));
+    compare_layout(node->get_left_node(), 2 * index + 1, tree);
+    compare_layout(node->get_right_node(), 2 * index + 2, tree);
+}
+
+TEST(flat_tree, layout)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+    std::vector<bamit::FlatIntervalTree> flat_list = bamit::flatten(node_list);
+
+    ASSERT_EQ(node_list.size(), flat_list.size());
+    for (size_t i = 0; i < node_list.size(); ++i)
+        compare_layout(node_list[i], 0, flat_list[i]);
+
+    // An empty tree has no nodes.
+    bamit::FlatIntervalTree empty{std::unique_ptr<bamit::IntervalNode>{}};
+    EXPECT_EQ(empty.size(), 0u);
+    EXPECT_FALSE(empty.has_node(0));
+}
+
+TEST(flat_tree, get_current_file_position)
+{
+    std::filesystem::path input{DATADIR"simulated_chr1_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+    std::vector<bamit::FlatIntervalTree> flat_list = bamit::flatten(node_list);
+
+    // Both layouts must give the same seek position for every query.
+    for (uint32_t start = 0; start < 2100; start += 7)
+    {
+        for (uint32_t length : {0u, 1u, 50u, 500u})
+        {
+            std::streamoff pointer_position{-1}, flat_position{-1};
+            bamit::get_current_file_position(node_list[0], start, start + length, pointer_position);
+            bamit::get_current_file_position(flat_list[0], start, start + length, flat_position);
+            EXPECT_EQ(pointer_position, flat_position);
+        }
+    }
+}
+
+TEST(flat_tree, get_overlap_records)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<bamit::FlatIntervalTree> flat_list = bamit::flatten(bamit::index(input_file));
+
+    bamit::Position start{1, 100};
+    bamit::Position end{1, 110};
+    auto results = bamit::get_overlap_records(input_file, flat_list, start, end);
+    seqan3::sam_file_input expected{DATADIR"samtools_result.sam"};
+
+    size_t i{0};
+    for (auto & rec : expected)
+    {
+        ASSERT_LT(i, results.size());
+        EXPECT_EQ(results[i++].id(), rec.id());
+    }
+    EXPECT_EQ(i, results.size());
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include <cereal/archives/binary.hpp>
+
+#include <bamit/all.hpp>
+
+#include "tree_test_helpers.hpp"
+
+#include <thread>
+
+TEST(lazy_index, load)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    std::filesystem::path index_path{OUTPUTDIR"lazy_index.bam.bit"};
+    seqan3::sam_file_input input_file{input};
+    bamit::LinearIndex linear_index{64};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file, false, 1, 0, 0,
+                                                                               &linear_index);
+    bamit::write_lazy_index(index_path, node_list, linear_index);
+    ASSERT_TRUE(bamit::is_lazy_index(index_path));
+    EXPECT_FALSE(bamit::is_mapped_index(index_path));
+
+    // Opening the index reads no tree, a query reads only the trees of its chromosomes and their windows of the
+    // LinearIndex.
+    bamit::LazyIndex lazy_index{index_path};
+    ASSERT_EQ(lazy_index.size(), node_list.size());
+    EXPECT_EQ(lazy_index.get_loaded_count(), 0u);
+    EXPECT_EQ(lazy_index.get_linear_index().get_window_size(), 64u);
+    ASSERT_FALSE(linear_index.get_offsets(1).empty());
+    EXPECT_TRUE(lazy_index.get_linear_index().get_offsets(1).empty());
+
+    bamit::Position const start{1, 100}, end{1, 400};
+    auto expected = bamit::get_overlap_records(input_file, node_list, start, end);
+    auto result = bamit::get_overlap_records(input_file, lazy_index.load(start, end), start, end, false, "",
+                                             lazy_index.get_linear_index());
+    EXPECT_EQ(lazy_index.get_loaded_count(), 1u);
+    EXPECT_EQ(lazy_index.get_linear_index().get_offsets(1), linear_index.get_offsets(1));
+    EXPECT_TRUE(lazy_index.get_linear_index().get_offsets(0).empty());
+    EXPECT_EQ(lazy_index.get_linear_index().get_span(1).begin, linear_index.get_span(1).begin);
+    EXPECT_EQ(lazy_index.get_linear_index().get_span(0).begin, -1);
+    ASSERT_EQ(result.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+        EXPECT_EQ(result[i].id(), expected[i].id());
+
+    // Loading again does not read the tree again.
+    compare_trees(lazy_index.load(1), node_list[1]);
+    EXPECT_EQ(lazy_index.get_loaded_count(), 1u);
+
+    std::vector<std::unique_ptr<bamit::IntervalNode>> const & loaded = lazy_index.load_all();
+    EXPECT_EQ(lazy_index.get_loaded_count(), node_list.size());
+    for (size_t i = 0; i < node_list.size(); ++i)
+    {
+        compare_trees(loaded[i], node_list[i]);
+        EXPECT_EQ(lazy_index.get_linear_index().get_offsets(i), linear_index.get_offsets(i));
+        bamit::ChromosomeSpan const & span = lazy_index.get_linear_index().get_span(i);
+        EXPECT_EQ(std::make_tuple(span.begin, span.end, span.mapped, span.unmapped),
+                  std::make_tuple(linear_index.get_span(i).begin, linear_index.get_span(i).end,
+                                  linear_index.get_span(i).mapped, linear_index.get_span(i).unmapped));
+    }
+    EXPECT_THROW(lazy_index.load(static_cast<int32_t>(node_list.size())), std::out_of_range);
+    std::filesystem::remove(index_path);
+}
+
+TEST(lazy_index, concurrent_load)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    std::filesystem::path index_path{OUTPUTDIR"lazy_index_concurrent.bam.bit"};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input);
+    bamit::write_lazy_index(index_path, node_list, bamit::LinearIndex{});
+
+    // Every thread queries every chromosome, each tree is still read once.
+    bamit::LazyIndex lazy_index{index_path};
+    std::vector<std::vector<bamit::OverlapCount>> counts(4);
+    std::vector<std::thread> threads{};
+    for (size_t t = 0; t < counts.size(); ++t)
+    {
+        threads.emplace_back([&lazy_index, &counts, t, size = node_list.size()] ()
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                int32_t const ref_id = (i + t) % size;
+                bamit::Position const start{ref_id, 0}, end{ref_id, 1000};
+                counts[t].push_back(bamit::get_overlap_count_bounds(lazy_index.load(start, end), start, end));
+            }
+        });
+    }
+    for (std::thread & thread : threads)
+        thread.join();
+    EXPECT_EQ(lazy_index.get_loaded_count(), node_list.size());
+    for (size_t t = 0; t < counts.size(); ++t)
+    {
+        for (size_t i = 0; i < node_list.size(); ++i)
+        {
+            int32_t const ref_id = (i + t) % node_list.size();
+            bamit::OverlapCount const expected = bamit::get_overlap_count_bounds(node_list, {ref_id, 0}, {ref_id, 1000});
+            EXPECT_EQ(std::make_pair(counts[t][i].lower, counts[t][i].upper), std::make_pair(expected.lower, expected.upper));
+        }
+    }
+    std::filesystem::remove(index_path);
+}
+
+TEST(lazy_index, invalid_files)
+{
+    std::filesystem::path index_path{OUTPUTDIR"not_lazy.bam.bit"};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(DATADIR"simulated_mult_chr_small_golden.bam");
+
+    // Index files written by bamit::write have no offset table.
+    {
+        std::ofstream out{index_path, std::ios_base::binary | std::ios_base::out};
+        cereal::BinaryOutputArchive archive{out};
+        bamit::write(node_list, archive);
+    }
+    EXPECT_FALSE(bamit::is_lazy_index(index_path));
+    EXPECT_THROW(bamit::LazyIndex{index_path}, std::runtime_error);
+
+    // Files of older versions, which stored the LinearIndex as a whole, are rejected.
+    {
+        std::ofstream out{index_path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc};
+        out.write(bamit::lazy_index_magic.data(), bamit::lazy_index_magic.size());
+        cereal::BinaryOutputArchive archive{out};
+        archive(uint32_t{2}, std::vector<uint64_t>(node_list.size() + 1, 16), bamit::LinearIndex{});
+    }
+    EXPECT_TRUE(bamit::is_lazy_index(index_path));
+    EXPECT_THROW(bamit::LazyIndex{index_path}, std::runtime_error);
+
+    // A truncated file is rejected when it is opened.
+    bamit::write_lazy_index(index_path, node_list, bamit::LinearIndex{});
+    std::filesystem::resize_file(index_path, std::filesystem::file_size(index_path) - 1);
+    EXPECT_TRUE(bamit::is_lazy_index(index_path));
+    EXPECT_THROW(bamit::LazyIndex{index_path}, std::runtime_error);
+    std::filesystem::remove(index_path);
+    EXPECT_THROW(bamit::LazyIndex{index_path}, std::runtime_error);
+}
@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include <cereal/archives/binary.hpp>
+
+#include <bamit/all.hpp>
+
+#include <sstream>
+
+TEST(linear_index, add_and_cap)
+{
+    bamit::LinearIndex linear_index{10};
+    // A long record followed by short ones: windows 0 to 5 start at the long record.
+    linear_index.add(0, bamit::Record{2, 55, 100});
+    linear_index.add(0, bamit::Record{4, 8, 200});
+    linear_index.add(0, bamit::Record{30, 72, 300});
+    linear_index.add(2, bamit::Record{15, 20, 400});
+
+    EXPECT_EQ(linear_index.get_offsets(0), (std::vector<std::streamoff>{100, 100, 100, 100, 100, 100, 300, 300}));
+    EXPECT_TRUE(linear_index.get_offsets(1).empty());
+    EXPECT_EQ(linear_index.get_offsets(2), (std::vector<std::streamoff>{400, 400, 400}));
+    EXPECT_TRUE(linear_index.get_offsets(3).empty());
+
+    std::streamoff file_position{150};
+    linear_index.cap(bamit::Position{0, 65}, file_position);
+    EXPECT_EQ(file_position, 300);
+    // A position right of the window is kept.
+    file_position = 350;
+    linear_index.cap(bamit::Position{0, 65}, file_position);
+    EXPECT_EQ(file_position, 350);
+    // Positions after the last record, chromosomes without records and -1 are left as they are.
+    file_position = 150;
+    linear_index.cap(bamit::Position{0, 80}, file_position);
+    linear_index.cap(bamit::Position{1, 0}, file_position);
+    linear_index.cap(bamit::Position{5, 0}, file_position);
+    EXPECT_EQ(file_position, 150);
+    file_position = -1;
+    linear_index.cap(bamit::Position{0, 65}, file_position);
+    EXPECT_EQ(file_position, -1);
+
+    EXPECT_THROW(bamit::LinearIndex{0}, std::invalid_argument);
+    EXPECT_THROW((bamit::LinearIndex{0, {{100}}}), std::invalid_argument);
+}
+
+TEST(linear_index, spans)
+{
+    bamit::LinearIndex linear_index{10};
+    linear_index.add(0, bamit::Record{2, 55, 100});
+    linear_index.add(0, bamit::Record{4, 8, 200});
+    linear_index.add_unmapped(2, 300);
+    linear_index.add(2, bamit::Record{15, 20, 400});
+
+    bamit::ChromosomeSpan span = linear_index.get_span(0);
+    EXPECT_EQ(span.begin, 100);
+    EXPECT_EQ(span.end, 300);
+    EXPECT_EQ(span.mapped, 2u);
+    EXPECT_EQ(span.unmapped, 0u);
+    EXPECT_EQ(linear_index.get_span(1).begin, -1);
+    EXPECT_EQ(linear_index.get_span(1).mapped, 0u);
+    // The end of the last chromosome is known once the records after it were seen.
+    EXPECT_EQ(linear_index.get_span(2).end, -1);
+    linear_index.add_unmapped(std::numeric_limits<uint32_t>::max(), 500);
+    linear_index.finish(600);
+    span = linear_index.get_span(2);
+    EXPECT_EQ(span.begin, 300);
+    EXPECT_EQ(span.end, 500);
+    EXPECT_EQ(span.mapped, 1u);
+    EXPECT_EQ(span.unmapped, 1u);
+    EXPECT_EQ(linear_index.get_span(5).begin, -1);
+
+    EXPECT_THROW(linear_index.set_span(3, span), std::out_of_range);
+    linear_index.set_span(1, span);
+    EXPECT_EQ(linear_index.get_span(1).end, 500);
+}
+
+TEST(linear_index, simulated_mult_chr_small_golden)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    bamit::LinearIndex linear_index{64};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file, false, 1, 0, 0,
+                                                                               &linear_index);
+
+    // Scanning the BAM file directly gives the same LinearIndex.
+    bamit::LinearIndex bam_linear_index{64};
+    bamit::index(input, false, 2, 0, 0, &bam_linear_index);
+    for (uint32_t i = 0; i < node_list.size(); ++i)
+        EXPECT_EQ(linear_index.get_offsets(i), bam_linear_index.get_offsets(i));
+
+    // The spans hold the records of every chromosome. Only the scan of the BAM file knows the end of the last one.
+    bamit::BamScanner scanner{input};
+    std::vector<bamit::ChromosomeSpan> expected_spans(node_list.size());
+    int32_t previous{-1};
+    while (scanner.next())
+    {
+        int32_t const ref_id = scanner.get_reference_id();
+        if (ref_id != previous && previous != -1) expected_spans[previous].end = scanner.get_file_position();
+        previous = ref_id;
+        if (ref_id == -1) continue;
+        bamit::ChromosomeSpan & span = expected_spans[ref_id];
+        if (span.begin == -1) span.begin = scanner.get_file_position();
+        ++(scanner.unmapped() ? span.unmapped : span.mapped);
+    }
+    if (previous != -1) expected_spans[previous].end = scanner.get_file_position();
+    for (uint32_t i = 0; i < node_list.size(); ++i)
+    {
+        for (bamit::LinearIndex const * index : {&linear_index, &bam_linear_index})
+        {
+            bamit::ChromosomeSpan const & span = index->get_span(i);
+            EXPECT_EQ(span.begin, expected_spans[i].begin);
+            EXPECT_EQ(span.mapped, expected_spans[i].mapped);
+            EXPECT_EQ(span.unmapped, expected_spans[i].unmapped);
+            if (index == &bam_linear_index || static_cast<int32_t>(i) != previous)
+            {
+                EXPECT_EQ(span.end, expected_spans[i].end);
+            }
+        }
+    }
+    EXPECT_GT(expected_spans[0].mapped, 0u);
+
+    size_t moved{0};
+    for (int32_t start = 0; start < 2100; start += 37)
+    {
+        for (int32_t length : {0, 10, 300})
+        {
+            bamit::Position const query_start{1, start}, query_end{1, start + length};
+            std::streamoff tree_position{-1}, capped_position{-1};
+            bamit::get_tree_file_position(node_list, query_start, query_end, tree_position);
+            bamit::get_tree_file_position(node_list, query_start, query_end, capped_position, linear_index);
+            EXPECT_GE(capped_position, tree_position);
+            moved += capped_position > tree_position;
+
+            // The first overlapping record and the records found do not change.
+            std::streamoff expected{-1}, result{-1};
+            bamit::get_overlap_file_position(input_file, node_list, query_start, query_end, expected);
+            bamit::get_overlap_file_position(input_file, node_list, query_start, query_end, result, linear_index);
+            EXPECT_EQ(result, expected);
+            EXPECT_LE(capped_position, result);
+
+            size_t const record_count = bamit::get_overlap_records(input_file, node_list, query_start, query_end,
+                                                                   false, "", linear_index).size();
+            EXPECT_EQ(record_count, bamit::get_overlap_records(input_file, node_list, query_start, query_end).size());
+            EXPECT_EQ(bamit::get_overlap_count(scanner, node_list, query_start, query_end, linear_index), record_count);
+        }
+    }
+    EXPECT_GT(moved, 0u);
+
+    // The LinearIndex is stored after the trees.
+    std::stringstream stream{};
+    {
+        cereal::BinaryOutputArchive archive{stream};
+        bamit::write(node_list, linear_index, archive);
+    }
+    std::vector<std::unique_ptr<bamit::IntervalNode>> read_node_list{};
+    bamit::LinearIndex read_linear_index{};
+    {
+        cereal::BinaryInputArchive archive{stream};
+        bamit::read(read_node_list, read_linear_index, archive);
+    }
+    EXPECT_EQ(read_node_list.size(), node_list.size());
+    EXPECT_EQ(read_linear_index.get_window_size(), 64u);
+    for (uint32_t i = 0; i < node_list.size(); ++i)
+        EXPECT_EQ(read_linear_index.get_offsets(i), linear_index.get_offsets(i));
+}
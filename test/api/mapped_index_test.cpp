@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include <cereal/archives/binary.hpp>
+
+#include <bamit/all.hpp>
+
+TEST(mapped_index, layout)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    std::filesystem::path index_path{OUTPUTDIR"mapped_index.bam.bit"};
+    bamit::LinearIndex linear_index{64};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input, false, 1, 0, 0, &linear_index);
+    bamit::write_mapped_index(index_path, node_list, linear_index);
+    ASSERT_TRUE(bamit::is_mapped_index(index_path));
+
+    bamit::MappedIndex const mapped_index{index_path};
+    std::vector<bamit::FlatIntervalTree> const flat_list = bamit::flatten(node_list);
+    ASSERT_EQ(mapped_index.get_trees().size(), flat_list.size());
+    for (size_t i = 0; i < flat_list.size(); ++i)
+    {
+        bamit::MappedIntervalTree const & tree = mapped_index.get_trees()[i];
+        ASSERT_EQ(tree.size(), flat_list[i].size());
+        for (size_t j = 0; j < tree.size(); ++j)
+        {
+            ASSERT_EQ(tree.has_node(j), flat_list[i].has_node(j));
+            if (!tree.has_node(j)) continue;
+            EXPECT_EQ(std::make_tuple(tree.get_start(j), tree.get_end(j), tree.get_file_position(j)),
+                      std::make_tuple(flat_list[i].get_start(j), flat_list[i].get_end(j),
+                                      flat_list[i].get_file_position(j)));
+        }
+        EXPECT_EQ(mapped_index.get_linear_index().get_offsets(i), linear_index.get_offsets(i));
+        bamit::ChromosomeSpan const & span = mapped_index.get_linear_index().get_span(i);
+        bamit::ChromosomeSpan const & expected_span = linear_index.get_span(i);
+        EXPECT_EQ(std::make_tuple(span.begin, span.end, span.mapped, span.unmapped),
+                  std::make_tuple(expected_span.begin, expected_span.end, expected_span.mapped,
+                                  expected_span.unmapped));
+    }
+    EXPECT_EQ(mapped_index.get_linear_index().get_window_size(), 64u);
+    std::filesystem::remove(index_path);
+}
+
+TEST(mapped_index, get_overlap_records)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    std::filesystem::path index_path{OUTPUTDIR"mapped_index_search.bam.bit"};
+    seqan3::sam_file_input input_file{input};
+    bamit::LinearIndex linear_index{};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file, false, 1, 0, 0,
+                                                                               &linear_index);
+    bamit::write_mapped_index(index_path, node_list, linear_index);
+    bamit::MappedIndex mapped_index{index_path};
+
+    bamit::BamScanner scanner{input};
+    for (int32_t start = 0; start < 2100; start += 61)
+    {
+        for (auto [query_start, query_end] : {std::pair{bamit::Position{1, start}, bamit::Position{1, start + 50}},
+                                              std::pair{bamit::Position{0, start}, bamit::Position{2, start}}})
+        {
+            auto expected = bamit::get_overlap_records(input_file, node_list, query_start, query_end);
+            auto result = bamit::get_overlap_records(input_file, mapped_index.get_trees(), query_start, query_end,
+                                                     false, "", mapped_index.get_linear_index());
+            ASSERT_EQ(result.size(), expected.size());
+            for (size_t i = 0; i < expected.size(); ++i)
+                EXPECT_EQ(result[i].id(), expected[i].id());
+            EXPECT_EQ(bamit::get_overlap_count(scanner, mapped_index.get_trees(), query_start, query_end),
+                      expected.size());
+        }
+    }
+
+    // The mapping stays valid when the MappedIndex is moved.
+    bamit::MappedIndex moved{std::move(mapped_index)};
+    EXPECT_EQ(moved.get_trees().size(), node_list.size());
+    std::filesystem::remove(index_path);
+}
+
+TEST(mapped_index, invalid_files)
+{
+    std::filesystem::path index_path{OUTPUTDIR"not_mapped.bam.bit"};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(DATADIR"simulated_mult_chr_small_golden.bam");
+
+    // Index files written by bamit::write are not mapped.
+    {
+        std::ofstream out{index_path, std::ios_base::binary | std::ios_base::out};
+        cereal::BinaryOutputArchive archive{out};
+        bamit::write(node_list, archive);
+    }
+    EXPECT_FALSE(bamit::is_mapped_index(index_path));
+    EXPECT_THROW(bamit::MappedIndex{index_path}, std::runtime_error);
+
+    // A truncated file is rejected.
+    bamit::write_mapped_index(index_path, node_list, bamit::LinearIndex{});
+    std::filesystem::resize_file(index_path, std::filesystem::file_size(index_path) / 2);
+    EXPECT_TRUE(bamit::is_mapped_index(index_path));
+    EXPECT_THROW(bamit::MappedIndex{index_path}, std::runtime_error);
+    std::filesystem::remove(index_path);
+    EXPECT_THROW(bamit::MappedIndex{index_path}, std::runtime_error);
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <bamit/all.hpp>
+
+#include <cstring>
+
+// Get the names of the records stored one after the other in BAM encoding.
+std::vector<std::string> record_names(std::vector<char> const & records)
+{
+    std::vector<std::string> names{};
+    for (size_t i = 0; i < records.size();)
+    {
+        int32_t block_size{};
+        std::memcpy(&block_size, records.data() + i, 4);
+        names.emplace_back(records.data() + i + 36);
+        i += 4 + block_size;
+    }
+    return names;
+}
+
+TEST(query_cache, least_recently_used)
+{
+    bamit::QueryCache cache{1000};
+    auto records = std::make_shared<std::vector<char> const>(300, 'x');
+    cache.insert({{0, 0}, {0, 10}}, bamit::CachedQuery{10, records, 1});
+    cache.insert({{0, 10}, {0, 20}}, bamit::CachedQuery{20, records, 1});
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_LE(cache.get_memory_used(), 1000u);
+
+    // Looking up the first query makes the second one the least recently used, which is dropped for the third.
+    auto with_records = [] (bamit::CachedQuery const & query) { return query.records != nullptr; };
+    ASSERT_TRUE(cache.find({{0, 0}, {0, 10}}, with_records).has_value());
+    cache.insert({{0, 20}, {0, 30}}, bamit::CachedQuery{30, records, 1});
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_FALSE(cache.find({{0, 10}, {0, 20}}).has_value());
+    EXPECT_EQ(cache.find({{0, 0}, {0, 10}})->file_position, 10);
+    EXPECT_EQ(cache.find({{0, 20}, {0, 30}})->records, records);
+    EXPECT_EQ(cache.get_hits(), 3u);
+    EXPECT_EQ(cache.get_misses(), 1u);
+
+    // Entries larger than the budget are not stored. An entry without records is a miss if records are needed.
+    cache.insert({{1, 0}, {1, 10}}, bamit::CachedQuery{40, std::make_shared<std::vector<char> const>(2000, 'x'), 1});
+    EXPECT_FALSE(cache.find({{1, 0}, {1, 10}}).has_value());
+    cache.insert({{1, 0}, {1, 10}}, bamit::CachedQuery{40});
+    std::optional<bamit::CachedQuery> entry = cache.find({{1, 0}, {1, 10}}, with_records);
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->file_position, 40);
+    EXPECT_EQ(entry->records, nullptr);
+    EXPECT_EQ(cache.get_misses(), 3u);
+
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0u);
+    EXPECT_EQ(cache.get_memory_used(), 0u);
+}
+
+TEST(query_cache, simulated_mult_chr_small_golden)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    std::vector<std::pair<bamit::Position, bamit::Position>> regions{};
+    for (int32_t start = 0; start < 2000; start += 97)
+    {
+        regions.push_back({{1, start}, {1, start + 60}});
+        regions.push_back({{0, start}, {0, start}});
+    }
+    regions.push_back({{0, 1900}, {2, 30}});
+
+    bamit::QueryCache cache{1 << 20};
+    bamit::BamScanner scanner{input};
+    for (auto const & [start, end] : regions)
+    {
+        // Positions found before are reused for the records.
+        std::streamoff file_position{-1};
+        bamit::get_overlap_file_position(input_file, node_list, start, end, file_position, cache);
+        bamit::CachedQuery const result = bamit::get_overlap_record_data(scanner, node_list, start, end, cache);
+        EXPECT_EQ(result.file_position, file_position);
+
+        std::vector<std::string> expected{};
+        for (auto & record : bamit::get_overlap_records(input_file, node_list, start, end))
+            expected.push_back(record.id());
+        ASSERT_NE(result.records, nullptr);
+        EXPECT_EQ(result.record_count, expected.size());
+        EXPECT_EQ(record_names(*result.records), expected);
+    }
+    EXPECT_EQ(cache.get_hits(), 0u);
+    EXPECT_EQ(cache.get_misses(), 2 * regions.size());
+
+    // Repeated queries from several threads are answered from the cache.
+    bamit::QueryEngine<std::unique_ptr<bamit::IntervalNode>, bamit::BamScanner> engine{input, node_list, 4};
+    std::vector<std::pair<bamit::Position, bamit::Position>> repeated{};
+    for (size_t i = 0; i < 10; ++i)
+        repeated.insert(repeated.end(), regions.begin(), regions.end());
+    auto results = engine.query(repeated, [&cache] (bamit::BamScanner & handle, auto const & index,
+                                                    bamit::Position const & start, bamit::Position const & end)
+    {
+        return bamit::get_overlap_record_data(handle, index, start, end, cache);
+    });
+    for (size_t i = 0; i < repeated.size(); ++i)
+        EXPECT_EQ(results[i].records, results[i % regions.size()].records);
+    EXPECT_EQ(cache.get_hits(), repeated.size());
+
+    // With records too large for the budget, only the file position of a query is kept.
+    bamit::QueryCache small_cache{300};
+    auto const & [start, end] = regions.back();
+    bamit::CachedQuery const result = bamit::get_overlap_record_data(scanner, node_list, start, end, small_cache);
+    ASSERT_GT(bamit::QueryCache::entry_size(result), small_cache.get_memory_budget());
+    std::optional<bamit::CachedQuery> const entry = small_cache.find({start, end});
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->file_position, result.file_position);
+    EXPECT_EQ(entry->records, nullptr);
+}
@@ -13,3 +13,28 @@ TEST(sample_functions_test, sample_read_depth_test)
     EXPECT_NO_THROW(result = bamit::sample_read_depth(input_file, node_list, 9));
     EXPECT_THROW(result = bamit::sample_read_depth(input_file, node_list, 1), std::invalid_argument);
 }
+
+TEST(sample_functions_test, sample_read_depth_parallel_test)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    // The same seed samples the same positions, whatever the number of threads.
+    seqan3::sam_file_input sequential_file{input};
+    bamit::EstimationResult expected = bamit::sample_read_depth(sequential_file, node_list, 200, 7);
+    for (size_t threads : {1u, 4u})
+    {
+        bamit::EstimationResult result = bamit::sample_read_depth(input, node_list, 200, 7, threads);
+        EXPECT_EQ(std::make_tuple(result.mean, result.median, result.mode, result.variance),
+                  std::make_tuple(expected.mean, expected.median, expected.mode, expected.variance));
+    }
+
+    // Threads sharing a cache of decompressed blocks get the same result.
+    bamit::BlockCache cache{1 << 20};
+    bamit::EstimationResult result = bamit::sample_read_depth(input, node_list, 200, 7, 4, &cache);
+    EXPECT_EQ(std::make_tuple(result.mean, result.median, result.mode, result.variance),
+              std::make_tuple(expected.mean, expected.median, expected.mode, expected.variance));
+    EXPECT_GT(cache.get_hits(), 0u);
+    EXPECT_THROW(bamit::sample_read_depth(input, node_list, 1), std::invalid_argument);
+}
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 #include <math.h>
 
+#include <set>
+
 #include <seqan3/test/expect_range_eq.hpp>
 
 #include <bamit/all.hpp>
@@ -43,3 +45,291 @@ TEST(get_overlap_records, simulated_chr1_small_golden)
      // std::filesystem::remove(result_sam_path);
      std::filesystem::remove(input.replace_extension("bam.bit"));
 }
+
+TEST(get_batch_overlap_records, simulated_mult_chr_small_golden)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    // Overlapping, adjacent, nested, repeated, point and multi-chromosome queries, in no particular order.
+    std::vector<std::pair<bamit::Position, bamit::Position>> regions{{{1, 100}, {1, 110}},
+                                                                     {{0, 500}, {0, 900}},
+                                                                     {{0, 0}, {0, 50}},
+                                                                     {{0, 50}, {0, 120}},
+                                                                     {{0, 600}, {0, 650}},
+                                                                     {{1, 100}, {1, 110}},
+                                                                     {{0, 1500}, {1, 20}},
+                                                                     {{1, 300}, {1, 300}},
+                                                                     {{0, 2000}, {0, 2050}},
+                                                                     {{1, 1000}, {1, 1800}}};
+    std::vector<std::vector<std::string>> batch_ids(regions.size());
+    std::vector<std::string> file_order{};
+    seqan3::sam_file_input batch_file{input};
+    bamit::get_batch_overlap_records(batch_file, node_list, regions,
+                                     [&](auto const & record, std::vector<size_t> const & indices)
+    {
+        file_order.push_back(record.id());
+        for (size_t index : indices)
+            batch_ids[index].push_back(record.id());
+    });
+
+    // Every query gets the same records as when searched on its own.
+    std::set<std::string> all_ids{};
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        seqan3::sam_file_input single_file{input};
+        std::vector<std::string> expected{};
+        for (auto & rec : bamit::get_overlap_records(single_file, node_list, regions[i].first, regions[i].second))
+            expected.push_back(rec.id());
+        EXPECT_EQ(batch_ids[i], expected) << "query " << i;
+        all_ids.insert(expected.begin(), expected.end());
+    }
+
+    // Every record overlapping any query is reported once.
+    EXPECT_EQ(file_order.size(), all_ids.size());
+    EXPECT_EQ(std::set<std::string>(file_order.begin(), file_order.end()), all_ids);
+}
+
+TEST(query_engine, simulated_mult_chr_small_golden)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    std::vector<std::pair<bamit::Position, bamit::Position>> regions{};
+    for (int32_t start = 0; start < 2000; start += 37)
+    {
+        regions.push_back({{1, start}, {1, start + 60}});
+        regions.push_back({{0, start}, {0, start}});
+    }
+    regions.push_back({{0, 1900}, {1, 30}});
+
+    // The handles are opened with one decompression thread each, and the global setting is left as it was.
+    auto const thread_count = seqan3::contrib::bgzf_thread_count;
+    seqan3::contrib::bgzf_thread_count = 3;
+    bamit::QueryEngine engine{input, node_list, 4};
+    EXPECT_EQ(seqan3::contrib::bgzf_thread_count, 3u);
+    seqan3::contrib::bgzf_thread_count = thread_count;
+    EXPECT_EQ(engine.size(), 4u);
+    auto results = engine.get_overlap_records(regions);
+
+    // Results are in the order of the queries and match querying one at a time.
+    ASSERT_EQ(results.size(), regions.size());
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        seqan3::sam_file_input single_file{input};
+        auto expected = bamit::get_overlap_records(single_file, node_list, regions[i].first, regions[i].second);
+        ASSERT_EQ(results[i].size(), expected.size()) << "query " << i;
+        for (size_t j = 0; j < expected.size(); ++j)
+            EXPECT_EQ(results[i][j].id(), expected[j].id());
+    }
+
+    // Exceptions thrown by a query are passed on.
+    EXPECT_THROW(engine.query(regions, [] (auto &, auto const &, bamit::Position const &, bamit::Position const &)
+                 {
+                     throw std::runtime_error{"query failed"};
+                     return 0;
+                 }), std::runtime_error);
+}
+
+TEST(get_overlap_range, simulated_mult_chr_small_golden)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    // The records are read one at a time while iterating.
+    seqan3::sam_file_input range_file{input};
+    seqan3::sam_file_input expected{DATADIR"samtools_result.sam"};
+    auto it_expected = expected.begin();
+    for (auto & rec : bamit::get_overlap_range(range_file, node_list, bamit::Position{1, 100}, bamit::Position{1, 110}))
+    {
+        ASSERT_NE(it_expected, expected.end());
+        EXPECT_EQ(rec.id(), (*it_expected).id());
+        ++it_expected;
+    }
+    EXPECT_EQ(it_expected, expected.end());
+
+    // A query until the end of the last chromosome stops at the end of the file.
+    bamit::Position start{0, 1000};
+    bamit::Position end{1, std::numeric_limits<int32_t>::max()};
+    seqan3::sam_file_input count_file{input};
+    seqan3::sam_file_input records_file{input};
+    EXPECT_EQ(static_cast<size_t>(std::ranges::distance(bamit::get_overlap_range(count_file, node_list, start, end))),
+              bamit::get_overlap_records(records_file, node_list, start, end).size());
+}
+
+TEST(get_overlap_count, simulated_mult_chr_small_golden)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    // The same scanner is used for all queries, in no particular order.
+    bamit::BamScanner scanner{input};
+    for (int32_t start = 2000; start >= 0; start -= 53)
+    {
+        for (auto [query_start, query_end] : {std::pair{bamit::Position{0, start}, bamit::Position{0, start}},
+                                              std::pair{bamit::Position{1, start}, bamit::Position{1, start + 100}},
+                                              std::pair{bamit::Position{0, start}, bamit::Position{1, start}}})
+        {
+            seqan3::sam_file_input records_file{input};
+            EXPECT_EQ(bamit::get_overlap_count(scanner, node_list, query_start, query_end),
+                      bamit::get_overlap_records(records_file, node_list, query_start, query_end).size());
+        }
+    }
+}
+
+TEST(get_overlap_count_bounds, simulated_mult_chr_small_golden)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    for (int32_t start = 0; start < 2100; start += 41)
+    {
+        for (int32_t length : {0, 10, 300, 1500})
+        {
+            for (auto [query_start, query_end] : {std::pair{bamit::Position{1, start}, bamit::Position{1, start + length}},
+                                                  std::pair{bamit::Position{0, start}, bamit::Position{1, length}}})
+            {
+                seqan3::sam_file_input records_file{input};
+                size_t const expected = bamit::get_overlap_records(records_file, node_list, query_start, query_end).size();
+                bamit::OverlapCount bounds = bamit::get_overlap_count_bounds(node_list, query_start, query_end);
+                EXPECT_LE(bounds.lower, expected);
+                EXPECT_GE(bounds.upper, expected);
+            }
+        }
+    }
+
+    // Queries spanning whole chromosomes are answered exactly.
+    bamit::OverlapCount all = bamit::get_overlap_count_bounds(node_list, bamit::Position{0, 0},
+                                                             bamit::Position{2, std::numeric_limits<int32_t>::max()});
+    EXPECT_EQ(all.lower, all.upper);
+    EXPECT_EQ(all.lower, node_list[0]->get_subtree_count() + node_list[1]->get_subtree_count() +
+                         node_list[2]->get_subtree_count());
+}
+
+TEST(get_overlap_chunks, simulated_mult_chr_small_golden)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    bamit::LinearIndex linear_index{64};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file, false, 1, 0, 0,
+                                                                               &linear_index);
+
+    for (int32_t start = 0; start < 2100; start += 41)
+    {
+        for (int32_t length : {0, 10, 300, 1500})
+        {
+            for (auto [query_start, query_end] : {std::pair{bamit::Position{1, start}, bamit::Position{1, start + length}},
+                                                  std::pair{bamit::Position{0, start}, bamit::Position{2, length}}})
+            {
+                std::vector<std::string> expected{};
+                for (auto & record : bamit::get_overlap_records(input_file, node_list, query_start, query_end))
+                    expected.push_back(record.id());
+
+                for (bamit::LinearIndex const & linear : {bamit::LinearIndex{}, linear_index})
+                {
+                    std::vector<bamit::Chunk> chunks = bamit::get_overlap_chunks(node_list, query_start, query_end,
+                                                                                 linear);
+                    // The chunks are sorted and disjoint.
+                    for (size_t i = 0; i < chunks.size(); ++i)
+                    {
+                        EXPECT_LE(chunks[i].begin, chunks[i].end);
+                        if (i > 0)
+                        {
+                            EXPECT_LT(chunks[i - 1].end, chunks[i].begin);
+                        }
+                    }
+
+                    std::vector<std::string> result{};
+                    bamit::read_overlap_chunks(input_file, chunks, query_start, query_end,
+                                               [&result] (auto const & record) { result.push_back(record.id()); });
+                    EXPECT_EQ(result, expected);
+                }
+            }
+        }
+    }
+}
+
+TEST(get_overlap_chunks, sam_file)
+{
+    // The file positions of a SAM file are plain offsets, so chunks are only merged if they overlap.
+    std::filesystem::path sam_path = std::filesystem::temp_directory_path()/"overlap_chunks.sam";
+    {
+        seqan3::sam_file_input bam_file{std::filesystem::path{DATADIR"simulated_mult_chr_small_golden.bam"}};
+        seqan3::sam_file_output sam_file{sam_path, bam_file.header().ref_ids(), bam_file.header().ref_id_info
+                                                                                 | std::views::elements<0>};
+        for (auto & record : bam_file)
+            sam_file.push_back(record);
+    }
+    seqan3::sam_file_input input_file{sam_path};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    for (int32_t start = 0; start < 2100; start += 97)
+    {
+        for (auto [query_start, query_end] : {std::pair{bamit::Position{1, start}, bamit::Position{1, start + 50}},
+                                              std::pair{bamit::Position{0, start}, bamit::Position{2, 300}}})
+        {
+            std::vector<std::string> expected{};
+            for (auto & record : bamit::get_overlap_records(input_file, node_list, query_start, query_end))
+                expected.push_back(record.id());
+            std::vector<bamit::Chunk> chunks = bamit::get_overlap_chunks(node_list, query_start, query_end);
+            std::vector<std::string> result{};
+            bamit::read_overlap_chunks(input_file, chunks, query_start, query_end,
+                                       [&result] (auto const & record) { result.push_back(record.id()); });
+            EXPECT_EQ(result, expected);
+
+            // The chunks span the chunks of the nodes and nothing else.
+            std::vector<bamit::Chunk> node_chunks{};
+            for (int32_t i = std::get<0>(query_start); i <= std::get<0>(query_end); ++i)
+            {
+                auto const [lo, hi] = bamit::chromosome_query(i, query_start, query_end);
+                bamit::collect_overlap_chunks(node_list[i].get(), lo, hi, node_chunks);
+            }
+            std::ranges::sort(node_chunks, {}, &bamit::Chunk::begin);
+            for (bamit::Chunk const & chunk : chunks)
+            {
+                std::streamoff covered_until{chunk.begin};
+                for (bamit::Chunk const & node_chunk : node_chunks)
+                    if (node_chunk.begin <= covered_until && node_chunk.end >= covered_until)
+                        covered_until = std::max(covered_until, node_chunk.end);
+                EXPECT_EQ(covered_until, chunk.end);
+            }
+        }
+    }
+    std::filesystem::remove(sam_path);
+}
+
+TEST(get_overlap_range, chromosome_spans)
+{
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input input_file{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input_file);
+
+    for (auto [start, end] : std::vector<std::pair<bamit::Position, bamit::Position>>{{{0, 0}, {2, 1000000}},
+                                                                                       {{0, 0}, {1, 0}},
+                                                                                       {{0, 1500}, {2, 300}},
+                                                                                       {{1, 0}, {2, 1}},
+                                                                                       {{0, 2000}, {1, 1000000}}})
+    {
+        // Compare with checking the start and end of every record of the file.
+        std::vector<std::string> expected{};
+        seqan3::sam_file_input all_records{input};
+        for (auto & rec : all_records)
+        {
+            if (bamit::unmapped(rec)) continue;
+            bamit::Position const record_start{rec.reference_id().value(), rec.reference_position().value()};
+            bamit::Position const record_end{std::get<0>(record_start),
+                                             std::get<1>(record_start) + bamit::get_length(rec.cigar_sequence())};
+            if (record_start < end && record_end >= start) expected.push_back(rec.id());
+        }
+
+        std::vector<std::string> result{};
+        for (auto & rec : bamit::get_overlap_range(input_file, node_list, start, end))
+            result.push_back(rec.id());
+        EXPECT_EQ(result, expected);
+    }
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <cereal/archives/binary.hpp>
+
+#include <bamit/all.hpp>
+
+#include "tree_test_helpers.hpp"
+
+#include <sstream>
+
+TEST(tree_encoding, round_trip)
+{
+    for (std::filesystem::path input : {DATADIR"simulated_chr1_small_golden.bam",
+                                        DATADIR"simulated_mult_chr_small_golden.bam"})
+    {
+        std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(input);
+        size_t encoded_size{0};
+        for (auto const & node : node_list)
+        {
+            std::string encoded{};
+            bamit::encode_tree(node, encoded);
+            encoded_size += encoded.size();
+            compare_trees(bamit::decode_tree(encoded), node);
+        }
+
+        // The encoding is several times smaller than the cereal archive.
+        std::ostringstream archived{};
+        {
+            cereal::BinaryOutputArchive archive{archived};
+            bamit::write(node_list, archive);
+        }
+        EXPECT_LT(encoded_size * 3, archived.str().size());
+    }
+
+    std::string encoded{};
+    bamit::encode_tree(nullptr, encoded);
+    EXPECT_TRUE(encoded.empty());
+    EXPECT_EQ(bamit::decode_tree(encoded), nullptr);
+}
+
+TEST(tree_encoding, large_values)
+{
+    // Positions and file positions far apart are stored exactly.
+    auto root = std::make_unique<bamit::IntervalNode>();
+    root->set_start(0);
+    root->set_median(std::numeric_limits<uint32_t>::max() - 1);
+    root->set_end(std::numeric_limits<uint32_t>::max());
+    root->set_file_position(int64_t{1} << 50);
+    root->set_last_file_position((int64_t{1} << 50) + 5);
+    root->set_count(std::numeric_limits<uint32_t>::max());
+    root->get_left_node() = std::make_unique<bamit::IntervalNode>();
+    root->get_left_node()->set_start(7);
+    root->get_left_node()->set_median(8);
+    root->get_left_node()->set_end(9);
+    root->get_left_node()->set_count(1);
+    bamit::count_subtree(*root->get_left_node());
+    bamit::count_subtree(*root);
+
+    std::string encoded{};
+    bamit::encode_tree(root, encoded);
+    compare_trees(bamit::decode_tree(encoded), root);
+
+    // Truncated or trailing bytes are rejected.
+    EXPECT_THROW(bamit::decode_tree(std::string_view{encoded}.substr(0, encoded.size() - 1)), std::runtime_error);
+    EXPECT_THROW(bamit::decode_tree(encoded + '\0'), std::runtime_error);
+    EXPECT_THROW(bamit::decode_tree(std::string(20, '\xff')), std::runtime_error);
+}
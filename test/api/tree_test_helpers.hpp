@@ -0,0 +1,20 @@
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include <bamit/IntervalNode.hpp>
+
+// Recursive function to check that two trees are identical, including the record counts of their nodes.
+inline void compare_trees(std::unique_ptr<bamit::IntervalNode> const & t1,
+                          std::unique_ptr<bamit::IntervalNode> const & t2)
+{
+    ASSERT_EQ(t1 == nullptr, t2 == nullptr);
+    if (!t1) return;
+
+    EXPECT_EQ(std::make_tuple(t1->get_start(), t1->get_end(), t1->get_file_position(), t1->get_last_file_position()),
+              std::make_tuple(t2->get_start(), t2->get_end(), t2->get_file_position(), t2->get_last_file_position()));
+    EXPECT_EQ(std::make_tuple(t1->get_median(), t1->get_count(), t1->get_subtree_count()),
+              std::make_tuple(t2->get_median(), t2->get_count(), t2->get_subtree_count()));
+    compare_trees(t1->get_left_node(), t2->get_left_node());
+    compare_trees(t1->get_right_node(), t2->get_right_node());
+}
@@ -46,3 +46,64 @@ TEST(write_read_test, write_read_test)
         EXPECT_EQ(result[i].id(), result_after_reading[i].id());
     }
 }
+
+TEST(write_read_test, unversioned_index)
+{
+    std::filesystem::path tmp = std::filesystem::temp_directory_path()/"intervaltree_unversioned";
+    std::filesystem::path input{DATADIR"simulated_mult_chr_small_golden.bam"};
+    seqan3::sam_file_input sam_in{input};
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(sam_in);
+
+    // Index files written before the nodes were versioned start directly with the trees, whose nodes lack the median,
+    // the record counts and the last file position.
+    {
+        std::ofstream out{tmp, std::ios_base::binary | std::ios_base::out};
+        cereal::BinaryOutputArchive ar_out(out);
+        auto write_node = [&ar_out] (auto & self, std::unique_ptr<bamit::IntervalNode> const & node) -> void
+        {
+            ar_out(static_cast<uint8_t>(node != nullptr));
+            if (!node) return;
+            ar_out(node->get_start(), node->get_end());
+            self(self, node->get_left_node());
+            self(self, node->get_right_node());
+            ar_out(node->get_file_position());
+        };
+        ar_out(static_cast<uint64_t>(node_list.size()));
+        for (auto const & node : node_list)
+            write_node(write_node, node);
+    }
+
+    std::ifstream in{tmp, std::ios_base::binary | std::ios_base::in};
+    cereal::BinaryInputArchive ar_in(in);
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list_read{};
+    bamit::LinearIndex linear_index{};
+    bamit::read(node_list_read, linear_index, ar_in);
+    ASSERT_EQ(node_list_read.size(), node_list.size());
+    for (size_t i = 0; i < node_list.size(); ++i)
+    {
+        EXPECT_EQ(node_list_read[i]->get_start(), node_list[i]->get_start());
+        EXPECT_EQ(node_list_read[i]->get_file_position(), node_list[i]->get_file_position());
+        EXPECT_EQ(bamit::has_record_counts(node_list_read[i].get()), node_list[i]->get_subtree_count() == 0);
+        EXPECT_TRUE(bamit::has_record_counts(node_list[i].get()));
+    }
+
+    // The queries fall back to reading the records, and find the same ones.
+    bamit::BamScanner scanner{input};
+    for (auto const & [start, end] : {std::pair<bamit::Position, bamit::Position>{{0, 0}, {0, 500}}, {{0, 900}, {1, 50}},
+                                      {{1, 100}, {1, 150}}, {{0, 1500}, {0, 1500}}})
+    {
+        size_t const expected = bamit::get_overlap_count(scanner, node_list, start, end);
+        EXPECT_EQ(bamit::get_overlap_count(scanner, node_list_read, start, end), expected);
+        EXPECT_EQ(bamit::get_overlap_count_bounds(node_list_read, start, end).upper,
+                  std::numeric_limits<uint64_t>::max());
+
+        std::vector<std::string> ids{};
+        bamit::read_overlap_chunks(sam_in, bamit::get_overlap_chunks(node_list_read, start, end), start, end,
+                                   [&ids] (auto const & record) { ids.push_back(record.id()); });
+        EXPECT_EQ(ids.size(), expected);
+        auto result = bamit::get_overlap_records(sam_in, node_list_read, start, end);
+        ASSERT_EQ(result.size(), ids.size());
+        for (size_t i = 0; i < ids.size(); ++i)
+            EXPECT_EQ(result[i].id(), ids[i]);
+    }
+}
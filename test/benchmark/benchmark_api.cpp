@@ -54,8 +54,7 @@ void endTimeMessage(std::string msg)
 void get_random_position(bamit::Position & start, bamit::Position & end,
                          seqan3::sam_file_header<std::deque<std::string>> & header)
 {
-    std::random_device rd; // obtain a random number from hardware
-    std::mt19937 gen(rd()); // seed the generator
+    static std::mt19937 gen(42); // fixed seed, so that every run uses the same queries
     std::uniform_int_distribution<> distr_start(0, header.ref_ids().size() - 1); // define the range
     uint32_t rand_chr_start = distr_start(gen); // Get start random chromosome.
     std::uniform_int_distribution<> distr_end(rand_chr_start, std::min((rand_chr_start+1), static_cast<uint32_t>(header.ref_ids().size() - 1))); // define the range
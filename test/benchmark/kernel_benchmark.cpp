@@ -0,0 +1,306 @@
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <bamit/all.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include <chrono>
+#include <random>
+#include <sstream>
+
+// Micro benchmarks of the index kernels on synthetic, coordinate sorted records. All inputs are generated from fixed
+// seeds, so every run measures the same work. Each benchmark prints one tab-separated line
+//     BENCHMARK <name> <workload> <items> <min ns per item> <median ns per item>
+// and records the same values as test properties, which are written by --gtest_output=json:<file>.
+// The number of records can be set with the environment variable BAMIT_BENCHMARK_RECORDS.
+
+// A synthetic data set: the number of records, their read-length distribution and the sequencing depth.
+struct Workload
+{
+    std::string name;
+    size_t record_count;
+    uint32_t min_length;
+    uint32_t max_length;
+    uint32_t depth;
+};
+
+size_t record_count()
+{
+    char const * env = std::getenv("BAMIT_BENCHMARK_RECORDS");
+    return env ? std::stoull(env) : 1000000;
+}
+
+std::vector<Workload> workloads()
+{
+    size_t const n = record_count();
+    return {{"short_30x", n, 100, 150, 30}, {"short_300x", n, 100, 150, 300}, {"long_30x", n / 10, 1000, 30000, 30}};
+}
+
+// Coordinate sorted records with uniformly distributed starts and lengths. File positions increase like the virtual
+// offsets of a BAM file with records of 300 bytes.
+std::vector<bamit::Record> simulate_records(Workload const & workload, uint32_t const seed)
+{
+    std::mt19937 gen(seed);
+    uint64_t const mean_length = (workload.min_length + workload.max_length) / 2;
+    uint32_t const chromosome_length = std::max<uint64_t>(workload.record_count * mean_length / workload.depth, 1);
+    std::uniform_int_distribution<uint32_t> distr_start(0, chromosome_length - 1);
+    std::uniform_int_distribution<uint32_t> distr_length(workload.min_length, workload.max_length);
+    std::vector<bamit::Record> records{};
+    records.reserve(workload.record_count);
+    for (size_t i = 0; i < workload.record_count; ++i)
+    {
+        uint32_t start = distr_start(gen);
+        records.emplace_back(start, start + distr_length(gen), 0);
+    }
+    std::sort(records.begin(), records.end(), bamit::RecordComparatorStart{});
+    for (size_t i = 0; i < records.size(); ++i)
+        records[i].file_position = static_cast<std::streamoff>(((i / 200) << 16) | ((i % 200) * 300));
+    return records;
+}
+
+// Random query intervals of up to 1000 bases within the records.
+std::vector<std::pair<uint32_t, uint32_t>> simulate_queries(std::vector<bamit::Record> const & records,
+                                                            size_t const count,
+                                                            uint32_t const seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<uint32_t> distr_start(0, records.back().start);
+    std::uniform_int_distribution<uint32_t> distr_length(0, 1000);
+    std::vector<std::pair<uint32_t, uint32_t>> queries{};
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t start = distr_start(gen);
+        queries.emplace_back(start, start + distr_length(gen));
+    }
+    return queries;
+}
+
+// Run a kernel several times and report the minimum and median time per item. setup is not timed.
+template <typename setup_type, typename kernel_type>
+void measure(std::string const & name, std::string const & workload, size_t const items,
+             setup_type && setup, kernel_type && kernel)
+{
+    constexpr size_t repetitions{5};
+    std::vector<double> times{};
+    for (size_t i = 0; i < repetitions; ++i)
+    {
+        setup();
+        auto begin = std::chrono::steady_clock::now();
+        kernel();
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::nano>(end - begin).count() / items);
+    }
+    std::sort(times.begin(), times.end());
+    std::cout << "BENCHMARK\t" << name << '\t' << workload << '\t' << items << '\t'
+              << times.front() << '\t' << times[repetitions / 2] << '\n';
+    testing::Test::RecordProperty(name + "." + workload + ".min_ns", std::to_string(times.front()));
+    testing::Test::RecordProperty(name + "." + workload + ".median_ns", std::to_string(times[repetitions / 2]));
+}
+
+// Write records of one chromosome to a BAM file. The records have a name and a cigar string, but no sequence.
+void write_bam(std::filesystem::path const & path, std::vector<bamit::Record> const & records)
+{
+    std::string data{"BAM\1"};
+    auto put = [&data] (auto const value) { data.append(reinterpret_cast<char const *>(&value), sizeof(value)); };
+    uint32_t const length = std::ranges::max(records, {}, &bamit::Record::end).end + 1;
+    std::string const header_text{"@HD\tVN:1.6\tSO:coordinate\n@SQ\tSN:chr1\tLN:" + std::to_string(length) + "\n"};
+    put(static_cast<int32_t>(header_text.size()));
+    data += header_text;
+    put(int32_t{1});
+    put(int32_t{5});
+    data.append("chr1", 5);
+    put(length);
+
+    std::ofstream out{path, std::ios_base::binary};
+    std::vector<char> compressed(bamit::bgzf_max_block_size);
+    auto write_block = [&] (char const * block, size_t const size)
+    {
+        z_stream stream{};
+        deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(block));
+        stream.avail_in = size;
+        stream.next_out = reinterpret_cast<Bytef *>(compressed.data() + 18);
+        stream.avail_out = compressed.size() - 26;
+        ASSERT_EQ(deflate(&stream, Z_FINISH), Z_STREAM_END);
+        size_t const total = 26 + stream.total_out;
+        deflateEnd(&stream);
+        char const header[18]{31, -117, 8, 4, 0, 0, 0, 0, 0, -1, 6, 0, 'B', 'C', 2, 0,
+                              static_cast<char>((total - 1) & 0xFF), static_cast<char>((total - 1) >> 8)};
+        std::memcpy(compressed.data(), header, 18);
+        uint32_t const crc = crc32(0, reinterpret_cast<Bytef const *>(block), size);
+        uint32_t const isize = size;
+        std::memcpy(compressed.data() + total - 8, &crc, 4);
+        std::memcpy(compressed.data() + total - 4, &isize, 4);
+        out.write(compressed.data(), total);
+    };
+    auto flush = [&] (size_t const keep)
+    {
+        size_t written{0};
+        for (; data.size() - written > keep; written += std::min<size_t>(data.size() - written, 0xff00))
+            write_block(data.data() + written, std::min<size_t>(data.size() - written, 0xff00));
+        data.erase(0, written);
+    };
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        std::string const name = "r" + std::to_string(i);
+        put(static_cast<int32_t>(32 + name.size() + 1 + 4));
+        put(int32_t{0});
+        put(static_cast<int32_t>(records[i].start));
+        put(static_cast<uint8_t>(name.size() + 1));
+        put(uint8_t{60});
+        put(uint16_t{4680});
+        put(uint16_t{1});
+        put(uint16_t{0});
+        put(int32_t{0});
+        put(int32_t{-1});
+        put(int32_t{-1});
+        put(int32_t{0});
+        data.append(name.c_str(), name.size() + 1);
+        put(static_cast<uint32_t>((records[i].end - records[i].start) << 4));
+        flush(0xff00);
+    }
+    flush(0);
+    write_block(nullptr, 0);
+}
+
+TEST(kernel_benchmark, calculate_median)
+{
+    for (auto const & workload : workloads())
+    {
+        std::vector<bamit::Record> records = simulate_records(workload, 1);
+        std::vector<uint32_t> values{};
+        uint32_t median{};
+        // Small sets are selected in a buffer, large ones by counting.
+        std::span<bamit::Record const> small{records.data(), std::min<size_t>(records.size(), 10000)};
+        measure("calculate_median_buffer", workload.name, small.size(), [] {},
+                [&] { median = bamit::calculate_median(small, values); });
+        measure("calculate_median", workload.name, records.size(), [] {},
+                [&] { median = bamit::calculate_median(records, values); });
+        measure("calculate_median_sampled", workload.name, records.size(), [] {},
+                [&] { median = bamit::calculate_median(records, values, 10000); });
+        EXPECT_GT(median, 0u);
+    }
+}
+
+TEST(kernel_benchmark, construct_tree)
+{
+    for (auto const & workload : workloads())
+    {
+        std::vector<bamit::Record> const records = simulate_records(workload, 2);
+        std::vector<bamit::Record> copy{};
+        std::unique_ptr<bamit::IntervalNode> root{};
+        measure("construct_tree", workload.name, records.size(), [&] { copy = records; root.reset(); },
+                [&] { bamit::construct_tree(root, copy); });
+
+        std::vector<bamit::CompactRecord> compact_copy{};
+        measure("construct_tree_compact", workload.name, records.size(),
+                [&]
+                {
+                    compact_copy.clear();
+                    for (uint32_t i = 0; i < records.size(); ++i)
+                        compact_copy.push_back(bamit::CompactRecord{records[i].start, records[i].end, i});
+                    root.reset();
+                },
+                [&] { bamit::construct_tree<bamit::CompactRecord>(root, compact_copy); });
+
+        bamit::ThreadPool pool{4};
+        measure("construct_tree_4_threads", workload.name, records.size(), [&] { copy = records; root.reset(); },
+                [&] { bamit::construct_tree(root, copy, pool); });
+        EXPECT_TRUE(root);
+    }
+}
+
+TEST(kernel_benchmark, get_current_file_position)
+{
+    for (auto const & workload : workloads())
+    {
+        std::vector<bamit::Record> records = simulate_records(workload, 3);
+        auto const queries = simulate_queries(records, 100000, 4);
+        std::vector<std::unique_ptr<bamit::IntervalNode>> node_list(1);
+        bamit::construct_tree(node_list[0], records);
+        std::vector<bamit::FlatIntervalTree> flat_list = bamit::flatten(node_list);
+
+        std::streamoff checksum{0};
+        measure("get_current_file_position", workload.name, queries.size(), [] {}, [&]
+        {
+            for (auto const & [start, end] : queries)
+            {
+                std::streamoff file_position{-1};
+                bamit::get_current_file_position(node_list[0], start, end, file_position);
+                checksum += file_position;
+            }
+        });
+        measure("get_current_file_position_flat", workload.name, queries.size(), [] {}, [&]
+        {
+            for (auto const & [start, end] : queries)
+            {
+                std::streamoff file_position{-1};
+                bamit::get_current_file_position(flat_list[0], start, end, file_position);
+                checksum -= file_position;
+            }
+        });
+        EXPECT_EQ(checksum, 0);
+    }
+}
+
+TEST(kernel_benchmark, get_correct_position)
+{
+    // Seeking and scanning reads the file, so a smaller data set is used.
+    Workload const workload{"short_30x", std::min<size_t>(record_count(), 200000), 100, 150, 30};
+    std::vector<bamit::Record> records = simulate_records(workload, 5);
+    auto const queries = simulate_queries(records, 1000, 6);
+    std::filesystem::path const path{OUTPUTDIR"kernel_benchmark.bam"};
+    write_bam(path, records);
+
+    std::vector<std::unique_ptr<bamit::IntervalNode>> node_list = bamit::index(path);
+    std::vector<std::streamoff> tree_positions{};
+    for (auto const & [start, end] : queries)
+    {
+        std::streamoff file_position{-1};
+        bamit::get_current_file_position(node_list[0], start, end, file_position);
+        tree_positions.push_back(file_position);
+    }
+
+    seqan3::sam_file_input input{path};
+    size_t found{0};
+    measure("get_correct_position", workload.name, queries.size(), [&] { found = 0; }, [&]
+    {
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            std::streamoff file_position = tree_positions[i];
+            if (file_position == -1) continue;
+            bamit::get_correct_position(input, bamit::Position{0, queries[i].first}, file_position);
+            found += file_position != -1;
+        }
+    });
+    EXPECT_GT(found, 0u);
+    std::filesystem::remove(path);
+}
+
+TEST(kernel_benchmark, serialization)
+{
+    for (auto const & workload : workloads())
+    {
+        std::vector<bamit::Record> records = simulate_records(workload, 7);
+        std::vector<std::unique_ptr<bamit::IntervalNode>> node_list(1);
+        bamit::construct_tree(node_list[0], records);
+
+        std::stringstream stream{};
+        measure("write", workload.name, records.size(), [&] { stream = std::stringstream{}; }, [&]
+        {
+            cereal::BinaryOutputArchive archive(stream);
+            bamit::write(node_list, archive);
+        });
+        std::string const serialized = stream.str();
+
+        std::vector<std::unique_ptr<bamit::IntervalNode>> read_list{};
+        measure("read", workload.name, records.size(), [&] { stream.clear(); stream.str(serialized); read_list.clear(); }, [&]
+        {
+            cereal::BinaryInputArchive archive(stream);
+            bamit::read(read_list, archive);
+        });
+        ASSERT_EQ(read_list.size(), 1u);
+        EXPECT_EQ(read_list[0]->get_file_position(), node_list[0]->get_file_position());
+    }
+}